@@ -10,6 +10,7 @@
 #define fibio_http_client_client_hpp
 
 #include <string>
+#include <chrono>
 #include <functional>
 #include <fibio/stream/iostream.hpp>
 #include <fibio/stream/ssl.hpp>
@@ -21,6 +22,7 @@ namespace fibio { namespace http {
     struct client {
         typedef fibio::http::client_request request;
         typedef fibio::http::client_response response;
+        typedef std::chrono::steady_clock::duration timeout_type;
         
         client()=default;
         client(const std::string &server, const std::string &port);
@@ -38,14 +40,30 @@ namespace fibio { namespace http {
         void set_auto_decompress(bool c);
         bool get_auto_decompress() const;
         
+        // Max time to wait for 100 Continue, the body is sent anyway afterward
+        void set_continue_timeout(timeout_type t);
+        timeout_type get_continue_timeout() const;
+        
         bool send_request(request &req, response &resp);
         
+        void reset_input_buffer();
+        
+        // Wait until a response starts to arrive, false on timeout
+        bool wait_readable(timeout_type timeout);
+        
         std::string server_;
         std::string port_;
-        ssl::context *ctx_;
+        ssl::context *ctx_=nullptr;
         //stream::tcp_stream stream_;
         stream::fiberized_iostream_base *stream_;
+        // Responses are read through the buffer, leftover bytes stay for next response
+        std::unique_ptr<common::input_buffer> input_buffer_;
+        std::unique_ptr<std::istream> input_stream_;
         bool auto_decompress_=false;
+        timeout_type continue_timeout_=std::chrono::seconds(1);
+        // Request body was announced with 100-continue but never sent, the
+        // connection can't carry another request
+        bool body_unsent_=false;
     };
     
     // GET
@@ -95,11 +113,11 @@ namespace fibio { namespace http {
                 the_client_->send_request(the_request_, the_response_);
             }
             if (max_redirection>0) {
-                auto i=the_response_.headers.find("location");
+                auto i=the_response_.headers.find(header_id::LOCATION);
                 if (static_cast<uint16_t>(the_response_.status_code) / 100 == 3
                     && i != the_response_.headers.end()) {
                     // 3xx redirect with "Location" header
-                    return request(i->second, hdr, max_redirection-1);
+                    return request(to_string(i->second), hdr, max_redirection-1);
                 }
             }
             return the_response_;
@@ -119,17 +137,17 @@ namespace fibio { namespace http {
                 url_encode(body, std::ostreambuf_iterator<char>(the_request_.body_stream()));
                 if (!hdr.empty()) the_request_.headers.insert(hdr.begin(), hdr.end());
                 the_client_->send_request(the_request_, the_response_);
-                auto i=the_response_.headers.find("location");
+                auto i=the_response_.headers.find(header_id::LOCATION);
                 if (max_redirection>0) {
                     if (static_cast<uint16_t>(the_response_.status_code) / 100 == 3
                         && i != the_response_.headers.end()) {
                         // 3xx redirect with "Location" header
                         if (the_response_.status_code==http_status_code::TEMPORARY_REDIRECT) {
                             // 307 needs to resend request with original method
-                            return request(i->second, body, hdr, max_redirection-1);
+                            return request(to_string(i->second), body, hdr, max_redirection-1);
                         } else {
                             // Other 3xx uses "POST-Redirection-GET"
-                            return request(i->second, hdr, max_redirection-1);
+                            return request(to_string(i->second), hdr, max_redirection-1);
                         }
                     }
                 }
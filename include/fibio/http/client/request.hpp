@@ -34,6 +34,13 @@ namespace fibio { namespace http {
 
         bool write_header(std::ostream &os);
         bool write(std::ostream &os);
+        
+        // Header with Content-Length, and body, write() does both
+        bool write_head(std::ostream &os);
+        bool write_body(std::ostream &os);
+        
+        // Has "Expect: 100-continue", body is sent after server answers 100
+        bool expect_continue() const;
 
         boost::interprocess::basic_ovectorstream<std::string> raw_body_stream_;
     };
@@ -13,15 +13,17 @@
 #include <string>
 #include <boost/iostreams/restrict.hpp>
 #include <fibio/http/common/response.hpp>
+#include <fibio/http/common/chunked_stream.hpp>
 
 namespace fibio { namespace http {
     struct client_response : common::response {
         void clear();
         
-        bool read(std::istream &is);
+        // Response to HEAD has no body whatever its headers say
+        bool read(std::istream &is, bool head=false);
         
         inline bool has_body() const {
-            return content_length>0 && body_stream_.get();
+            return (content_length>0 || chunked) && body_stream_.get();
         }
         
         inline std::istream &body_stream() {
@@ -39,6 +41,8 @@ namespace fibio { namespace http {
         bool auto_decompress_=false;
         std::unique_ptr<boost::iostreams::restriction<std::istream>> restriction_;
         std::unique_ptr<std::istream> body_stream_;
+        std::unique_ptr<common::chunked_istreambuf> chunked_buf_;
+        std::unique_ptr<std::istream> chunked_stream_;
     };
 
     inline std::istream &operator>>(std::istream &is, client_response &v) {
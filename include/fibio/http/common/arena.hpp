@@ -0,0 +1,185 @@
+//
+//  arena.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/24.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_common_arena_hpp
+#define fibio_http_common_arena_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <list>
+#include <map>
+#include <utility>
+#include <type_traits>
+#include <scoped_allocator>
+#include <boost/utility/string_ref.hpp>
+
+namespace fibio { namespace http { namespace common {
+    constexpr size_t DEFAULT_ARENA_BLOCK_SIZE=4096;
+
+    struct arena_counters {
+        // Allocations served by arenas
+        uint64_t allocations=0;
+        // Blocks allocated from the heap
+        uint64_t heap_allocations=0;
+        // Usually one reset per request
+        uint64_t resets=0;
+    };
+
+    // Process-wide counters, arenas report to them on reset and destruction
+    arena_counters get_arena_counters();
+
+    /**
+     * Monotonic arena
+     *
+     * Memory is handed out from large blocks and released all at once by reset(),
+     * blocks are merged into one on reset so a steady workload needs no heap
+     * allocation at all.
+     */
+    struct arena {
+        explicit arena(size_t block_size=DEFAULT_ARENA_BLOCK_SIZE);
+        ~arena();
+
+        arena(const arena &)=delete;
+        arena &operator=(const arena &)=delete;
+
+        void *allocate(size_t size, size_t alignment);
+
+        // Objects allocated from the arena must be destroyed or released before reset
+        void reset();
+
+        // Reset and free all blocks, used when the owner goes idle
+        void release();
+
+        // Counters since last reset
+        const arena_counters &counters() const { return counters_; }
+
+    private:
+        struct block {
+            block *next;
+            size_t size;
+        };
+
+        void *allocate_slow(size_t size, size_t alignment);
+        void add_block(size_t size);
+        void free_blocks();
+        void report();
+
+        size_t block_size_;
+        block *blocks_=nullptr;
+        char *current_=nullptr;
+        char *end_=nullptr;
+        arena_counters counters_;
+    };
+
+    /**
+     * Allocator backed by an arena, falls back to the heap if the arena is null,
+     * so containers work without an arena as well
+     *
+     * Copies of a container are allocated from the heap as they may outlive the
+     * arena, moves keep the storage, and the arena along with it
+     */
+    template<typename T>
+    struct arena_allocator {
+        typedef T value_type;
+        typedef T *pointer;
+        typedef const T *const_pointer;
+        typedef T &reference;
+        typedef const T &const_reference;
+        typedef size_t size_type;
+        typedef ptrdiff_t difference_type;
+
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+
+        template<typename U>
+        struct rebind { typedef arena_allocator<U> other; };
+
+        arena_allocator(arena *a=nullptr) noexcept
+        : arena_(a)
+        {}
+
+        template<typename U>
+        arena_allocator(const arena_allocator<U> &other) noexcept
+        : arena_(other.arena_)
+        {}
+
+        T *allocate(size_t n) {
+            if (arena_) return static_cast<T *>(arena_->allocate(n*sizeof(T), alignof(T)));
+            return static_cast<T *>(::operator new(n*sizeof(T)));
+        }
+
+        void deallocate(T *p, size_t) noexcept {
+            // Arena memory is released all at once
+            if (!arena_) ::operator delete(p);
+        }
+
+        template<typename U, typename... Args>
+        void construct(U *p, Args&&... args) {
+            ::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+        }
+
+        template<typename U>
+        void destroy(U *p) { p->~U(); }
+
+        size_t max_size() const noexcept { return size_t(-1)/sizeof(T); }
+
+        arena_allocator select_on_container_copy_construction() const
+        { return arena_allocator(nullptr); }
+
+        arena *arena_;
+    };
+
+    template<typename T, typename U>
+    inline bool operator==(const arena_allocator<T> &lhs, const arena_allocator<U> &rhs)
+    { return lhs.arena_==rhs.arena_; }
+
+    template<typename T, typename U>
+    inline bool operator!=(const arena_allocator<T> &lhs, const arena_allocator<U> &rhs)
+    { return lhs.arena_!=rhs.arena_; }
+
+    typedef std::basic_string<char, std::char_traits<char>, arena_allocator<char>> arena_string;
+
+    // Elements are allocated from the same arena as the container
+    template<typename T>
+    using scoped_arena_allocator=std::scoped_allocator_adaptor<arena_allocator<T>>;
+
+    typedef std::list<arena_string, scoped_arena_allocator<arena_string>> arena_string_list;
+
+    typedef std::map<
+        arena_string,
+        arena_string,
+        std::less<arena_string>,
+        scoped_arena_allocator<std::pair<const arena_string, arena_string>>
+    > arena_string_map;
+
+    // Replace with an empty one using the same allocator, so no storage refers to the arena
+    template<typename Container>
+    inline void release(Container &c) {
+        Container(c.get_allocator()).swap(c);
+    }
+
+    // Comparisons with std::string, arena_string is found via ADL
+    inline bool operator==(const arena_string &lhs, const std::string &rhs)
+    { return boost::string_ref(lhs.data(), lhs.size())==boost::string_ref(rhs); }
+
+    inline bool operator==(const std::string &lhs, const arena_string &rhs)
+    { return rhs==lhs; }
+
+    inline bool operator!=(const arena_string &lhs, const std::string &rhs)
+    { return !(lhs==rhs); }
+
+    inline bool operator!=(const std::string &lhs, const arena_string &rhs)
+    { return !(rhs==lhs); }
+
+    inline std::string to_string(const arena_string &s)
+    { return std::string(s.data(), s.size()); }
+}}} // End of namespace fibio::http::common
+
+#endif
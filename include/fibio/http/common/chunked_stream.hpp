@@ -0,0 +1,152 @@
+//
+//  chunked_stream.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/29.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_common_chunked_stream_hpp
+#define fibio_http_common_chunked_stream_hpp
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include <streambuf>
+#include <boost/asio/buffer.hpp>
+#include <fibio/http/common/header_map.hpp>
+#include <fibio/http/common/input_buffer.hpp>
+
+namespace fibio { namespace http { namespace common {
+    constexpr size_t DEFAULT_CHUNK_SIZE=8192;
+
+    /**
+     * Output stream buffer emitting chunked transfer-coding
+     *
+     * Data is collected in a bounded buffer, each time it's full a chunk is passed
+     * to the writer as a gather list, large writes bypass the buffer and become one
+     * chunk, finish() sends the last chunk. With set_deflate() data goes through
+     * zlib before being framed, flushing the stream flushes the compressor too.
+     */
+    struct chunked_ostreambuf : std::streambuf {
+        // Returns false if the data cannot be written
+        typedef std::function<bool(std::vector<boost::asio::const_buffer> &)> writer_type;
+        // Called before the first chunk with its size, last is set if it's the whole body
+        typedef std::function<void(size_t size, bool last)> start_type;
+
+        explicit chunked_ostreambuf(size_t buffer_size=DEFAULT_CHUNK_SIZE);
+        ~chunked_ostreambuf();
+
+        chunked_ostreambuf(const chunked_ostreambuf &)=delete;
+        chunked_ostreambuf &operator=(const chunked_ostreambuf &)=delete;
+
+        // Start a new body, raw data is written without chunk framing if framing is false
+        void reset(writer_type writer, bool framing=true, start_type start=start_type());
+
+        /**
+         * Compress the rest of the body, window_bits is as in deflateInit2(), 15+16
+         * gives gzip, the compressor is kept for next bodies
+         */
+        bool set_deflate(int level, int window_bits);
+
+        // Send buffered data and the last chunk, returns false on write error
+        bool finish();
+
+        bool good() const { return good_; }
+
+    protected:
+        virtual int_type overflow(int_type c) override;
+        virtual std::streamsize xsputn(const char_type *s, std::streamsize n) override;
+        virtual int sync() override;
+
+    private:
+        struct deflater;
+
+        // Write out the buffer, sync also flushes the compressor
+        bool flush_buffer(bool sync);
+
+        // Two pieces of data as one chunk, followed by the last chunk if last is set
+        bool write(const char *p1, size_t n1, const char *p2, size_t n2, bool last, bool sync=false);
+
+        // Frame data as one chunk and pass it to the writer
+        bool send(const char *p1, size_t n1, const char *p2, size_t n2, bool last);
+
+        std::unique_ptr<char[]> buffer_;
+        size_t buffer_size_;
+        writer_type writer_;
+        start_type start_;
+        bool framing_=true;
+        bool good_=false;
+        bool started_=false;
+        std::vector<boost::asio::const_buffer> buffers_;
+        // "<hex size>\r\n"
+        char size_line_[20];
+        std::unique_ptr<deflater> deflater_;
+        bool deflating_=false;
+    };
+
+    /**
+     * Input stream buffer decoding chunked transfer-coding
+     *
+     * Works in place on the connection buffer, the get area points directly into
+     * buffered chunk data, so nothing is copied or allocated per chunk. Trailer
+     * fields are decoded into the map given to reset(). Reaches EOF after the
+     * trailer, or on malformed input, bytes after the body stay in the source.
+     */
+    struct chunked_istreambuf : std::streambuf {
+        chunked_istreambuf()=default;
+
+        chunked_istreambuf(const chunked_istreambuf &)=delete;
+        chunked_istreambuf &operator=(const chunked_istreambuf &)=delete;
+
+        /**
+         * Start decoding a new body from source
+         *
+         * If source is not an input_buffer, a temporary one is used, read-ahead bytes
+         * are given back to source by seeking at the end of the body
+         */
+        void reset(std::streambuf *source, header_map *trailers=nullptr);
+
+        // Whole body including trailer has been decoded
+        bool done() const { return state_==state::done; }
+
+        // Malformed chunk framing
+        bool failed() const { return state_==state::error; }
+        
+        // Body larger than n bytes fails as malformed, 0 means unlimited
+        void set_max_size(uint64_t n) { max_size_=n; }
+        
+        // Failed on max size
+        bool too_large() const { return too_large_; }
+
+    protected:
+        virtual int_type underflow() override;
+        virtual std::streamsize showmanyc() override;
+
+    private:
+        enum class state {
+            size,
+            data,
+            data_end,
+            trailer,
+            done,
+            error,
+        };
+
+        void release_window();
+        bool read_line(const char *&begin, const char *&end);
+        int_type finish(state s);
+
+        input_buffer *source_=nullptr;
+        std::unique_ptr<input_buffer> owned_source_;
+        header_map *trailers_=nullptr;
+        state state_=state::done;
+        uint64_t remaining_=0;
+        // Chunk data announced so far
+        uint64_t size_=0;
+        uint64_t max_size_=0;
+        bool too_large_=false;
+    };
+}}} // End of namespace fibio::http::common
+
+#endif
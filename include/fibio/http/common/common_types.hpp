@@ -10,10 +10,15 @@
 #define fibio_http_common_common_types_hpp
 
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <vector>
 #include <map>
 #include <chrono>
+#include <algorithm>
+#include <boost/utility/string_ref.hpp>
 #include <fibio/http/common/content_type.hpp>
+#include <fibio/http/common/arena.hpp>
 
 namespace fibio { namespace http { namespace common {
     enum class http_version : uint16_t {
@@ -108,20 +113,33 @@ namespace fibio { namespace http { namespace common {
     };
     
     typedef std::string header_key_type;
-    typedef std::string header_value_type;
+    // Values of owned headers live in the message arena, if any
+    typedef arena_string header_value_type;
+    
+    /**
+     * Non-owning reference to a piece of string, i.e. part of the raw header block
+     */
+    typedef boost::string_ref string_view;
     
     struct iless {
         inline bool operator()(const header_key_type &lhs, const header_key_type &rhs) const
         { return strcasecmp(lhs.c_str(), rhs.c_str())<0; }
+        
+        inline bool operator()(const string_view &lhs, const string_view &rhs) const {
+            int r=strncasecmp(lhs.data(), rhs.data(), std::min(lhs.size(), rhs.size()));
+            return r<0 || (r==0 && lhs.size()<rhs.size());
+        }
     };
     
     struct iequal {
         inline bool operator()(const header_key_type &lhs, const header_key_type &rhs) const
         { return strcasecmp(lhs.c_str(), rhs.c_str())==0; }
+        
+        inline bool operator()(const string_view &lhs, const string_view &rhs) const {
+            return lhs.size()==rhs.size() && strncasecmp(lhs.data(), rhs.data(), lhs.size())==0;
+        }
     };
 
-    typedef std::multimap<header_key_type, header_value_type, iless> header_map;
-    
     typedef std::chrono::steady_clock::duration timeout_type;
 }}} // End of namespace fibio::http::common
 
@@ -130,6 +148,7 @@ namespace fibio { namespace http {
     using common::http_method;
     using common::http_status_code;
     using common::timeout_type;
+    using common::string_view;
 }}  // End of namespace fibio::http
 
 
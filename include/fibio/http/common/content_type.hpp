@@ -9,6 +9,9 @@
 #ifndef fibio_http_common_content_type_hpp
 #define fibio_http_common_content_type_hpp
 
+#include <string>
+#include <boost/algorithm/string/predicate.hpp>
+
 namespace fibio { namespace http { namespace common {
     template<typename T>
     struct content_type {
@@ -25,6 +28,35 @@ namespace fibio { namespace http { namespace common {
         static constexpr const char *name="text/xml";
      };
      */
+    
+    // Content type of a file, guessed from its extension
+    inline const char *content_type_by_extension(const std::string &path) {
+        static constexpr const char *types[][2]={
+            {".html", "text/html"},
+            {".htm", "text/html"},
+            {".css", "text/css"},
+            {".js", "application/javascript"},
+            {".json", "application/json"},
+            {".xml", "text/xml"},
+            {".txt", "text/plain"},
+            {".png", "image/png"},
+            {".jpg", "image/jpeg"},
+            {".jpeg", "image/jpeg"},
+            {".gif", "image/gif"},
+            {".svg", "image/svg+xml"},
+            {".ico", "image/x-icon"},
+            {".pdf", "application/pdf"},
+            {".zip", "application/zip"},
+            {".gz", "application/gzip"},
+            {".mp4", "video/mp4"},
+            {".mp3", "audio/mpeg"},
+            {".woff", "application/font-woff"},
+        };
+        for (auto &t : types) {
+            if (boost::algorithm::iends_with(path, t[0])) return t[1];
+        }
+        return "application/octet-stream";
+    }
 }}} // End of namespace fibio::http::common
 
 #endif
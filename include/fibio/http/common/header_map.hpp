@@ -0,0 +1,265 @@
+//
+//  header_map.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/22.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_common_header_map_hpp
+#define fibio_http_common_header_map_hpp
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+#include <fibio/http/common/common_types.hpp>
+#include <fibio/http/common/arena.hpp>
+
+namespace fibio { namespace http { namespace common {
+    /**
+     * Well-known header fields, resolved once when a header is inserted
+     */
+    enum class header_id : uint8_t {
+        UNKNOWN=0,
+        ACCEPT,
+        ACCEPT_ENCODING,
+        ACCEPT_RANGES,
+        AUTHORIZATION,
+        CACHE_CONTROL,
+        CONNECTION,
+        CONTENT_DISPOSITION,
+        CONTENT_ENCODING,
+        CONTENT_LENGTH,
+        CONTENT_RANGE,
+        CONTENT_TYPE,
+        COOKIE,
+        DATE,
+        ETAG,
+        EXPECT,
+        HOST,
+        IF_MODIFIED_SINCE,
+        IF_NONE_MATCH,
+        IF_RANGE,
+        LAST_MODIFIED,
+        LOCATION,
+        RANGE,
+        RETRY_AFTER,
+        SET_COOKIE,
+        TRANSFER_ENCODING,
+        UPGRADE,
+        USER_AGENT,
+        VARY,
+    };
+
+    constexpr size_t header_id_count=static_cast<size_t>(header_id::VARY)+1;
+
+    /**
+     * Resolve header name to well-known id, case-insensitive
+     */
+    header_id lookup_header_id(const string_view &name);
+
+    /**
+     * Case-insensitive FNV-1a hash of header name
+     */
+    inline uint32_t header_hash(const string_view &name) {
+        uint32_t h=2166136261u;
+        for (char c : name) {
+            // ASCII only, header names are tokens
+            h^=static_cast<uint8_t>((c>='A' && c<='Z') ? (c|0x20) : c);
+            h*=16777619u;
+        }
+        return h;
+    }
+
+    /**
+     * Flat header container
+     *
+     * Headers are kept in inserting order in a vector, well-known headers are indexed
+     * by id so lookup is O(1), other headers are compared by hash first.
+     * Multiple headers with same name are allowed, find returns the first one.
+     */
+    template<typename String, typename Allocator=std::allocator<String>>
+    struct basic_header_map {
+        typedef String key_type;
+        typedef String mapped_type;
+
+        struct value_type : std::pair<String, String> {
+            typedef std::pair<String, String> base_type;
+
+            template<typename K, typename V>
+            value_type(K &&k, V &&v)
+            : base_type(std::forward<K>(k), std::forward<V>(v))
+            , id(lookup_header_id(string_view(this->first)))
+            , hash(id==header_id::UNKNOWN ? header_hash(string_view(this->first)) : 0)
+            {}
+
+            // Don't change the name, id and hash are not updated
+            header_id id;
+            uint32_t hash;
+        };
+
+        typedef typename std::allocator_traits<Allocator>::template rebind_alloc<value_type> allocator_type;
+        typedef std::vector<value_type, allocator_type> container_type;
+        typedef typename container_type::iterator iterator;
+        typedef typename container_type::const_iterator const_iterator;
+
+        // Typical request/response has less headers than this
+        static constexpr size_t initial_capacity=16;
+
+        explicit basic_header_map(const allocator_type &a=allocator_type())
+        : fields_(a)
+        {
+            index_.fill(0);
+        }
+
+        allocator_type get_allocator() const { return fields_.get_allocator(); }
+
+        iterator begin() { return fields_.begin(); }
+        iterator end() { return fields_.end(); }
+        const_iterator begin() const { return fields_.begin(); }
+        const_iterator end() const { return fields_.end(); }
+        size_t size() const { return fields_.size(); }
+        bool empty() const { return fields_.empty(); }
+
+        // Keep capacity, containers are reused across requests
+        void clear() {
+            fields_.clear();
+            index_.fill(0);
+        }
+
+        // Release storage if it grows beyond limit bytes
+        void shrink(size_t limit) {
+            if (fields_.capacity()*sizeof(value_type)>limit) {
+                container_type(fields_.get_allocator()).swap(fields_);
+            }
+        }
+
+        void swap(basic_header_map &other) {
+            fields_.swap(other.fields_);
+            index_.swap(other.index_);
+        }
+
+        // Braced pairs, i.e. {"Content-Type", ct}
+        iterator insert(const std::pair<string_view, string_view> &v) {
+            return emplace(v.first, v.second);
+        }
+
+        template<typename K, typename V>
+        iterator insert(const std::pair<K, V> &v) {
+            return emplace(v.first, v.second);
+        }
+
+        template<typename Iterator>
+        void insert(Iterator first, Iterator last) {
+            for (; first!=last; ++first) {
+                emplace(first->first, first->second);
+            }
+        }
+
+        template<typename K, typename V>
+        iterator emplace(K &&k, V &&v) {
+            if (fields_.capacity()==0) fields_.reserve(initial_capacity);
+            fields_.emplace_back(make_field(std::forward<K>(k)), make_field(std::forward<V>(v)));
+            size_t id=static_cast<size_t>(fields_.back().id);
+            if (id!=0 && index_[id]==0) {
+                // Index first occurrence only
+                index_[id]=fields_.size();
+            }
+            return fields_.end()-1;
+        }
+
+        iterator find(header_id id) {
+            size_t i=index_[static_cast<size_t>(id)];
+            return (id==header_id::UNKNOWN || i==0) ? end() : begin()+(i-1);
+        }
+
+        const_iterator find(header_id id) const {
+            size_t i=index_[static_cast<size_t>(id)];
+            return (id==header_id::UNKNOWN || i==0) ? end() : begin()+(i-1);
+        }
+
+        iterator find(const string_view &key) {
+            header_id id=lookup_header_id(key);
+            if (id!=header_id::UNKNOWN) return find(id);
+            uint32_t h=header_hash(key);
+            return std::find_if(begin(), end(), [&](const value_type &v){
+                return v.hash==h && iequal()(string_view(v.first), key);
+            });
+        }
+
+        const_iterator find(const string_view &key) const {
+            return const_cast<basic_header_map *>(this)->find(key);
+        }
+
+        size_t count(const string_view &key) const {
+            header_id id=lookup_header_id(key);
+            uint32_t h=(id==header_id::UNKNOWN) ? header_hash(key) : 0;
+            return std::count_if(begin(), end(), [&](const value_type &v){
+                return v.id==id && v.hash==h && (id!=header_id::UNKNOWN || iequal()(string_view(v.first), key));
+            });
+        }
+
+        // Remove all headers with the name
+        size_t erase(const string_view &key) {
+            header_id id=lookup_header_id(key);
+            uint32_t h=(id==header_id::UNKNOWN) ? header_hash(key) : 0;
+            size_t n=fields_.size();
+            fields_.erase(std::remove_if(fields_.begin(), fields_.end(), [&](const value_type &v){
+                return v.id==id && v.hash==h && (id!=header_id::UNKNOWN || iequal()(string_view(v.first), key));
+            }), fields_.end());
+            n-=fields_.size();
+            if (n>0) reindex();
+            return n;
+        }
+
+        // Owning strings are copied into storage from the map's allocator
+        template<typename T>
+        String make_field(T &&v) {
+            return make_field(std::forward<T>(v), std::uses_allocator<String, allocator_type>());
+        }
+
+        template<typename T>
+        String make_field(T &&v, std::true_type) {
+            string_view sv(v);
+            return String(sv.data(), sv.size(), typename String::allocator_type(fields_.get_allocator()));
+        }
+
+        template<typename T>
+        String make_field(T &&v, std::false_type) {
+            return String(std::forward<T>(v));
+        }
+
+        void reindex() {
+            index_.fill(0);
+            for (size_t i=0; i<fields_.size(); i++) {
+                size_t id=static_cast<size_t>(fields_[i].id);
+                if (id!=0 && index_[id]==0) index_[id]=i+1;
+            }
+        }
+
+        container_type fields_;
+        // Position+1 of first header with the id, 0 if not exists
+        std::array<uint16_t, header_id_count> index_;
+    };
+
+    // Field storage and names/values come from the arena if the map is constructed with one
+    typedef basic_header_map<header_value_type, arena_allocator<header_value_type>> header_map;
+
+    /**
+     * Headers as views into the raw header block
+     *
+     * Views are only valid while the underlying storage is alive, i.e. until next
+     * request is read from the same connection
+     */
+    typedef basic_header_map<string_view> header_view_map;
+}}} // End of namespace fibio::http::common
+
+namespace fibio { namespace http {
+    using common::header_id;
+}}  // End of namespace fibio::http
+
+#endif
@@ -0,0 +1,136 @@
+//
+//  input_buffer.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/20.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_common_input_buffer_hpp
+#define fibio_http_common_input_buffer_hpp
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <streambuf>
+#include <fibio/mutex.hpp>
+
+namespace fibio { namespace http { namespace common {
+    constexpr size_t DEFAULT_READ_BUFFER_SIZE=8192;
+    constexpr size_t DEFAULT_MAX_READ_BUFFER_SIZE=65536;
+
+    /**
+     * Free list of read buffers shared by connections
+     *
+     * Idle connections give their buffers back, so memory is only held by
+     * connections with a request in progress
+     */
+    struct buffer_pool {
+        explicit buffer_pool(size_t block_size=DEFAULT_READ_BUFFER_SIZE, size_t max_free=1024);
+
+        buffer_pool(const buffer_pool &)=delete;
+        buffer_pool &operator=(const buffer_pool &)=delete;
+
+        std::unique_ptr<char[]> acquire();
+
+        // Block must be block_size() bytes, it's freed if the pool is full
+        void release(std::unique_ptr<char[]> b);
+
+        size_t block_size() const { return block_size_; }
+
+    private:
+        // Connections are served by fibers, waiting yields instead of blocking
+        mutex mtx_;
+        std::vector<std::unique_ptr<char[]>> free_;
+        size_t block_size_;
+        size_t max_free_;
+    };
+
+    /**
+     * Connection level input buffer
+     *
+     * Data is read from the underlying stream buffer in large blocks, header parser
+     * works directly on buffered data, body stream consumes from the same buffer via
+     * std::istream interface, and leftover bytes stay for the next (pipelined) request.
+     *
+     * The header block of current request is pinned at the beginning of the buffer,
+     * so header views stay valid while the body is being read.
+     */
+    struct input_buffer : std::streambuf {
+        input_buffer(std::streambuf *source,
+                     size_t initial_size=DEFAULT_READ_BUFFER_SIZE,
+                     size_t max_size=DEFAULT_MAX_READ_BUFFER_SIZE,
+                     buffer_pool *pool=nullptr);
+
+        ~input_buffer();
+
+        input_buffer(const input_buffer &)=delete;
+        input_buffer &operator=(const input_buffer &)=delete;
+
+        // Unconsumed data
+        const char *data() const { return gptr(); }
+        size_t size() const { return egptr()-gptr(); }
+
+        void consume(size_t n);
+
+        /**
+         * Read more data from the source, returns number of bytes read
+         *
+         * Unconsumed data may be moved, either by compaction or growing, returns 0 if
+         * the source reaches EOF or the buffer cannot grow beyond max_size
+         */
+        size_t fill();
+
+        // Buffer is full and cannot grow any more
+        bool full() const;
+
+        // Keep consumed bytes from the beginning of the buffer till current position
+        void pin();
+
+        // Release pinned bytes and move unconsumed data to the beginning of the buffer
+        void unpin();
+
+        /**
+         * Give unconsumed data back to the source by seeking backward
+         *
+         * Only works if the source supports seeking, used when the buffer is temporary
+         */
+        bool unread();
+
+        /**
+         * Give storage back to the pool, only if there is no unconsumed data
+         *
+         * Buffer must be restored by unpark() before reading
+         */
+        bool park();
+
+        void unpark();
+
+        bool parked() const { return !buffer_; }
+
+        size_t capacity() const { return capacity_; }
+        size_t max_size() const { return max_size_; }
+        std::streambuf *source() const { return source_; }
+
+    protected:
+        virtual int_type underflow() override;
+        virtual std::streamsize xsgetn(char_type *s, std::streamsize n) override;
+        virtual std::streamsize showmanyc() override;
+
+    private:
+        std::streamsize read_some(char *p, std::streamsize n);
+        void compact();
+        void grow(size_t new_capacity);
+        void release_buffer();
+
+        std::streambuf *source_;
+        buffer_pool *pool_;
+        std::unique_ptr<char[]> buffer_;
+        size_t initial_size_;
+        size_t capacity_;
+        size_t max_size_;
+        size_t pinned_=0;
+    };
+}}} // End of namespace fibio::http::common
+
+#endif
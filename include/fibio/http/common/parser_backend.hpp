@@ -0,0 +1,45 @@
+//
+//  parser_backend.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/23.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_common_parser_backend_hpp
+#define fibio_http_common_parser_backend_hpp
+
+#include <cstdint>
+
+namespace fibio { namespace http { namespace common {
+    /**
+     * Header parser implementations
+     *
+     * SSE4_2 and AVX2 scan for CRLF, ':' and invalid characters 16 or 32 bytes at a
+     * time, anything unusual (line folding, chunked encoding, upgrade, etc.) is handed
+     * over to http_parser, so all backends produce the same result.
+     * SIMD backends can be disabled at build time with FIBIO_HTTP_NO_SIMD_PARSER.
+     * test/bench_parser.cpp measures all backends supported by the machine.
+     */
+    enum class parser_backend : uint8_t {
+        AUTO=0,         // Best one supported by the build and the CPU
+        HTTP_PARSER,    // Bundled http_parser only
+        SSE4_2,
+        AVX2,
+    };
+
+    // Returns false if the backend is not supported by the build or the CPU
+    bool parser_backend_supported(parser_backend b);
+
+    // Select backend for all following header parsing, returns false if not supported
+    bool set_parser_backend(parser_backend b);
+
+    // Backend in use, never returns AUTO
+    parser_backend get_parser_backend();
+}}} // End of namespace fibio::http::common
+
+namespace fibio { namespace http {
+    using common::parser_backend;
+}}  // End of namespace fibio::http
+
+#endif
@@ -12,36 +12,83 @@
 #include <list>
 #include <iostream>
 #include <fibio/http/common/common_types.hpp>
+#include <fibio/http/common/arena.hpp>
+#include <fibio/http/common/header_map.hpp>
+#include <fibio/http/common/input_buffer.hpp>
 
 namespace fibio { namespace http { namespace common {
     
     struct parsed_url_type {
-        std::string schema;
-        std::string host;
+        explicit parsed_url_type(arena *a=nullptr);
+        
+        // Release all storage, nothing refers to the arena afterward
+        void clear();
+        
+        arena_string schema;
+        arena_string host;
         uint16_t port=0;
-        std::string path;
-        std::string query;
-        std::string fragment;
-        std::string userinfo;
-        std::list<std::string> path_components;
-        std::map<std::string, std::string> query_params;
+        arena_string path;
+        arena_string query;
+        arena_string fragment;
+        arena_string userinfo;
+        arena_string_list path_components;
+        arena_string_map query_params;
     };
     
-    bool parse_url(const std::string url, parsed_url_type &parsed_url, bool parse_path=true, bool parse_query=true);
+    bool parse_url(const string_view &url, parsed_url_type &parsed_url, bool parse_path=true, bool parse_query=true);
     
     struct request {
+        // Headers and parsed url are allocated from the arena if it's not null
+        explicit request(arena *a=nullptr);
+        
+        // Views referring to url/headers are re-pointed to the new object, copies
+        // own url/headers on the heap and stay valid after the connection moves on
+        request(const request &other);
+        request(request &&other);
+        request &operator=(const request &other);
+        request &operator=(request &&other);
+        
+        // Arena storage is released, other storage keeps its capacity so the object
+        // can be reused for next request
         void clear();
         
+        // Release storage grown beyond limit bytes
+        void shrink(size_t limit);
+        
+        // Read header and copy url/headers into owned storage
         bool read_header(std::istream &is);
+        
+        // Read header from connection buffer, only url_view/header_views are set,
+        // they're valid until next header is read from the same buffer
+        bool read_header(input_buffer &buf);
+        
+        // Copy url/headers from views, views are then re-pointed to owned storage
+        void copy_headers();
+        
+        // Re-point views to url/headers, needed after headers are changed as the
+        // views copied by copy_headers() may be left dangling
+        void rebind_views();
+        
+        // Append request line and headers to buf
+        bool serialize_header(std::string &buf) const;
+        
         bool write_header(std::ostream &os);
         
         http_method method=http_method::INVALID;
         std::string url;
         http_version version=http_version::INVALID;
         header_map headers;
+        string_view url_view;
+        header_view_map header_views;
         size_t content_length=0;
+        // Body uses chunked transfer-coding
+        bool chunked=false;
         bool keep_alive=false;
         parsed_url_type parsed_url;
+        
+    //private:
+        // Views refer to url/headers instead of a connection buffer
+        bool owned_views_=false;
     };
 }}} // End of namespace fibio::http::common
 
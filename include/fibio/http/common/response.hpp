@@ -10,20 +10,61 @@
 #define fibio_http_common_response_hpp
 
 #include <fibio/http/common/common_types.hpp>
+#include <fibio/http/common/arena.hpp>
+#include <fibio/http/common/header_map.hpp>
+#include <fibio/http/common/input_buffer.hpp>
 
 namespace fibio { namespace http { namespace common {
     struct response {
+        // Header storage is allocated from the arena if it's not null
+        explicit response(arena *a=nullptr);
+        
+        // Views referring to headers are re-pointed to the new object, copies own
+        // their headers on the heap
+        response(const response &other);
+        response(response &&other);
+        response &operator=(const response &other);
+        response &operator=(response &&other);
+        
+        // Arena storage is released, other storage keeps its capacity so the object
+        // can be reused for next response
         void clear();
         
+        // Release storage grown beyond limit bytes
+        void shrink(size_t limit);
+        
+        // Read header and copy headers into owned storage
         bool read_header(std::istream &is);
+        
+        // Read header from connection buffer, only header_views are set,
+        // they're valid until next header is read from the same buffer
+        bool read_header(input_buffer &buf);
+        
+        // Copy headers from views, views are then re-pointed to owned storage
+        void copy_headers();
+        
+        // Re-point views to headers, needed after headers are changed as the
+        // views copied by copy_headers() may be left dangling
+        void rebind_views();
+        
+        // Append status line and headers to buf
+        bool serialize_header(std::string &buf) const;
+        
         bool write_header(std::ostream &os);
         
         http_version version=http_version::INVALID;
         http_status_code status_code=http_status_code::INVALID;
         std::string status_message;
         header_map headers;
+        header_view_map header_views;
         size_t content_length=0;
+        // Body uses chunked transfer-coding
+        bool chunked=false;
         bool keep_alive=false;
+        
+    //private:
+        // Views refer to headers instead of a connection buffer
+        bool owned_views_=false;
     };
 }}} // End of namespace fibio::http::common
 
@@ -10,52 +10,53 @@
 #define fibio_http_common_string_pred_hpp
 
 #include <boost/algorithm/string/predicate.hpp>
+#include <fibio/http/common/common_types.hpp>
 
 namespace fibio { namespace http { namespace common {
     struct starts_with {
-        bool operator()(const std::string &s) const {
+        bool operator()(const string_view &s) const {
             return boost::algorithm::starts_with(s, c);
         }
         std::string c;
     };
     struct istarts_with {
-        bool operator()(const std::string &s) const {
+        bool operator()(const string_view &s) const {
             return boost::algorithm::istarts_with(s, c);
         }
         std::string c;
     };
     struct ends_with {
-        bool operator()(const std::string &s) const {
+        bool operator()(const string_view &s) const {
             return boost::algorithm::ends_with(s, c);
         }
         std::string c;
     };
     struct iends_with {
-        bool operator()(const std::string &s) const {
+        bool operator()(const string_view &s) const {
             return boost::algorithm::iends_with(s, c);
         }
         std::string c;
     };
     struct contains {
-        bool operator()(const std::string &s) const {
+        bool operator()(const string_view &s) const {
             return boost::algorithm::contains(s, c);
         }
         std::string c;
     };
     struct icontains {
-        bool operator()(const std::string &s) const {
+        bool operator()(const string_view &s) const {
             return boost::algorithm::icontains(s, c);
         }
         std::string c;
     };
     struct equals {
-        bool operator()(const std::string &s) const {
+        bool operator()(const string_view &s) const {
             return boost::algorithm::equals(s, c);
         }
         std::string c;
     };
     struct iequals {
-        bool operator()(const std::string &s) const {
+        bool operator()(const string_view &s) const {
             return boost::algorithm::iequals(s, c);
         }
         std::string c;
@@ -0,0 +1,122 @@
+//
+//  multipart.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/11/02.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_server_multipart_hpp
+#define fibio_http_server_multipart_hpp
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <iostream>
+#include <fibio/http/common/header_map.hpp>
+#include <fibio/http/server/server.hpp>
+
+namespace fibio { namespace http {
+    constexpr size_t DEFAULT_MULTIPART_BUFFER_SIZE=65536;
+    constexpr size_t MAX_MULTIPART_HEADER_SIZE=8192;
+    constexpr size_t DEFAULT_SPOOL_BUFFER_SIZE=1024*1024;
+    constexpr size_t DEFAULT_MAX_FORM_FIELD_SIZE=65536;
+
+    // Get boundary parameter of a multipart Content-Type, false if there is none
+    bool multipart_boundary(const string_view &content_type, std::string &boundary);
+
+    /**
+     * Streaming multipart body reader
+     *
+     * Parts are read one after another from the body, content of current part is
+     * available from stream() and reaches EOF at the delimiter. Delimiters are
+     * found with Boyer-Moore-Horspool search in a fixed size buffer, and part data
+     * before them is handed out in place, so memory use doesn't depend on part size.
+     */
+    struct multipart_reader {
+        struct part {
+            void clear();
+
+            common::header_map headers;
+            // From Content-Disposition
+            std::string name;
+            std::string filename;
+            // Content-Disposition has a filename parameter, it may be empty
+            bool has_filename=false;
+            std::string content_type;
+        };
+
+        multipart_reader(std::istream &body,
+                         const std::string &boundary,
+                         size_t buffer_size=DEFAULT_MULTIPART_BUFFER_SIZE);
+        ~multipart_reader();
+
+        multipart_reader(const multipart_reader &)=delete;
+        multipart_reader &operator=(const multipart_reader &)=delete;
+
+        // Skip the rest of current part and read header of next one, returns false
+        // after the last part, or if the body is malformed
+        bool next(part &p);
+
+        // Content of current part
+        std::istream &stream() { return stream_; }
+
+        // Body is malformed or truncated
+        bool failed() const;
+
+        struct impl;
+    private:
+        std::unique_ptr<impl> impl_;
+        std::istream stream_;
+    };
+
+    /**
+     * Write a stream into a new temporary file under dir
+     *
+     * Data is collected in a page aligned buffer and written buffer_size bytes at
+     * a time, returns false and removes the file on error.
+     */
+    bool spool_to_file(std::istream &is,
+                       const std::string &dir,
+                       std::string &path,
+                       uint64_t &size,
+                       size_t buffer_size=DEFAULT_SPOOL_BUFFER_SIZE);
+
+    /**
+     * Parsed multipart/form-data body, temporary files are removed on destruction
+     * unless they're taken away by clearing the path
+     */
+    struct form_data {
+        struct file {
+            std::string name;
+            std::string filename;
+            std::string content_type;
+            // Temporary file holding the content
+            std::string path;
+            uint64_t size=0;
+        };
+
+        form_data()=default;
+        form_data(const form_data &)=delete;
+        form_data &operator=(const form_data &)=delete;
+        ~form_data();
+
+        std::multimap<std::string, std::string> fields;
+        std::vector<file> files;
+    };
+
+    /**
+     * Read a multipart/form-data request body
+     *
+     * Parts with a filename are spooled into temporary files under tmp_dir, other
+     * parts are kept as fields and fail the form if larger than max_field_size.
+     */
+    bool read_form_data(server::request &req,
+                        form_data &form,
+                        const std::string &tmp_dir="/tmp",
+                        size_t max_field_size=DEFAULT_MAX_FORM_FIELD_SIZE);
+}}  // End of namespace fibio::http
+
+#endif
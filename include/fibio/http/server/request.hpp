@@ -12,33 +12,114 @@
 #include <memory>
 #include <string>
 #include <boost/iostreams/restrict.hpp>
+#include <functional>
 #include <fibio/http/common/request.hpp>
+#include <fibio/http/common/chunked_stream.hpp>
 
 namespace fibio { namespace http {
     struct server_request : common::request {
+        typedef common::arena_string_map params_type;
+        
+        explicit server_request(common::arena *a=nullptr)
+        : common::request(a)
+        , params(a)
+        {}
+        
         void clear();
         
         bool accept_compressed() const;
         
+        // If is is backed by an input_buffer, url/headers are only accessible via
+        // url_view/header_views unless copy_headers() is called
         bool read(std::istream &is);
         
         inline bool has_body() const {
-            return content_length>0 && body_stream_.get();
+            return (content_length>0 || chunked) && body_stream_.get();
         }
         
         inline std::istream &body_stream() {
+            body_requested_=true;
+            // Client holds the body back until it gets 100 Continue
+            if (expect_continue && !continue_sent_) send_continue();
             // TODO: Throw if body stream is not setup
             return *(body_stream_.get());
         }
         
-        // Consume and discard body
-        void drop_body();
+        // Tell the client to send the body, done by first body_stream() call
+        void send_continue();
+        
+        // Client is waiting for 100 Continue and hasn't got it, body may or may
+        // not follow, so the connection can't be reused
+        bool continue_pending() const { return expect_continue && !continue_sent_; }
+        
+        /**
+         * Consume and discard unread body
+         *
+         * Returns false if the body is left unread, i.e. it's known or found to be
+         * larger than max_drain_size, or never sent, the connection can't be reused
+         */
+        bool drop_body();
+        
+        // Lower max_body_size for this request, applies to a body being read
+        void limit_body(size_t n);
+        
+        // Body stream failed on max_body_size
+        bool body_size_exceeded() const {
+            return chunked && chunked_buf_ && chunked_buf_->too_large();
+        }
+        
+        params_type params;
         
-        std::map<std::string, std::string> params;
+        // Trailer fields of chunked body, available after the body is read
+        common::header_map trailers;
+        
+        // "Expect: 100-continue" on an HTTP/1.1 request with body
+        bool expect_continue=false;
+        
+        // If not 0, gzip/deflate encoded bodies are decompressed by body_stream(),
+        // stream fails once decompressed data exceeds this many bytes, the
+        // Content-Encoding header and content_length are left as received, limits
+        // and draining apply to the encoded body
+        size_t max_decompressed_size=0;
+        // Set when body_stream() failed on max_decompressed_size
+        bool decompressed_size_exceeded=false;
+        
+        // If not 0, chunked bodies fail past this many bytes, Content-Length is
+        // checked by the server before the request is handled
+        size_t max_body_size=0;
+        
+        // If not 0, drop_body() gives up past this many bytes
+        size_t max_drain_size=0;
+        // Bytes discarded by last drop_body()
+        size_t dropped_bytes=0;
         
     //private:
+        bool setup_body_stream(std::istream &is);
+        
         std::unique_ptr<boost::iostreams::restriction<std::istream>> restriction_;
         std::unique_ptr<std::istream> body_stream_;
+        // Set by the server, writes 100 Continue to the connection
+        std::function<bool()> continue_writer_;
+        bool continue_sent_=false;
+        // body_stream() has been called
+        bool body_requested_=false;
+        // Raw body under the decompressor, drained instead of decompressing the rest
+        std::unique_ptr<std::istream> encoded_stream_;
+        // Reused for all chunked requests on the connection
+        std::unique_ptr<common::chunked_istreambuf> chunked_buf_;
+    };
+
+    /**
+     * Size limits of a request, 0 means unlimited
+     */
+    struct request_limits {
+        // Total size of header fields
+        size_t max_header_size=0;
+        size_t max_url_length=0;
+        size_t max_body_size=0;
+        
+        // Returns OK, or 431/414/413 if the request is over a limit
+        http_status_code check(const server_request &req) const;
     };
 
     inline std::istream &operator>>(std::istream &is, server_request &v) {
@@ -10,12 +10,18 @@
 #define fibio_http_server_response_hpp
 
 #include <string>
+#include <memory>
+#include <vector>
+#include <functional>
 #include <boost/interprocess/streams/vectorstream.hpp>
 #include <fibio/http/common/response.hpp>
+#include <fibio/http/common/chunked_stream.hpp>
 
 namespace fibio { namespace http {
     struct server_response : common::response {
-        server_response()=default;
+        explicit server_response(common::arena *a=nullptr)
+        : common::response(a)
+        {}
 
         server_response(const server_response &other)
         : common::response(other)
@@ -26,8 +32,12 @@ namespace fibio { namespace http {
             return *this;
         }
         
+        ~server_response();
+        
         void clear();
         
+        void shrink(size_t limit);
+        
         size_t get_content_length() const;
         
         void set_content_type(const std::string &);
@@ -36,22 +46,107 @@ namespace fibio { namespace http {
         
         std::ostream &body_stream();
         
+        /**
+         * Send body from a file, returns false if it's not a readable regular file
+         *
+         * File is sent with sendfile(2) on plain connections without being copied
+         * into user space, and with a large buffer read/write loop on SSL connections
+         */
+        bool set_file_body(const std::string &path);
+        
+        bool has_file_body() const { return file_fd_>=0; }
+        
+        // Close the file, body is sent from body_stream() again
+        void clear_file_body();
+        
+        /**
+         * Send a body owned by someone else, i.e. a cached asset
+         *
+         * Body is sent without being copied, headers is a block of pre-serialized
+         * header lines sent as is, owner keeps both alive until they're sent.
+         */
+        void set_static_body(std::shared_ptr<const void> owner,
+                             const string_view &body,
+                             const string_view &headers=string_view());
+        
+        /**
+         * Handle Range/If-Range of a GET request, called by the server after the
+         * handler returns
+         *
+         * A 200 response becomes 206 with one range or multipart/byteranges, or 416
+         * if no range is satisfiable, file bodies are still sent with sendfile.
+         */
+        void apply_range(const common::header_view_map &request_headers);
+        
+        // Look up headers and then the pre-serialized block
+        string_view find_header(const string_view &name) const;
+        
+        /**
+         * Stream the body with chunked transfer-coding straight to the connection
+         *
+         * Headers are sent on first write, so they must be set before writing, the
+         * body is sent in chunks of bounded size and finished after the handler
+         * returns. HTTP/1.0 clients get the raw body and the connection is closed.
+         */
+        std::ostream &chunked_body_stream();
+        
+        bool chunked() const { return chunked_; }
+        
+        // Send remaining data and the last chunk
+        bool finish_chunked();
+        
         template<typename T>
         void set_body(const T &t, const std::string &content_type=common::content_type<T>::name) {
             set_content_type(content_type);
             body_stream() << t;
         }
         
+        // Status line and headers, Date/Content-Length/Connection are generated
+        bool serialize_header(std::string &buf) const;
+        
         bool write_header(std::ostream &os);
         bool write(std::ostream &os);
         
+        // Serialize status line and headers into header_block, and move body out,
+        // both are ready for a gather write
+        bool serialize(std::string &header_block, std::string &body);
+        
         boost::interprocess::basic_ovectorstream<std::string> raw_body_stream_;
+        
+        // Set by the server, writes directly to the connection
+        common::chunked_ostreambuf::writer_type chunk_writer_;
+        // Set by the server, may turn on compression before the first chunk
+        std::function<void(server_response &, size_t, bool)> stream_compressor_;
+        bool chunked_=false;
+        bool header_sent_=false;
+        // Answering HEAD, headers are the same as for GET but no body is sent
+        bool head_=false;
+        std::string chunk_header_block_;
+        std::unique_ptr<common::chunked_ostreambuf> chunked_buf_;
+        std::unique_ptr<std::ostream> chunked_stream_;
+        
+        std::shared_ptr<const void> static_owner_;
+        string_view static_body_;
+        string_view static_headers_;
+        
+        int file_fd_=-1;
+        uint64_t file_offset_=0;
+        uint64_t file_length_=0;
+        uint64_t file_size_=0;
+        // Parts of multipart/byteranges file body, each with its part header
+        struct file_part {
+            std::string prefix;
+            uint64_t offset;
+            uint64_t length;
+        };
+        std::vector<file_part> file_parts_;
+        std::string file_parts_trailer_;
+        // Replaces the pre-serialized block when Content-Type is changed
+        std::string range_headers_;
     };
 
     inline std::ostream &operator<<(std::ostream &os, server_response &resp) {
-        resp.write_header(os);
-        if(resp.get_content_length()>0)
-            os << resp.body_stream().rdbuf();
+        resp.write(os);
         os.flush();
         return os;
     }
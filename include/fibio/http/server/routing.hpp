@@ -48,12 +48,36 @@ namespace fibio { namespace http {
         http_status_code m;
     };
 
+    /**
+     * Serve files under root directory, prefix is stripped from the URL path,
+     * directory requests are served with index.html, HEAD is answered without body
+     */
+    struct file_handler {
+        bool operator()(server::request &req,
+                        server::response &resp,
+                        server::connection &) const;
+        
+        // Map URL path to file path, returns OK or the status to reply with
+        http_status_code map_path(server::request &req, std::string &path) const;
+        
+        std::string root;
+        std::string prefix;
+    };
+
     /**
      * Routing table to handle requests
      */
     server::request_handler_type route(const routing_table_type &table,
                                        server::request_handler_type default_handler=stock_handler{http_status_code::NOT_FOUND});
 
+    /**
+     * Answer requests over route-specific limits with a stock response, their
+     * connections are closed as the body is not read, chunked bodies fail past
+     * max_body_size while being read by handler
+     */
+    server::request_handler_type with_limits(const request_limits &limits,
+                                             server::request_handler_type handler);
+
     /**
      * Match any request
      */
@@ -76,7 +100,7 @@ namespace fibio { namespace http {
     template<typename Predicate>
     match_type url_(Predicate pred) {
         return [pred](server::request &req)->bool {
-            return pred(req.url);
+            return pred(req.url_view);
         };
     }
 
@@ -87,8 +111,8 @@ namespace fibio { namespace http {
     template<typename Predicate>
     match_type header_(const std::string &h, Predicate pred) {
         return [h, pred](server::request &req)->bool {
-            auto i=req.headers.find(h);
-            if (i==req.headers.end()) {
+            auto i=req.header_views.find(h);
+            if (i==req.header_views.end()) {
                 return false;
             }
             return pred(i->second);
@@ -102,7 +126,7 @@ namespace fibio { namespace http {
     template<typename Predicate>
     match_type param_(const std::string &p, Predicate pred) {
         return [p, pred](server::request &req)->bool {
-            auto i=req.params.find(p);
+            auto i=req.params.find(common::arena_string(p.data(), p.size(), req.params.get_allocator()));
             if (i==req.params.end()) {
                 return false;
             }
@@ -117,6 +141,7 @@ namespace fibio { namespace http {
     match_type GET(const std::string &pattern);
     match_type POST(const std::string &pattern);
     match_type PUT(const std::string &pattern);
+    match_type HEAD(const std::string &pattern);
 }}  // End of namespace fibio::http
 
 #endif
@@ -12,6 +12,7 @@
 #include <memory>
 #include <string>
 #include <functional>
+#include <vector>
 #include <system_error>
 #include <fibio/stream/iostream.hpp>
 #include <fibio/stream/ssl.hpp>
@@ -20,6 +21,14 @@
 
 namespace fibio { namespace http {
     constexpr unsigned DEFAULT_KEEP_ALIVE_REQ_PER_CONNECTION=100;
+    constexpr unsigned DEFAULT_PIPELINE_DEPTH=16;
+    constexpr size_t DEFAULT_HIGH_WATER_MARK=65536;
+    constexpr timeout_type DEFAULT_CODEL_INTERVAL=std::chrono::milliseconds(100);
+    constexpr int DEFAULT_COMPRESSION_LEVEL=6;
+    constexpr size_t DEFAULT_COMPRESSION_MIN_SIZE=1024;
+    constexpr size_t DEFAULT_COMPRESSION_CACHE_SIZE=16*1024*1024;
+    constexpr size_t DEFAULT_MAX_DECOMPRESSED_BODY_SIZE=16*1024*1024;
+    constexpr size_t DEFAULT_MAX_DRAIN_SIZE=65536;
     
     struct server {
         typedef fibio::http::server_request request;
@@ -28,6 +37,10 @@ namespace fibio { namespace http {
         typedef std::function<bool(request &req,
                                    response &resp,
                                    connection &conn)> request_handler_type;
+        // Called before the body of a request with "Expect: 100-continue" is
+        // requested, returns false to reject with the status set in response
+        typedef std::function<bool(request &req,
+                                   response &resp)> expect_handler_type;
         
         struct settings {
             settings(request_handler_type h=[](request &, response &, connection &)->bool{ return false; },
@@ -41,7 +54,28 @@ namespace fibio { namespace http {
             , default_request_handler(h)
             , read_timeout(r)
             , write_timeout(w)
+            , idle_timeout(std::chrono::seconds(0))
             , max_keep_alive(m)
+            , copy_headers(false)
+            , pipeline_depth(DEFAULT_PIPELINE_DEPTH)
+            , read_buffer_size(common::DEFAULT_READ_BUFFER_SIZE)
+            , max_read_buffer_size(common::DEFAULT_MAX_READ_BUFFER_SIZE)
+            , high_water_mark(DEFAULT_HIGH_WATER_MARK)
+            , listeners(1)
+            , max_connections(0)
+            , soft_max_connections(0)
+            , max_inflight_requests(0)
+            , retry_after(1)
+            , codel_target(std::chrono::seconds(0))
+            , codel_interval(DEFAULT_CODEL_INTERVAL)
+            , compress_responses(false)
+            , compression_level(DEFAULT_COMPRESSION_LEVEL)
+            , compression_min_size(DEFAULT_COMPRESSION_MIN_SIZE)
+            , compression_cache_size(DEFAULT_COMPRESSION_CACHE_SIZE)
+            , decompress_requests(false)
+            , max_decompressed_body_size(DEFAULT_MAX_DECOMPRESSED_BODY_SIZE)
+            , max_drain_size(DEFAULT_MAX_DRAIN_SIZE)
+            , expect_handler(nullptr)
             , ctx(0)
             {
                 // read and write timeout must be set or unset at same time
@@ -60,7 +94,28 @@ namespace fibio { namespace http {
             , default_request_handler(h)
             , read_timeout(r)
             , write_timeout(w)
+            , idle_timeout(std::chrono::seconds(0))
             , max_keep_alive(m)
+            , copy_headers(false)
+            , pipeline_depth(DEFAULT_PIPELINE_DEPTH)
+            , read_buffer_size(common::DEFAULT_READ_BUFFER_SIZE)
+            , max_read_buffer_size(common::DEFAULT_MAX_READ_BUFFER_SIZE)
+            , high_water_mark(DEFAULT_HIGH_WATER_MARK)
+            , listeners(1)
+            , max_connections(0)
+            , soft_max_connections(0)
+            , max_inflight_requests(0)
+            , retry_after(1)
+            , codel_target(std::chrono::seconds(0))
+            , codel_interval(DEFAULT_CODEL_INTERVAL)
+            , compress_responses(false)
+            , compression_level(DEFAULT_COMPRESSION_LEVEL)
+            , compression_min_size(DEFAULT_COMPRESSION_MIN_SIZE)
+            , compression_cache_size(DEFAULT_COMPRESSION_CACHE_SIZE)
+            , decompress_requests(false)
+            , max_decompressed_body_size(DEFAULT_MAX_DECOMPRESSED_BODY_SIZE)
+            , max_drain_size(DEFAULT_MAX_DRAIN_SIZE)
+            , expect_handler(nullptr)
             , ctx(&context)
             {
                 // read and write timeout must be set or unset at same time
@@ -72,15 +127,101 @@ namespace fibio { namespace http {
             request_handler_type default_request_handler;
             timeout_type read_timeout;
             timeout_type write_timeout;
+            // Max time a keep-alive connection waits for next request, read_timeout is
+            // used if not set, read buffers of waiting connections are given back to a
+            // pool, the fibio stream keeps its own buffers
+            timeout_type idle_timeout;
             unsigned max_keep_alive;
+            // Copy url and headers into request.url/request.headers, otherwise only
+            // request.url_view/request.header_views are available, and they're valid
+            // until next request on the same connection, with copied headers the
+            // handler may change request.headers, views are re-pointed afterward
+            bool copy_headers;
+            // Max number of pipelined requests handled before responses are flushed,
+            // 1 disables coalescing
+            unsigned pipeline_depth;
+            // Initial size of per-connection read buffer, it grows to hold a
+            // complete header block, up to max_read_buffer_size
+            size_t read_buffer_size;
+            size_t max_read_buffer_size;
+            // Request/response objects are reused on a connection and keep their
+            // buffers, buffers grown beyond this size are released after the request
+            size_t high_water_mark;
+            // Number of listening sockets bound to the same address with SO_REUSEPORT,
+            // each has its own accept fiber and the kernel balances new connections
+            // among them, usually one per scheduler thread, 1 uses a single listener
+            unsigned listeners;
+            // Accept pauses while there are this many connections, 0 means unlimited
+            unsigned max_connections;
+            // Past soft limits requests are answered with a pre-serialized 503 without
+            // calling the handler, 0 means unlimited, shed connections are closed
+            unsigned soft_max_connections;
+            // Max number of requests in handlers at the same time, 0 means unlimited
+            unsigned max_inflight_requests;
+            // Retry-After in 503 responses, in seconds
+            unsigned retry_after;
+            // Queue-delay based shedding, requests wait for a handler slot instead of
+            // being shed at max_inflight_requests, and are shed with 503 once waiting
+            // time stays above codel_target for codel_interval, 0 disables, requests
+            // only wait behind max_inflight_requests so it must be set with CoDel
+            timeout_type codel_target;
+            timeout_type codel_interval;
+            // Compress buffered, cached and chunked bodies with gzip/deflate if the
+            // client accepts, bodies smaller than compression_min_size and already
+            // compressed media types are sent as is, chunked bodies are compressed
+            // as they're streamed
+            bool compress_responses;
+            int compression_level;
+            size_t compression_min_size;
+            // Budget of compressed bodies kept so a hot asset or a repeated buffered
+            // body is compressed once, cached files are keyed by identity, buffered
+            // bodies by length and SHA-256 of their content, 0 disables the cache
+            size_t compression_cache_size;
+            // Decompress gzip/deflate request bodies in request.body_stream(), the
+            // stream fails past max_decompressed_body_size bytes of output,
+            // Content-Encoding and content_length still describe the body as sent
+            bool decompress_requests;
+            size_t max_decompressed_body_size;
+            // Requests over limits are answered with 431/414/413 without calling
+            // the handler and the connection is closed, header block never gets
+            // larger than max_read_buffer_size, it's answered with 431 as well
+            request_limits limits;
+            // Unread body left by the handler is drained if it's no larger than
+            // this, otherwise the connection is closed, 0 always drains
+            size_t max_drain_size;
+            // Validates requests with "Expect: 100-continue" before the handler
+            // runs, 100 Continue is sent when the handler reads the body, requests
+            // answered without reading the body get their connection closed
+            expect_handler_type expect_handler;
             ssl::context *ctx;
         };
+        
+        struct stats {
+            // Connections accepted by each listener
+            std::vector<uint64_t> accepted;
+            uint64_t active_connections=0;
+            // Times accept paused on max_connections
+            uint64_t accept_pauses=0;
+            // Requests passed to the handler
+            uint64_t handled_requests=0;
+            // Requests answered with 503
+            uint64_t shed_requests=0;
+            // Part of shed_requests, shed by CoDel
+            uint64_t delay_shed_requests=0;
+            // Requests answered with 431/414/413 on limits
+            uint64_t rejected_requests=0;
+            // Unread bodies discarded by reading them
+            uint64_t drained_bodies=0;
+            // Connections closed instead of reading the rest of a body
+            uint64_t closed_bodies=0;
+        };
 
         server(settings s);
         ~server();
         void start();
         void stop();
         void join();
+        stats get_stats() const;
         struct impl;
     private:
         impl *engine_;
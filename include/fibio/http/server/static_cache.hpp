@@ -0,0 +1,106 @@
+//
+//  static_cache.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/28.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_server_static_cache_hpp
+#define fibio_http_server_static_cache_hpp
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <fibio/http/server/routing.hpp>
+
+namespace fibio { namespace http {
+    constexpr size_t DEFAULT_STATIC_CACHE_BUDGET=64*1024*1024;
+    constexpr size_t DEFAULT_STATIC_CACHE_MIN_MAPPED_SIZE=1024*1024;
+
+    /**
+     * Cache of static files
+     *
+     * Validators and header blocks are computed once when a file is loaded, files
+     * are invalidated by inotify on Linux, and by re-checking mtime elsewhere.
+     * Least recently used files are evicted when the memory budget is exceeded,
+     * files larger than max_file_size are not cached.
+     *
+     * Files smaller than min_mapped_size are copied into memory, so changing them
+     * never affects responses in flight. Larger files are memory-mapped, a hit is
+     * reloaded if the file size has changed, but a mapped file truncated in place
+     * while it's being sent still kills the process with SIGBUS, so such files
+     * must be replaced atomically, i.e. written to a temporary file and renamed.
+     */
+    struct static_cache {
+        struct asset {
+            asset()=default;
+            asset(const asset &)=delete;
+            asset &operator=(const asset &)=delete;
+            ~asset();
+
+            std::string path;
+            const char *data=nullptr;
+            size_t size=0;
+            // Either data is owned, or it's mapped and the file is kept open
+            std::unique_ptr<char[]> owned;
+            int fd=-1;
+            time_t last_modified=0;
+            // Strong ETag, from content of copied files, from inode, size and mtime
+            // of mapped ones
+            std::string etag;
+            // Content-Type, Accept-Ranges, ETag and Last-Modified lines, a 304 only
+            // sends the validators
+            std::string headers;
+        };
+        typedef std::shared_ptr<const asset> asset_ptr;
+
+        struct stats {
+            uint64_t hits=0;
+            uint64_t misses=0;
+            uint64_t evictions=0;
+            uint64_t invalidations=0;
+            size_t memory_usage=0;
+            size_t entries=0;
+        };
+
+        explicit static_cache(size_t memory_budget=DEFAULT_STATIC_CACHE_BUDGET,
+                              size_t max_file_size=DEFAULT_STATIC_CACHE_BUDGET/16,
+                              size_t min_mapped_size=DEFAULT_STATIC_CACHE_MIN_MAPPED_SIZE);
+        ~static_cache();
+
+        static_cache(const static_cache &)=delete;
+        static_cache &operator=(const static_cache &)=delete;
+
+        // Returns null if path is not a regular file or is too large to cache
+        asset_ptr get(const std::string &path);
+
+        void invalidate(const std::string &path);
+
+        stats get_stats() const;
+
+        struct impl;
+    private:
+        std::unique_ptr<impl> impl_;
+    };
+
+    /**
+     * Check If-None-Match/If-Modified-Since against the asset, true if client's
+     * copy is still valid
+     */
+    bool not_modified(server::request &req, const static_cache::asset &a);
+
+    /**
+     * Serve files through the cache, uncacheable files are sent with file_handler
+     */
+    struct cached_file_handler {
+        bool operator()(server::request &req,
+                        server::response &resp,
+                        server::connection &conn) const;
+
+        file_handler files;
+        std::shared_ptr<static_cache> cache;
+    };
+}}  // End of namespace fibio::http
+
+#endif
@@ -0,0 +1,105 @@
+//
+//  arena.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/24.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <atomic>
+#include <algorithm>
+#include <fibio/http/common/arena.hpp>
+
+namespace fibio { namespace http { namespace common {
+    namespace detail {
+        std::atomic<uint64_t> arena_allocations(0);
+        std::atomic<uint64_t> arena_heap_allocations(0);
+        std::atomic<uint64_t> arena_resets(0);
+
+        inline char *align_up(char *p, size_t alignment) {
+            uintptr_t v=reinterpret_cast<uintptr_t>(p);
+            return reinterpret_cast<char *>((v+alignment-1) & ~uintptr_t(alignment-1));
+        }
+    }   // End of namespace detail
+
+    arena_counters get_arena_counters() {
+        arena_counters c;
+        c.allocations=detail::arena_allocations.load(std::memory_order_relaxed);
+        c.heap_allocations=detail::arena_heap_allocations.load(std::memory_order_relaxed);
+        c.resets=detail::arena_resets.load(std::memory_order_relaxed);
+        return c;
+    }
+
+    arena::arena(size_t block_size)
+    : block_size_(std::max(block_size, sizeof(block)*2))
+    {}
+
+    arena::~arena() {
+        report();
+        free_blocks();
+    }
+
+    void *arena::allocate(size_t size, size_t alignment) {
+        counters_.allocations++;
+        char *p=detail::align_up(current_, alignment);
+        if (current_ && p+size<=end_) {
+            current_=p+size;
+            return p;
+        }
+        return allocate_slow(size, alignment);
+    }
+
+    void arena::reset() {
+        counters_.resets++;
+        report();
+        if (blocks_ && blocks_->next) {
+            // Merge all blocks into one big enough for the whole last round
+            size_t total=0;
+            for (block *b=blocks_; b; b=b->next) total+=b->size;
+            free_blocks();
+            add_block(total);
+        } else if (blocks_) {
+            current_=reinterpret_cast<char *>(blocks_+1);
+        }
+    }
+
+    void arena::release() {
+        counters_.resets++;
+        report();
+        free_blocks();
+    }
+
+    void *arena::allocate_slow(size_t size, size_t alignment) {
+        add_block(std::max(block_size_, size+alignment+sizeof(block)));
+        char *p=detail::align_up(current_, alignment);
+        current_=p+size;
+        return p;
+    }
+
+    void arena::add_block(size_t size) {
+        block *b=static_cast<block *>(::operator new(size));
+        b->next=blocks_;
+        b->size=size;
+        blocks_=b;
+        current_=reinterpret_cast<char *>(b+1);
+        end_=reinterpret_cast<char *>(b)+size;
+        counters_.heap_allocations++;
+    }
+
+    void arena::free_blocks() {
+        while (blocks_) {
+            block *b=blocks_;
+            blocks_=b->next;
+            ::operator delete(b);
+        }
+        current_=nullptr;
+        end_=nullptr;
+    }
+
+    void arena::report() {
+        detail::arena_allocations.fetch_add(counters_.allocations, std::memory_order_relaxed);
+        detail::arena_heap_allocations.fetch_add(counters_.heap_allocations, std::memory_order_relaxed);
+        detail::arena_resets.fetch_add(counters_.resets, std::memory_order_relaxed);
+        counters_=arena_counters();
+    }
+}}} // End of namespace fibio::http::common
@@ -0,0 +1,82 @@
+//
+//  byte_range.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/29.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <strings.h>
+#include "byte_range.hpp"
+
+namespace fibio { namespace http { namespace detail {
+    namespace {
+        inline void skip_spaces(const char *&p, const char *e) {
+            while (p<e && (*p==' ' || *p=='\t')) p++;
+        }
+
+        // At least one digit, fails on overflow
+        inline bool parse_number(const char *&p, const char *e, uint64_t &v) {
+            const char *b=p;
+            v=0;
+            while (p<e && *p>='0' && *p<='9') {
+                if (v>(UINT64_MAX-9)/10) return false;
+                v=v*10+(*p++-'0');
+            }
+            return p>b;
+        }
+    }
+
+    range_result parse_byte_ranges(const string_view &spec, uint64_t size, std::vector<byte_range> &ranges) {
+        ranges.clear();
+        const char *p=spec.begin();
+        const char *e=spec.end();
+        skip_spaces(p, e);
+        if (e-p<6 || strncasecmp(p, "bytes=", 6)!=0) return range_result::IGNORE;
+        p+=6;
+        size_t specs=0;
+        uint64_t total=0;
+        while (p<e) {
+            skip_spaces(p, e);
+            if (p<e && *p==',') {
+                // Empty list element
+                p++;
+                continue;
+            }
+            if (p==e) break;
+            if (++specs>MAX_BYTE_RANGES) return range_result::IGNORE;
+            size_t n=ranges.size();
+            uint64_t first=0, last=0;
+            bool suffix=(*p=='-');
+            if (suffix) {
+                p++;
+                if (!parse_number(p, e, last)) return range_result::IGNORE;
+                // Last n bytes
+                if (last>0 && size>0) {
+                    first=last>=size ? 0 : size-last;
+                    ranges.push_back({first, size-first});
+                }
+            } else {
+                if (!parse_number(p, e, first) || p==e || *p++!='-') return range_result::IGNORE;
+                bool open=(p==e || *p==',' || *p==' ' || *p=='\t');
+                if (open) {
+                    last=UINT64_MAX;
+                } else if (!parse_number(p, e, last) || last<first) {
+                    return range_result::IGNORE;
+                }
+                if (first<size) {
+                    last=std::min(last, size-1);
+                    ranges.push_back({first, last-first+1});
+                }
+            }
+            if (ranges.size()>n) total+=ranges.back().length;
+            skip_spaces(p, e);
+            if (p<e && *p++!=',') return range_result::IGNORE;
+        }
+        if (specs==0) return range_result::IGNORE;
+        if (ranges.empty()) return range_result::UNSATISFIABLE;
+        // Overlapping ranges asking for more than the whole body
+        if (total>size) return range_result::IGNORE;
+        return range_result::PARTIAL;
+    }
+}}} // End of namespace fibio::http::detail
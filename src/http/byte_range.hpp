@@ -0,0 +1,41 @@
+//
+//  byte_range.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/29.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_byte_range_hpp
+#define fibio_http_byte_range_hpp
+
+#include <cstdint>
+#include <vector>
+#include <fibio/http/common/common_types.hpp>
+
+namespace fibio { namespace http { namespace detail {
+    // More ranges than this are answered with the whole body
+    constexpr size_t MAX_BYTE_RANGES=16;
+
+    struct byte_range {
+        uint64_t first;
+        uint64_t length;
+    };
+
+    enum class range_result {
+        // Malformed or abusive, Range header is ignored
+        IGNORE,
+        // 416
+        UNSATISFIABLE,
+        // 206
+        PARTIAL,
+    };
+
+    /**
+     * Parse "bytes=..." Range header against a body of size bytes, unsatisfiable
+     * ranges in a set are dropped, the rest are clipped to the body
+     */
+    range_result parse_byte_ranges(const string_view &spec, uint64_t size, std::vector<byte_range> &ranges);
+}}} // End of namespace fibio::http::detail
+
+#endif
@@ -0,0 +1,325 @@
+//
+//  chunked_stream.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/29.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <zlib.h>
+#include <fibio/http/common/chunked_stream.hpp>
+
+namespace fibio { namespace http { namespace common {
+    namespace detail {
+        constexpr char hex_digits[]="0123456789abcdef";
+        constexpr char crlf[]="\r\n";
+        constexpr char last_chunk[]="0\r\n\r\n";
+        // Longest chunk size line or trailer field accepted
+        constexpr size_t max_line_size=8192;
+        
+        inline int hex_value(char c) {
+            if (c>='0' && c<='9') return c-'0';
+            if (c>='a' && c<='f') return c-'a'+10;
+            if (c>='A' && c<='F') return c-'A'+10;
+            return -1;
+        }
+        
+        inline bool is_ows(char c) {
+            return c==' ' || c=='\t';
+        }
+    }   // End of namespace detail
+
+    struct chunked_ostreambuf::deflater {
+        deflater(int level, int window_bits)
+        : window_bits_(window_bits)
+        {
+            std::memset(&zs_, 0, sizeof(zs_));
+            ok_=(deflateInit2(&zs_, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY)==Z_OK);
+        }
+
+        ~deflater() {
+            if (ok_) deflateEnd(&zs_);
+        }
+
+        // Start a new stream, false if the wrapper differs and a new one is needed
+        bool reset(int level, int window_bits) {
+            if (!ok_ || window_bits!=window_bits_) return false;
+            return deflateReset(&zs_)==Z_OK && deflateParams(&zs_, level, Z_DEFAULT_STRATEGY)==Z_OK;
+        }
+
+        // Compress n bytes and append the output to out_
+        bool compress(const char *p, size_t n, int flush) {
+            zs_.next_in=reinterpret_cast<Bytef *>(const_cast<char *>(p));
+            zs_.avail_in=uInt(n);
+            while (true) {
+                size_t used=out_.size();
+                out_.resize(used+zs_.avail_in/2+4096);
+                zs_.next_out=reinterpret_cast<Bytef *>(&out_[used]);
+                zs_.avail_out=uInt(out_.size()-used);
+                int r=::deflate(&zs_, flush);
+                out_.resize(out_.size()-zs_.avail_out);
+                if (r==Z_STREAM_END) return true;
+                if (r!=Z_OK && r!=Z_BUF_ERROR) return false;
+                // Output space left means zlib has nothing more to give for now
+                if (zs_.avail_in==0 && zs_.avail_out>0 && flush!=Z_FINISH) return true;
+            }
+        }
+
+        z_stream zs_;
+        int window_bits_;
+        bool ok_=false;
+        // Compressed data of current chunk
+        std::string out_;
+    };
+
+    chunked_ostreambuf::chunked_ostreambuf(size_t buffer_size)
+    : buffer_(new char[std::max<size_t>(buffer_size, 1)])
+    , buffer_size_(std::max<size_t>(buffer_size, 1))
+    {
+        setp(buffer_.get(), buffer_.get()+buffer_size_);
+    }
+
+    chunked_ostreambuf::~chunked_ostreambuf()=default;
+
+    void chunked_ostreambuf::reset(writer_type writer, bool framing, start_type start) {
+        writer_=std::move(writer);
+        start_=std::move(start);
+        framing_=framing;
+        good_=true;
+        started_=false;
+        deflating_=false;
+        setp(buffer_.get(), buffer_.get()+buffer_size_);
+    }
+
+    bool chunked_ostreambuf::set_deflate(int level, int window_bits) {
+        if (started_) return false;
+        if (!deflater_ || !deflater_->reset(level, window_bits)) {
+            deflater_.reset(new deflater(level, window_bits));
+        }
+        deflating_=deflater_->ok_;
+        return deflating_;
+    }
+
+    bool chunked_ostreambuf::finish() {
+        size_t n=pptr()-pbase();
+        setp(buffer_.get(), buffer_.get()+buffer_size_);
+        bool ret=write(buffer_.get(), n, nullptr, 0, true);
+        writer_=writer_type();
+        start_=start_type();
+        return ret;
+    }
+
+    chunked_ostreambuf::int_type chunked_ostreambuf::overflow(int_type c) {
+        if (!flush_buffer(false)) return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr()=traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize chunked_ostreambuf::xsputn(const char_type *s, std::streamsize n) {
+        if (size_t(epptr()-pptr())>=size_t(n)) {
+            std::memcpy(pptr(), s, n);
+            pbump(int(n));
+            return n;
+        }
+        // Large write, send buffered data and s together as one chunk
+        size_t buffered=pptr()-pbase();
+        setp(buffer_.get(), buffer_.get()+buffer_size_);
+        return write(buffer_.get(), buffered, s, n, false) ? n : 0;
+    }
+
+    int chunked_ostreambuf::sync() {
+        return flush_buffer(true) ? 0 : -1;
+    }
+
+    bool chunked_ostreambuf::flush_buffer(bool sync) {
+        size_t n=pptr()-pbase();
+        // Compressor may still hold data written before
+        if (n==0 && !(sync && deflating_ && started_)) return good_;
+        setp(buffer_.get(), buffer_.get()+buffer_size_);
+        return write(buffer_.get(), n, nullptr, 0, false, sync);
+    }
+
+    bool chunked_ostreambuf::write(const char *p1, size_t n1, const char *p2, size_t n2, bool last, bool sync) {
+        if (!good_) return false;
+        if (!started_) {
+            // May turn on compression
+            if (start_) start_(n1+n2, last);
+            started_=true;
+        }
+        if (!deflating_) return send(p1, n1, p2, n2, last);
+        int flush=last ? Z_FINISH : (sync ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        std::string &out=deflater_->out_;
+        out.clear();
+        if (n2>0) {
+            good_=deflater_->compress(p1, n1, Z_NO_FLUSH) && deflater_->compress(p2, n2, flush);
+        } else {
+            good_=deflater_->compress(p1, n1, flush);
+        }
+        // Nothing may come out until zlib has collected enough input
+        return good_ && send(out.data(), out.size(), nullptr, 0, last);
+    }
+
+    bool chunked_ostreambuf::send(const char *p1, size_t n1, const char *p2, size_t n2, bool last) {
+        buffers_.clear();
+        size_t n=n1+n2;
+        if (n>0) {
+            if (framing_) {
+                char *e=size_line_+sizeof(size_line_);
+                char *b=e-2;
+                std::memcpy(b, detail::crlf, 2);
+                do {
+                    *--b=detail::hex_digits[n & 0xf];
+                    n>>=4;
+                } while (n);
+                buffers_.push_back(boost::asio::buffer(b, e-b));
+            }
+            if (n1>0) buffers_.push_back(boost::asio::buffer(p1, n1));
+            if (n2>0) buffers_.push_back(boost::asio::buffer(p2, n2));
+            if (framing_) buffers_.push_back(boost::asio::buffer(detail::crlf, 2));
+        }
+        if (last && framing_) {
+            buffers_.push_back(boost::asio::buffer(detail::last_chunk, sizeof(detail::last_chunk)-1));
+        }
+        // Last call always goes to the writer, even with nothing to send
+        if (!buffers_.empty() || last) {
+            good_=writer_ && writer_(buffers_);
+        }
+        return good_;
+    }
+
+    void chunked_istreambuf::reset(std::streambuf *source, header_map *trailers) {
+        release_window();
+        source_=dynamic_cast<input_buffer *>(source);
+        if (!source_) {
+            owned_source_.reset(new input_buffer(source));
+            source_=owned_source_.get();
+        } else {
+            owned_source_.reset();
+        }
+        trailers_=trailers;
+        state_=state::size;
+        remaining_=0;
+        size_=0;
+        too_large_=false;
+    }
+
+    chunked_istreambuf::int_type chunked_istreambuf::underflow() {
+        // Chunk data handed out by last window has been read
+        release_window();
+        while (true) {
+            switch (state_) {
+                case state::size: {
+                    const char *b, *e;
+                    if (!read_line(b, e)) return finish(state::error);
+                    uint64_t n=0;
+                    const char *p=b;
+                    for (; p<e && detail::hex_value(*p)>=0; ++p) {
+                        // Overflow
+                        if (n>>60) return finish(state::error);
+                        n=(n<<4) | detail::hex_value(*p);
+                    }
+                    // At least one digit, chunk extensions are ignored
+                    while (p<e && detail::is_ows(*p)) ++p;
+                    if (p==b || (p<e && *p!=';')) return finish(state::error);
+                    // Rejected before reading any of it
+                    if (max_size_ && (size_>max_size_ || n>max_size_-size_)) {
+                        too_large_=true;
+                        return finish(state::error);
+                    }
+                    size_+=n;
+                    source_->consume(e-b+2);
+                    remaining_=n;
+                    state_=(n==0) ? state::trailer : state::data;
+                    break;
+                }
+                case state::data: {
+                    if (remaining_==0) {
+                        state_=state::data_end;
+                        break;
+                    }
+                    if (source_->size()==0 && source_->fill()==0) return finish(state::error);
+                    size_t n=size_t(std::min<uint64_t>(remaining_, source_->size()));
+                    char *p=const_cast<char *>(source_->data());
+                    setg(p, p, p+n);
+                    return traits_type::to_int_type(*p);
+                }
+                case state::data_end: {
+                    const char *b, *e;
+                    if (!read_line(b, e) || b!=e) return finish(state::error);
+                    source_->consume(2);
+                    state_=state::size;
+                    break;
+                }
+                case state::trailer: {
+                    const char *b, *e;
+                    if (!read_line(b, e)) return finish(state::error);
+                    if (b==e) {
+                        source_->consume(2);
+                        return finish(state::done);
+                    }
+                    const char *colon=std::find(b, e, ':');
+                    if (colon==b || colon==e) return finish(state::error);
+                    if (trailers_) {
+                        const char *v=colon+1;
+                        while (v<e && detail::is_ows(*v)) ++v;
+                        const char *ve=e;
+                        while (ve>v && detail::is_ows(ve[-1])) --ve;
+                        trailers_->emplace(string_view(b, colon-b), string_view(v, ve-v));
+                    }
+                    source_->consume(e-b+2);
+                    break;
+                }
+                case state::done:
+                case state::error:
+                    return traits_type::eof();
+            }
+        }
+    }
+
+    std::streamsize chunked_istreambuf::showmanyc() {
+        if (state_!=state::data || !source_) return (state_==state::done || state_==state::error) ? -1 : 0;
+        return std::streamsize(std::min<uint64_t>(remaining_, source_->size()));
+    }
+
+    void chunked_istreambuf::release_window() {
+        if (source_ && eback()) {
+            size_t n=gptr()-eback();
+            source_->consume(n);
+            remaining_-=n;
+        }
+        setg(nullptr, nullptr, nullptr);
+    }
+
+    bool chunked_istreambuf::read_line(const char *&begin, const char *&end) {
+        static constexpr char eol[]="\r\n";
+        while (true) {
+            const char *b=source_->data();
+            const char *e=b+source_->size();
+            const char *p=std::search(b, e, eol, eol+2);
+            if (p!=e) {
+                begin=b;
+                end=p;
+                return true;
+            }
+            if (source_->size()>detail::max_line_size || source_->full()) return false;
+            if (source_->fill()==0) return false;
+        }
+    }
+
+    chunked_istreambuf::int_type chunked_istreambuf::finish(state s) {
+        state_=s;
+        if (owned_source_) {
+            // Give read-ahead bytes back
+            owned_source_->unread();
+            owned_source_.reset();
+            source_=nullptr;
+        }
+        return traits_type::eof();
+    }
+}}} // End of namespace fibio::http::common
@@ -7,9 +7,11 @@
 //
 
 #include <boost/lexical_cast.hpp>
+#include <boost/asio/basic_waitable_timer.hpp>
 #include <boost/iostreams/restrict.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#include <fibio/fiber.hpp>
 #include <fibio/http/client/client.hpp>
 
 namespace fibio { namespace http {
@@ -36,18 +38,18 @@ namespace fibio { namespace http {
         if (ct.empty()) {
             return;
         }
-        auto i=headers.find("Content-Type");
+        auto i=headers.find(header_id::CONTENT_TYPE);
         if (i==headers.end()) {
             headers.insert({"Content-Type", ct});
         } else {
-            i->second.assign(ct);
+            i->second.assign(ct.data(), ct.size());
         }
     }
     
     void client_request::accept_compressed(bool c) {
         if (c) {
             // Support gzip only for now
-            common::header_map::iterator i=headers.find("Accept-Encoding");
+            common::header_map::iterator i=headers.find(header_id::ACCEPT_ENCODING);
             if (i==headers.end()) {
                 headers.insert(std::make_pair("Accept-Encoding", "gzip"));
             } else {
@@ -65,27 +67,34 @@ namespace fibio { namespace http {
         } else {
             ka="close";
         }
-        auto i=headers.find("connection");
+        auto i=headers.find(header_id::CONNECTION);
         if (i==headers.end()) {
             headers.insert(std::make_pair("Connection", ka));
         } else {
-            i->second.assign(ka);
+            i->second.assign(ka.data(), ka.size());
         }
         if (!common::request::write_header(os)) return false;
         return !os.eof() && !os.fail() && !os.bad();
     }
     
     bool client_request::write(std::ostream &os) {
+        return write_head(os) && write_body(os);
+    }
+    
+    bool client_request::write_head(std::ostream &os) {
         // Set "content-length"
-        auto i=headers.find("content-length");
+        std::string cl=boost::lexical_cast<std::string>(get_content_length());
+        auto i=headers.find(header_id::CONTENT_LENGTH);
         if (i==headers.end()) {
-            headers.insert(std::make_pair("Content-Length", boost::lexical_cast<std::string>(get_content_length())));
+            headers.insert(std::make_pair("Content-Length", cl));
         } else {
-            i->second.assign(boost::lexical_cast<std::string>(get_content_length()));
+            i->second.assign(cl.data(), cl.size());
         }
         // Write header
-        if (!write_header(os)) return false;
-        // Write body
+        return write_header(os);
+    }
+    
+    bool client_request::write_body(std::ostream &os) {
         if (!raw_body_stream_.vector().empty()) {
             os.write(&(raw_body_stream_.vector()[0]), raw_body_stream_.vector().size());
         }
@@ -93,6 +102,14 @@ namespace fibio { namespace http {
         return !os.eof() && !os.fail() && !os.bad();
     }
     
+    bool client_request::expect_continue() const {
+        auto i=headers.find(header_id::EXPECT);
+        return i!=headers.end()
+            && version==http_version::HTTP_1_1
+            && get_content_length()>0
+            && common::iequal()(i->second, std::string("100-continue"));
+    }
+    
     //////////////////////////////////////////////////////////////////////////////////////////
     // client_response
     //////////////////////////////////////////////////////////////////////////////////////////
@@ -110,23 +127,30 @@ namespace fibio { namespace http {
         return auto_decompress_;
     }
     
-    bool client_response::read(std::istream &is) {
+    bool client_response::read(std::istream &is, bool head) {
         clear();
         if (!common::response::read_header(is)) return false;
         
-        if (content_length>0) {
+        if (!head && (content_length>0 || chunked)) {
             // Setup body stream
             namespace bio = boost::iostreams;
             bio::filtering_istream *in=new bio::filtering_istream;
             if (auto_decompress_) {
                 // Support gzip only for now
-                auto i=headers.find("Content-Encoding");
+                auto i=headers.find(header_id::CONTENT_ENCODING);
                 if (i!=headers.end() && common::iequal()(i->second, std::string("gzip"))) {
                     in->push(boost::iostreams::gzip_decompressor());
                 }
             }
-            restriction_.reset(new bio::restriction<std::istream>(is, 0, content_length));
-            in->push(*restriction_);
+            if (chunked) {
+                if (!chunked_buf_) chunked_buf_.reset(new common::chunked_istreambuf);
+                chunked_buf_->reset(is.rdbuf());
+                chunked_stream_.reset(new std::istream(chunked_buf_.get()));
+                in->push(*chunked_stream_);
+            } else {
+                restriction_.reset(new bio::restriction<std::istream>(is, 0, content_length));
+                in->push(*restriction_);
+            }
             body_stream_.reset(in);
         }
         return true;
@@ -141,6 +165,7 @@ namespace fibio { namespace http {
             }
             body_stream_.reset();
             restriction_.reset();
+            chunked_stream_.reset();
         }
     }
     
@@ -193,7 +218,10 @@ namespace fibio { namespace http {
     boost::system::error_code client::connect(const std::string &server, const std::string &port) {
         server_=server;
         port_=port;
+        ctx_=nullptr;
         stream_=new tcp_stream();
+        body_unsent_=false;
+        reset_input_buffer();
         return static_cast<tcp_stream *>(stream_)->connect(server, port);
     }
     
@@ -204,7 +232,10 @@ namespace fibio { namespace http {
     boost::system::error_code client::connect(ssl::context &ctx, const std::string &server, const std::string &port) {
         server_=server;
         port_=port;
+        ctx_=&ctx;
         stream_=new ssl::tcp_stream(ctx);
+        body_unsent_=false;
+        reset_input_buffer();
         return static_cast<ssl::tcp_stream *>(stream_)->connect(server, port);
     }
     
@@ -212,6 +243,11 @@ namespace fibio { namespace http {
         return connect(ctx, server, boost::lexical_cast<std::string>(port));
     }
     
+    void client::reset_input_buffer() {
+        input_buffer_.reset(new common::input_buffer(stream_->rdbuf()));
+        input_stream_.reset(new std::istream(input_buffer_.get()));
+    }
+    
     void client::disconnect() {
         if (stream_) {
             stream_->close();
@@ -226,16 +262,78 @@ namespace fibio { namespace http {
         return auto_decompress_;
     }
     
+    void client::set_continue_timeout(timeout_type t) {
+        continue_timeout_=t;
+    }
+    
+    client::timeout_type client::get_continue_timeout() const {
+        return continue_timeout_;
+    }
+    
+    bool client::wait_readable(timeout_type timeout) {
+        if (input_buffer_->size()>0 || stream_->rdbuf()->in_avail()>0) return true;
+        boost::asio::ip::tcp::socket &sock=ctx_
+            ? static_cast<ssl::tcp_stream *>(stream_)->stream_descriptor().next_layer()
+            : static_cast<tcp_stream *>(stream_)->stream_descriptor();
+        boost::asio::basic_waitable_timer<std::chrono::steady_clock> timer(asio::get_io_service());
+        timer.expires_from_now(timeout);
+        bool timed_out=false;
+        // Timer fiber runs on the same thread, cancelling the wait never races with it
+        fiber watchdog(fiber::attributes(fiber::attributes::stick_with_parent), [&]() {
+            boost::system::error_code ec;
+            timer.async_wait(asio::yield[ec]);
+            if (ec) return;
+            timed_out=true;
+            sock.cancel(ec);
+        });
+        boost::system::error_code ec;
+        // Readable, closed or failed, either way the wait is over
+        sock.async_read_some(boost::asio::null_buffers(), asio::yield[ec]);
+        timer.cancel();
+        watchdog.join();
+        return !(timed_out && ec==boost::asio::error::operation_aborted);
+    }
+    
     bool client::send_request(request &req, response &resp) {
+        if (body_unsent_) {
+            // Server is still waiting for the body announced by last request
+            stream_->close();
+            return false;
+        }
         if (!stream_->is_open() || stream_->eof() || stream_->fail() || stream_->bad()) return false;
         // Make sure there is no pending data in the last response
         resp.clear();
         req.accept_compressed(auto_decompress_);
         resp.set_auto_decompression(auto_decompress_);
-        if(!req.write(*stream_)) return false;
+        if (req.expect_continue()) {
+            // Body is held back until the server asks for it, or until the server
+            // is taken as not knowing 100-continue
+            if (!req.write_head(*stream_)) return false;
+            stream_->flush();
+            input_stream_->clear();
+            if (wait_readable(continue_timeout_)) {
+                if (!resp.read(*input_stream_)) return false;
+                if (resp.status_code!=http_status_code::CONTINUE) {
+                    // Final answer without the body, the connection is left for reading
+                    // the response body only
+                    body_unsent_=true;
+                    return resp.status_code!=http_status_code::INVALID;
+                }
+            }
+            if (!req.write_body(*stream_)) return false;
+        } else if(!req.write(*stream_)) {
+            return false;
+        }
         if (!stream_->is_open() || stream_->eof() || stream_->fail() || stream_->bad()) return false;
         //if (!stream_.is_open()) return false;
-        return resp.read(*stream_) && (resp.status_code!=http_status_code::INVALID);
+        input_stream_->clear();
+        bool head=(req.method==http_method::HEAD);
+        if (!resp.read(*input_stream_, head)) return false;
+        // 100 Continue may come after the body has been sent on timeout
+        while (resp.status_code==http_status_code::CONTINUE) {
+            if (!resp.read(*input_stream_, head)) return false;
+        }
+        return resp.status_code!=http_status_code::INVALID;
     }
 
     client::request &make_request(client::request &req,
@@ -261,7 +359,8 @@ namespace fibio { namespace http {
         if(!parse_url(url, purl, false, false))
             return false;
         // TODO: HTTPS
-        std::string host=purl.host;
+        std::string hostname=to_string(purl.host);
+        std::string host=hostname;
         if (common::iequal()(purl.schema, "http")) {
             if(purl.port==0) {
                 purl.port=80;
@@ -269,7 +368,7 @@ namespace fibio { namespace http {
                 host+=':';
                 host+=boost::lexical_cast<std::string>(purl.port);
             }
-            if(!make_client(false, purl.host, purl.port))
+            if(!make_client(false, hostname, purl.port))
                 return false;
         } else if (common::iequal()(purl.schema, "https")) {
             if(purl.port==0) {
@@ -278,25 +377,25 @@ namespace fibio { namespace http {
                 host+=':';
                 host+=boost::lexical_cast<std::string>(purl.port);
             }
-            if(!make_client(true, purl.host, purl.port))
+            if(!make_client(true, hostname, purl.port))
                 return false;
         } else {
             // ERROR: Unknown protocol
             return false;
         }
         the_request_.url.reserve(url.length());
-        the_request_.url=purl.path;
+        the_request_.url.assign(purl.path.data(), purl.path.size());
         if(!purl.query.empty()) {
             the_request_.url+='?';
-            the_request_.url+=purl.query;
+            the_request_.url.append(purl.query.data(), purl.query.size());
         }
         if(!purl.fragment.empty()) {
             the_request_.url+='?';
-            the_request_.url+=purl.fragment;
+            the_request_.url.append(purl.fragment.data(), purl.fragment.size());
         }
         the_request_.version=http_version::HTTP_1_1;
         the_request_.keep_alive=true;
-        the_request_.headers.insert({"Host", std::move(host)});
+        the_request_.headers.insert({"Host", host});
         the_request_.headers.insert(hdr.begin(), hdr.end());
         return true;
     }
@@ -0,0 +1,56 @@
+//
+//  codel.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/28.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <cmath>
+#include "codel.hpp"
+
+namespace fibio { namespace http { namespace detail {
+    codel::codel(duration target, duration interval)
+    : target_(target)
+    , interval_(interval)
+    {}
+
+    bool codel::should_drop(duration sojourn, clock_type::time_point now) {
+        if (!enabled()) return false;
+        std::lock_guard<mutex> lock(mtx_);
+        bool ok_to_drop=false;
+        if (sojourn<target_) {
+            // Went below target, leave dropping state
+            first_above_time_=clock_type::time_point();
+        } else if (first_above_time_==clock_type::time_point()) {
+            first_above_time_=now+interval_;
+        } else if (now>=first_above_time_) {
+            ok_to_drop=true;
+        }
+
+        if (dropping_) {
+            if (!ok_to_drop) {
+                dropping_=false;
+                return false;
+            }
+            if (now<drop_next_) return false;
+            count_++;
+            drop_next_+=control_law();
+            return true;
+        }
+        if (!ok_to_drop) return false;
+        dropping_=true;
+        // Start with the drop rate of last time if it was not long ago
+        if (count_>2 && now-drop_next_<interval_*8) {
+            count_-=2;
+        } else {
+            count_=1;
+        }
+        drop_next_=now+control_law();
+        return true;
+    }
+
+    codel::duration codel::control_law() const {
+        return std::chrono::duration_cast<duration>(interval_/std::sqrt(double(count_)));
+    }
+}}} // End of namespace fibio::http::detail
@@ -0,0 +1,50 @@
+//
+//  codel.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/28.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_codel_hpp
+#define fibio_http_codel_hpp
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <fibio/mutex.hpp>
+
+namespace fibio { namespace http { namespace detail {
+    /**
+     * CoDel drop decision
+     *
+     * Sojourn time is the time a request waits before its handler runs, once it
+     * stays above target for a whole interval, requests are dropped at a rate
+     * growing with the square root of drop count until it goes below target.
+     */
+    struct codel {
+        typedef std::chrono::steady_clock clock_type;
+        typedef clock_type::duration duration;
+
+        codel(duration target, duration interval);
+
+        bool enabled() const { return target_>duration(0); }
+
+        // Called when the handler is about to run, returns true if request should be dropped
+        bool should_drop(duration sojourn, clock_type::time_point now=clock_type::now());
+
+    private:
+        // interval/sqrt(count)
+        duration control_law() const;
+
+        mutex mtx_;
+        duration target_;
+        duration interval_;
+        clock_type::time_point first_above_time_;
+        clock_type::time_point drop_next_;
+        uint32_t count_=0;
+        bool dropping_=false;
+    };
+}}} // End of namespace fibio::http::detail
+
+#endif
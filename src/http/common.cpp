@@ -9,141 +9,54 @@
 #include <string>
 #include <iostream>
 #include "../../http-parser/http_parser.h"
-#include <boost/lexical_cast.hpp>
 #include <fibio/http/common/common_types.hpp>
 #include <fibio/http/common/request.hpp>
 #include <fibio/http/common/response.hpp>
+#include <fibio/http/common/input_buffer.hpp>
 #include "url_parser.hpp"
+#include "http_tokens.hpp"
+#include "simd_parser.hpp"
 
 namespace fibio { namespace http { namespace common {
     namespace detail {
-        const std::map<http_version, std::string> http_version_name_map={
-            {http_version::HTTP_0_9, "HTTP/0.9"},
-            {http_version::HTTP_1_0, "HTTP/1.0"},
-            {http_version::HTTP_1_1, "HTTP/1.1"},
-        };
-        
-        const std::map<std::string, http_version, iless> name_http_version_map={
-            {"HTTP/0.9", http_version::HTTP_0_9},
-            {"HTTP/1.0", http_version::HTTP_1_0},
-            {"HTTP/1.1", http_version::HTTP_1_1},
+        /**
+         * Open addressing table from case-insensitive name hash to header_id,
+         * built once from header_names
+         */
+        struct header_id_table {
+            static constexpr size_t table_size=64;
+            static_assert(table_size>=header_id_count*2, "Header id table is too crowded");
+            
+            header_id_table() {
+                slots_.fill(header_id::UNKNOWN);
+                for (size_t i=1; i<header_id_count; i++) {
+                    size_t s=header_hash(header_names[i].view()) & (table_size-1);
+                    while (slots_[s]!=header_id::UNKNOWN) s=(s+1) & (table_size-1);
+                    slots_[s]=static_cast<header_id>(i);
+                }
+            }
+            
+            header_id lookup(const string_view &name) const {
+                size_t s=header_hash(name) & (table_size-1);
+                while (slots_[s]!=header_id::UNKNOWN) {
+                    if (iequal()(header_names[static_cast<size_t>(slots_[s])].view(), name)) return slots_[s];
+                    s=(s+1) & (table_size-1);
+                }
+                return header_id::UNKNOWN;
+            }
+            
+            std::array<header_id, table_size> slots_;
         };
         
-        const std::map<http_method, std::string> method_name_map={
-            {http_method::DELETE, "DELETE"},
-            {http_method::GET, "GET"},
-            {http_method::HEAD, "HEAD"},
-            {http_method::POST, "POST"},
-            {http_method::PUT, "PUT"},
-            /* pathological */
-            {http_method::CONNECT, "CONNECT"},
-            {http_method::OPTIONS, "OPTIONS"},
-            {http_method::TRACE, "TRACE"},
-            /* webdav */
-            {http_method::COPY, "COPY"},
-            {http_method::LOCK, "LOCK"},
-            {http_method::MKCOL, "MKCOL"},
-            {http_method::MOVE, "MOVE"},
-            {http_method::PROPFIND, "PROPFIND"},
-            {http_method::PROPPATCH, "PROPPATCH"},
-            {http_method::SEARCH, "SEARCH"},
-            {http_method::UNLOCK, "UNLOCK"},
-            /* subversion */
-            {http_method::REPORT, "REPORT"},
-            {http_method::MKACTIVITY, "MKACTIVITY"},
-            {http_method::CHECKOUT, "CHECKOUT"},
-            {http_method::MERGE, "MERGE"},
-            /* upnp */
-            {http_method::MSEARCH, "MSEARCH"},
-            {http_method::NOTIFY, "NOTIFY"},
-            {http_method::SUBSCRIBE, "SUBSCRIBE"},
-            {http_method::UNSUBSCRIBE, "UNSUBSCRIBE"},
-            /* RFC-5789 */
-            {http_method::PATCH, "PATCH"},
-            {http_method::PURGE, "PURGE"},
-        };
-
-        const std::map<std::string, http_method, iless> name_method_map={
-            {"DELETE",  http_method::DELETE},
-            {"GET",     http_method::GET},
-            {"HEAD",    http_method::HEAD},
-            {"POST",    http_method::POST},
-            {"PUT",     http_method::PUT},
-            /* pathological */
-            {"CONNECT", http_method::CONNECT},
-            {"OPTIONS", http_method::OPTIONS},
-            {"TRACE",   http_method::TRACE},
-            /* webdav */
-            {"COPY",    http_method::COPY},
-            {"LOCK",    http_method::LOCK},
-            {"MKCOL",   http_method::MKCOL},
-            {"MOVE",    http_method::MOVE},
-            {"PROPFIND",http_method::PROPFIND},
-            {"PROPPATCH", http_method::PROPPATCH},
-            {"SEARCH",  http_method::SEARCH},
-            {"UNLOCK",  http_method::UNLOCK},
-            /* subversion */
-            {"REPORT",  http_method::REPORT},
-            {"MKACTIVITY",  http_method::MKACTIVITY},
-            {"CHECKOUT",    http_method::CHECKOUT},
-            {"MERGE",   http_method::MERGE},
-            /* upnp */
-            {"MSEARCH", http_method::MSEARCH},
-            {"NOTIFY",  http_method::NOTIFY},
-            {"SUBSCRIBE",   http_method::SUBSCRIBE},
-            {"UNSUBSCRIBE", http_method::UNSUBSCRIBE},
-            /* RFC-5789 */
-            {"PATCH",   http_method::PATCH},
-            {"PURGE",   http_method::PURGE},
-        };
+        inline void rebase_view(string_view &v, const char *old_base, const char *new_base) {
+            if (v.empty()) return;
+            v=string_view(new_base+(v.data()-old_base), v.size());
+        }
         
-        const std::map<http_status_code, std::string> status_msg_map={
-            {http_status_code::CONTINUE                        , "Continue"},
-            {http_status_code::SWITCHING_PROTOCOLS             , "Switching Protocols"},
-            {http_status_code::OK                              , "OK"},
-            {http_status_code::CREATED                         , "Created"},
-            {http_status_code::ACCEPTED                        , "Accepted"},
-            {http_status_code::NON_AUTHORITATIVE_INFORMATION   , "Non-Authoritative Information"},
-            {http_status_code::NO_CONTENT                      , "No Content"},
-            {http_status_code::RESET_CONTENT                   , "Reset Content"},
-            {http_status_code::PARTIAL_CONTENT                 , "Partial Content"},
-            {http_status_code::MULTIPLE_CHOICES                , "Multiple Choices"},
-            {http_status_code::MOVED_PERMANENTLY               , "Moved Permanently"},
-            {http_status_code::FOUND                           , "Found"},
-            {http_status_code::SEE_OTHER                       , "See Other"},
-            {http_status_code::NOT_MODIFIED                    , "Not Modified"},
-            {http_status_code::USE_PROXY                       , "Use Proxy"},
-            //http_status_code::UNUSED                         , "(Unused)"},
-            {http_status_code::TEMPORARY_REDIRECT              , "Temporary Redirect"},
-            {http_status_code::BAD_REQUEST                     , "Bad Request"},
-            {http_status_code::UNAUTHORIZED                    , "Unauthorized"},
-            {http_status_code::PAYMENT_REQUIRED                , "Payment Required"},
-            {http_status_code::FORBIDDEN                       , "Forbidden"},
-            {http_status_code::NOT_FOUND                       , "Not Found"},
-            {http_status_code::METHOD_NOT_ALLOWED              , "Method Not Allowed"},
-            {http_status_code::NOT_ACCEPTABLE                  , "Not Acceptable"},
-            {http_status_code::PROXY_AUTHENTICATION_REQUIRED   , "Proxy Authentication Required"},
-            {http_status_code::REQUEST_TIMEOUT                 , "Request Timeout"},
-            {http_status_code::CONFLICT                        , "Conflict"},
-            {http_status_code::GONE                            , "Gone"},
-            {http_status_code::LENGTH_REQUIRED                 , "Length Required"},
-            {http_status_code::PRECONDITION_FAILED             , "Precondition Failed"},
-            {http_status_code::REQUEST_ENTITY_TOO_LARGE        , "Request Entity Too Large"},
-            {http_status_code::REQUEST_URI_TOO_LONG            , "Request-URI Too Long"},
-            {http_status_code::UNSUPPORTED_MEDIA_TYPE          , "Unsupported Media Type"},
-            {http_status_code::REQUESTED_RANGE_NOT_SATISFIABLE , "Requested Range Not Satisfiable"},
-            {http_status_code::EXPECTATION_FAILED              , "Expectation Failed"},
-            {http_status_code::UPGRADE_REQUIRED                , "Upgrade Required"},
-            {http_status_code::PRECONDITION_REQUIRED           , "Precondition Required"},
-            {http_status_code::TOO_MANY_REQUESTS               , "Too Many Requests"},
-            {http_status_code::REQUEST_HEADER_FIELDS_TOO_LARGE , "Request Header Fields Too Large"},
-            {http_status_code::INTERNAL_SERVER_ERROR           , "Internal Server Error"},
-            {http_status_code::NOT_IMPLEMENTED                 , "Not Implemented"},
-            {http_status_code::BAD_GATEWAY                     , "Bad Gateway"},
-            {http_status_code::SERVICE_UNAVAILABLE             , "Service Unavailable"},
-            {http_status_code::GATEWAY_TIMEOUT                 , "Gateway Timeout"},
-            {http_status_code::HTTP_VERSION_NOT_SUPPORTED      , "HTTP Version Not Supported"},
-        };
+        // Extend a view to cover [v.begin(), at+length)
+        inline void extend_view(string_view &v, const char *at, size_t length) {
+            v=string_view(v.data(), at+length-v.data());
+        }
         
         struct request_parser {
             typedef request_parser parser_type;
@@ -151,7 +64,18 @@ namespace fibio { namespace http { namespace common {
             : req_(req)
             {}
             
-            bool parse(std::istream &is);
+            bool parse(input_buffer &buf);
+            
+            // Buffered data has been moved, so do the views
+            void rebase(const char *old_base, const char *new_base) {
+                rebase_view(req_.url_view, old_base, new_base);
+                rebase_view(current_field_, old_base, new_base);
+                rebase_view(current_value_, old_base, new_base);
+                for (auto &f : req_.header_views.fields_) {
+                    rebase_view(f.first, old_base, new_base);
+                    rebase_view(f.second, old_base, new_base);
+                }
+            }
             
             int on_message_begin() {
                 req_.clear();
@@ -161,11 +85,9 @@ namespace fibio { namespace http { namespace common {
             
             int on_url(const char *at, size_t length) {
                 if(state_==url)
-                    req_.url.append(at, length);
-                else {
-                    req_.url.reserve(1024);
-                    req_.url.assign(at, length);
-                }
+                    extend_view(req_.url_view, at, length);
+                else
+                    req_.url_view=string_view(at, length);
                 state_=url;
                 return 0;
             }
@@ -177,14 +99,13 @@ namespace fibio { namespace http { namespace common {
             
             int on_header_field(const char *at, size_t length) {
                 if (state_==field) {
-                    current_field_.append(at, length);
+                    extend_view(current_field_, at, length);
                 } else {
                     if (state_==value) {
                         // One header line finished
-                        req_.headers.insert(std::make_pair(current_field_, current_value_));
+                        req_.header_views.insert(std::make_pair(current_field_, current_value_));
                     }
-                    current_field_.reserve(256);
-                    current_field_.assign(at, length);
+                    current_field_=string_view(at, length);
                 }
                 state_=field;
                 return 0;
@@ -192,19 +113,17 @@ namespace fibio { namespace http { namespace common {
             
             int on_header_value(const char *at, size_t length) {
                 if (state_==value)
-                    current_value_.append(at, length);
-                else {
-                    current_value_.reserve(256);
-                    current_value_.assign(at, length);
-                }
+                    extend_view(current_value_, at, length);
+                else
+                    current_value_=string_view(at, length);
                 state_=value;
                 return 0;
             }
             
             int on_headers_complete() {
                 // Finish last header
-                if (!current_field_.empty() && !current_value_.empty()) {
-                    req_.headers.insert(std::make_pair(current_field_, current_value_));
+                if (state_==value) {
+                    req_.header_views.insert(std::make_pair(current_field_, current_value_));
                 }
                 return 1;
             }
@@ -216,6 +135,8 @@ namespace fibio { namespace http { namespace common {
             int on_message_complete() {
                 // Don't parse body
                 state_=header_complete;
+                // Stop right after the header, following bytes belong to the body or next request
+                http_parser_pause(&parser_, 1);
                 
                 // Setup keep_alive flag
                 req_.keep_alive=(http_should_keep_alive(&parser_)!=0);
@@ -223,6 +144,7 @@ namespace fibio { namespace http { namespace common {
                 // Set content length
                 req_.content_length=parser_.content_length;
                 if (req_.content_length==ULONG_MAX) req_.content_length=0;
+                req_.chunked=(parser_.flags & F_CHUNKED)!=0;
                 
                 // Set HTTP version
                 if (parser_.http_major==0 && parser_.http_minor==9) {
@@ -255,8 +177,8 @@ namespace fibio { namespace http { namespace common {
             http_parser parser_;
             request &req_;
             parser_state state_;
-            std::string current_field_;
-            std::string current_value_;
+            string_view current_field_;
+            string_view current_value_;
         };
         
         namespace request {
@@ -297,37 +219,38 @@ namespace fibio { namespace http { namespace common {
             };
         }   // End of namespace fibio::http::common::detail::request
         
-        bool request_parser::parse(std::istream &is) {
+        bool request_parser::parse(input_buffer &buf) {
             http_parser_init(&parser_, HTTP_REQUEST);
             parser_.data=reinterpret_cast<void*>(this);
             state_=none;
-
-            constexpr int buf_size=1024;
-            char buf[buf_size];
-            std::streamsize recved=0;
-            std::streamsize nparsed=0;
-            while (!is.eof()) {
-                // Read some data
-                recved = is.readsome(buf, buf_size);
-                if (recved<=0) {
-                    // Connection closed
-                    return true;
-                }
-                nparsed=http_parser_execute(&parser_, &request::settings, buf, recved);
-                if (state_==header_complete) {
-                    // Parse error
-                    if (nparsed>=0) {
-                        // Move read pointer back to where parser consumed
-                        std::streamsize off=nparsed;
-                        off-=recved;
-                        is.seekg(off, std::ios_base::cur);
+            // Previous header block is not needed anymore, new one starts at the beginning
+            buf.unpin();
+            
+            size_t parsed=0;
+            while (true) {
+                if (buf.size()>parsed) {
+                    size_t n=buf.size()-parsed;
+                    size_t nparsed=http_parser_execute(&parser_, &request::settings, buf.data()+parsed, n);
+                    parsed+=nparsed;
+                    if (state_==header_complete) {
+                        // Keep header block in the buffer while the body is being read
+                        buf.consume(parsed);
+                        buf.pin();
+                        return true;
+                    } else if (nparsed!=n) {
+                        // Parse error
+                        return false;
                     }
-                    return true;
-                } else if (nparsed!=recved) {
+                }
+                // Read more data, views need to follow if buffered data is moved
+                const char *old_base=buf.data();
+                if (buf.fill()==0) {
+                    // Connection closed or header is too large
                     return false;
                 }
+                if (buf.data()!=old_base) rebase(old_base, buf.data());
             }
-            return true;
+            return false;
         }
         
         struct response_parser {
@@ -336,7 +259,18 @@ namespace fibio { namespace http { namespace common {
             : resp_(resp)
             {}
             
-            bool parse(std::istream &is);
+            bool parse(input_buffer &buf);
+            
+            // Buffered data has been moved, so do the views
+            void rebase(const char *old_base, const char *new_base) {
+                rebase_view(current_status_, old_base, new_base);
+                rebase_view(current_field_, old_base, new_base);
+                rebase_view(current_value_, old_base, new_base);
+                for (auto &f : resp_.header_views.fields_) {
+                    rebase_view(f.first, old_base, new_base);
+                    rebase_view(f.second, old_base, new_base);
+                }
+            }
             
             int on_message_begin() {
                 resp_.clear();
@@ -350,25 +284,22 @@ namespace fibio { namespace http { namespace common {
             
             int on_status(const char *at, size_t length) {
                 if(state_==status)
-                    resp_.status_message.append(at, length);
-                else {
-                    resp_.status_message.reserve(100);
-                    resp_.status_message.assign(at, length);
-                }
+                    extend_view(current_status_, at, length);
+                else
+                    current_status_=string_view(at, length);
                 state_=status;
                 return 0;
             }
             
             int on_header_field(const char *at, size_t length) {
                 if (state_==field) {
-                    current_field_.append(at, length);
+                    extend_view(current_field_, at, length);
                 } else {
                     if (state_==value) {
                         // One header line finished
-                        resp_.headers.insert(std::make_pair(current_field_, current_value_));
+                        resp_.header_views.insert(std::make_pair(current_field_, current_value_));
                     }
-                    current_field_.reserve(256);
-                    current_field_.assign(at, length);
+                    current_field_=string_view(at, length);
                 }
                 state_=field;
                 return 0;
@@ -376,19 +307,17 @@ namespace fibio { namespace http { namespace common {
             
             int on_header_value(const char *at, size_t length) {
                 if (state_==value)
-                    current_value_.append(at, length);
-                else {
-                    current_value_.reserve(256);
-                    current_value_.assign(at, length);
-                }
+                    extend_view(current_value_, at, length);
+                else
+                    current_value_=string_view(at, length);
                 state_=value;
                 return 0;
             }
             
             int on_headers_complete() {
                 // Finish last header
-                if (!current_field_.empty() && !current_value_.empty()) {
-                    resp_.headers.insert(std::make_pair(current_field_, current_value_));
+                if (state_==value) {
+                    resp_.header_views.insert(std::make_pair(current_field_, current_value_));
                 }
                 return 1;
             }
@@ -400,6 +329,11 @@ namespace fibio { namespace http { namespace common {
             int on_message_complete() {
                 // Don't parse body
                 state_=header_complete;
+                // Stop right after the header, following bytes belong to the body or next request
+                http_parser_pause(&parser_, 1);
+                
+                // Status message is short, always keep a copy
+                resp_.status_message.assign(current_status_.data(), current_status_.size());
                 
                 // Setup keep_alive flag
                 resp_.keep_alive=(http_should_keep_alive(&parser_)!=0);
@@ -407,6 +341,7 @@ namespace fibio { namespace http { namespace common {
                 // Set content length
                 resp_.content_length=parser_.content_length;
                 if (resp_.content_length==ULONG_MAX) resp_.content_length=0;
+                resp_.chunked=(parser_.flags & F_CHUNKED)!=0;
                 
                 // Set HTTP version
                 if (parser_.http_major==0 && parser_.http_minor==9) {
@@ -439,8 +374,9 @@ namespace fibio { namespace http { namespace common {
             http_parser parser_;
             response &resp_;
             parser_state state_;
-            std::string current_field_;
-            std::string current_value_;
+            string_view current_status_;
+            string_view current_field_;
+            string_view current_value_;
         };
         
         namespace response {
@@ -481,55 +417,178 @@ namespace fibio { namespace http { namespace common {
             };
         }   // End of namespace fibio::http::common::detail::response
         
-        bool response_parser::parse(std::istream &is) {
+        bool response_parser::parse(input_buffer &buf) {
             http_parser_init(&parser_, HTTP_RESPONSE);
             parser_.data=reinterpret_cast<void*>(this);
             state_=none;
+            // Previous header block is not needed anymore, new one starts at the beginning
+            buf.unpin();
             
-            constexpr int buf_size=1024;
-            char buf[buf_size];
-            std::streamsize recved=0;
-            std::streamsize nparsed=0;
-            while (!is.eof()) {
-                // Read some data
-                recved = is.readsome(buf, buf_size);
-                if (recved<=0) {
-                    // Connection closed
-                    return true;
-                }
-                nparsed=http_parser_execute(&parser_, &response::settings, buf, recved);
-                if (state_==header_complete) {
-                    // Parse error
-                    if (nparsed>=0) {
-                        // Move read pointer back to where parser consumed
-                        std::streamsize off=nparsed;
-                        off-=recved;
-                        is.seekg(off, std::ios_base::cur);
+            size_t parsed=0;
+            while (true) {
+                if (buf.size()>parsed) {
+                    size_t n=buf.size()-parsed;
+                    size_t nparsed=http_parser_execute(&parser_, &response::settings, buf.data()+parsed, n);
+                    parsed+=nparsed;
+                    if (state_==header_complete) {
+                        // Keep header block in the buffer while the body is being read
+                        buf.consume(parsed);
+                        buf.pin();
+                        return true;
+                    } else if (nparsed!=n) {
+                        // Parse error
+                        return false;
                     }
-                    return true;
-                } else if (nparsed!=recved) {
+                }
+                // Read more data, views need to follow if buffered data is moved
+                const char *old_base=buf.data();
+                if (buf.fill()==0) {
+                    // Connection closed or header is too large
                     return false;
                 }
+                if (buf.data()!=old_base) rebase(old_base, buf.data());
             }
-            return true;
+            return false;
+        }
+        
+        // Arena storage must be gone before the arena is reset, it's cheap to get
+        // again, heap storage keeps its capacity for next message
+        inline void clear_headers(header_map &headers) {
+            if (headers.get_allocator().arena_) release(headers);
+            else headers.clear();
         }
     }   // End of namespace fibio::http::common::detail
     
+    header_id lookup_header_id(const string_view &name) {
+        static const detail::header_id_table table;
+        return table.lookup(name);
+    }
+    
     //////////////////////////////////////////////////////////////////////////////////////////
     // request
     //////////////////////////////////////////////////////////////////////////////////////////
     
+    parsed_url_type::parsed_url_type(arena *a)
+    : schema(a)
+    , host(a)
+    , path(a)
+    , query(a)
+    , fragment(a)
+    , userinfo(a)
+    , path_components(a)
+    , query_params(a)
+    {}
+    
+    void parsed_url_type::clear() {
+        release(schema);
+        release(host);
+        port=0;
+        release(path);
+        release(query);
+        release(fragment);
+        release(userinfo);
+        release(path_components);
+        release(query_params);
+    }
+    
+    request::request(arena *a)
+    : headers(a)
+    , parsed_url(a)
+    {}
+    
+    request::request(const request &other)
+    : method(other.method)
+    , url(other.url)
+    , version(other.version)
+    , headers(other.headers)
+    , url_view(other.url_view)
+    , header_views(other.header_views)
+    , content_length(other.content_length)
+    , chunked(other.chunked)
+    , keep_alive(other.keep_alive)
+    , parsed_url(other.parsed_url)
+    , owned_views_(other.owned_views_)
+    {
+        // Containers are copied to the heap, views into the connection buffer are
+        // copied as well, so the copy outlives the connection
+        if (owned_views_) rebind_views();
+        else if (!url_view.empty()) copy_headers();
+    }
+    
+    request::request(request &&other)
+    : method(other.method)
+    , url(std::move(other.url))
+    , version(other.version)
+    , headers(std::move(other.headers))
+    , url_view(other.url_view)
+    , header_views(std::move(other.header_views))
+    , content_length(other.content_length)
+    , chunked(other.chunked)
+    , keep_alive(other.keep_alive)
+    , parsed_url(std::move(other.parsed_url))
+    , owned_views_(other.owned_views_)
+    {
+        // Short strings don't keep their address when moved
+        if (owned_views_) rebind_views();
+    }
+    
+    request &request::operator=(const request &other) {
+        if (this==&other) return *this;
+        method=other.method;
+        url=other.url;
+        version=other.version;
+        // Storage is moved in from heap copies, nothing is left on an arena
+        headers=header_map(other.headers);
+        url_view=other.url_view;
+        header_views=other.header_views;
+        content_length=other.content_length;
+        chunked=other.chunked;
+        keep_alive=other.keep_alive;
+        parsed_url=parsed_url_type(other.parsed_url);
+        owned_views_=other.owned_views_;
+        if (owned_views_) rebind_views();
+        else if (!url_view.empty()) copy_headers();
+        return *this;
+    }
+    
+    request &request::operator=(request &&other) {
+        if (this==&other) return *this;
+        method=other.method;
+        url=std::move(other.url);
+        version=other.version;
+        headers=std::move(other.headers);
+        url_view=other.url_view;
+        header_views=std::move(other.header_views);
+        content_length=other.content_length;
+        chunked=other.chunked;
+        keep_alive=other.keep_alive;
+        parsed_url=std::move(other.parsed_url);
+        owned_views_=other.owned_views_;
+        if (owned_views_) rebind_views();
+        return *this;
+    }
+    
     void request::clear() {
         method=http_method::INVALID;
         url.clear();
         version=http_version::INVALID;
-        headers.clear();
+        detail::clear_headers(headers);
+        url_view.clear();
+        header_views.clear();
         content_length=0;
+        chunked=false;
         keep_alive=false;
-        parsed_url=parsed_url_type();
+        parsed_url.clear();
+        owned_views_=false;
+    }
+    
+    void request::shrink(size_t limit) {
+        if (url.capacity()>limit) std::string().swap(url);
+        headers.shrink(limit);
+        header_views.shrink(limit);
     }
     
-    bool parse_url(const std::string url, parsed_url_type &parsed_url, bool parse_path, bool parse_query)
+    bool parse_url(const string_view &url, parsed_url_type &parsed_url, bool parse_path, bool parse_query)
     {
         if (!(parsed_url.path.empty() && parsed_url.path_components.empty())) {
             // Already parsed
@@ -537,7 +596,7 @@ namespace fibio { namespace http { namespace common {
         }
 
         http_parser_url p;
-        if(::http_parser_parse_url(url.c_str(),
+        if(::http_parser_parse_url(url.data(),
                                    url.length(),
                                    false,
                                    &p))
@@ -580,37 +639,93 @@ namespace fibio { namespace http { namespace common {
     }
     
     bool request::read_header(std::istream &is) {
+        input_buffer *buf=dynamic_cast<input_buffer *>(is.rdbuf());
+        if (buf) {
+            if (!read_header(*buf)) return false;
+        } else {
+            // Temporary buffer, give read-ahead bytes back to the stream afterward,
+            // views refer to it so they're copied before it goes away
+            input_buffer tmp(is.rdbuf());
+            bool ret=read_header(tmp);
+            if (ret) copy_headers();
+            tmp.unread();
+            return ret;
+        }
+        copy_headers();
+        return true;
+    }
+    
+    bool request::read_header(input_buffer &buf) {
+        if (detail::simd_parser_enabled()) {
+            switch (detail::simd_read_header(buf, *this)) {
+                case detail::simd_parse_result::complete:
+                    return true;
+                case detail::simd_parse_result::failed:
+                    return false;
+                case detail::simd_parse_result::fallback:
+                    // Unusual message, let http_parser handle it
+                    break;
+            }
+        }
         detail::request_parser parser(*this);
-        return parser.parse(is);
+        return parser.parse(buf);
     }
     
-    bool request::write_header(std::ostream &os) {
+    void request::copy_headers() {
+        url.assign(url_view.data(), url_view.size());
+        // Views may already refer to owned storage, build a new map first
+        header_map h(headers.get_allocator());
+        for (auto &v : header_views) {
+            h.insert(std::make_pair(v.first, v.second));
+        }
+        headers.swap(h);
+        // Views now refer to owned storage, raw buffer can be reused
+        rebind_views();
+    }
+    
+    void request::rebind_views() {
+        owned_views_=true;
+        url_view=url;
+        header_views.clear();
+        for (auto &h : headers) {
+            header_views.insert(std::make_pair(string_view(h.first), string_view(h.second)));
+        }
+    }
+    
+    bool request::serialize_header(std::string &buf) const {
         // Some validation
         if (method==http_method::INVALID) return false;
         if (url.empty()) return false;
         if (version==http_version::INVALID) return false;
         
         // METHOD " " URL " " HTTP_VER "\r\n"
-        auto m=detail::method_name_map.find(method);
-        if (m==detail::method_name_map.end()) return false;
-        os.write(&(m->second[0]), m->second.size());
-        os.write(" ", 1);
-        os.write(&(url[0]), url.size());
-        os.write(" ", 1);
-        auto v=detail::http_version_name_map.find(version);
-        if (v==detail::http_version_name_map.end()) return false;
-        os.write(&(v->second[0]), v->second.size());
-        os.write("\r\n", 2);
+        const detail::token *m=detail::method_name(method);
+        if (!m) return false;
+        const detail::token *v=detail::version_name(version);
+        if (!v) return false;
+        buf.append(m->data, m->size);
+        buf.push_back(' ');
+        buf.append(url);
+        buf.push_back(' ');
+        buf.append(v->data, v->size);
+        buf.append("\r\n", 2);
         
         // Write headers
         for (auto &p: headers) {
-            os.write(&(p.first[0]), p.first.size());
-            os.write(": ", 2);
-            os.write(&(p.second[0]), p.second.size());
-            os.write("\r\n", 2);
+            buf.append(p.first.data(), p.first.size());
+            buf.append(": ", 2);
+            buf.append(p.second.data(), p.second.size());
+            buf.append("\r\n", 2);
         }
         // End of header
-        os.write("\r\n", 2);
+        buf.append("\r\n", 2);
+        return true;
+    }
+    
+    bool request::write_header(std::ostream &os) {
+        std::string buf;
+        if (!serialize_header(buf)) return false;
+        os.write(buf.data(), buf.size());
         return true;
     }
     
@@ -618,50 +733,169 @@ namespace fibio { namespace http { namespace common {
     // response
     //////////////////////////////////////////////////////////////////////////////////////////
     
+    response::response(arena *a)
+    : headers(a)
+    {}
+    
+    response::response(const response &other)
+    : version(other.version)
+    , status_code(other.status_code)
+    , status_message(other.status_message)
+    , headers(other.headers)
+    , header_views(other.header_views)
+    , content_length(other.content_length)
+    , chunked(other.chunked)
+    , keep_alive(other.keep_alive)
+    , owned_views_(other.owned_views_)
+    {
+        // Same as request, the copy doesn't refer to the connection buffer or arena
+        if (owned_views_) rebind_views();
+        else if (!header_views.empty()) copy_headers();
+    }
+    
+    response::response(response &&other)
+    : version(other.version)
+    , status_code(other.status_code)
+    , status_message(std::move(other.status_message))
+    , headers(std::move(other.headers))
+    , header_views(std::move(other.header_views))
+    , content_length(other.content_length)
+    , chunked(other.chunked)
+    , keep_alive(other.keep_alive)
+    , owned_views_(other.owned_views_)
+    {
+        // Short strings don't keep their address when moved
+        if (owned_views_) rebind_views();
+    }
+    
+    response &response::operator=(const response &other) {
+        if (this==&other) return *this;
+        version=other.version;
+        status_code=other.status_code;
+        status_message=other.status_message;
+        headers=header_map(other.headers);
+        header_views=other.header_views;
+        content_length=other.content_length;
+        chunked=other.chunked;
+        keep_alive=other.keep_alive;
+        owned_views_=other.owned_views_;
+        if (owned_views_) rebind_views();
+        else if (!header_views.empty()) copy_headers();
+        return *this;
+    }
+    
+    response &response::operator=(response &&other) {
+        if (this==&other) return *this;
+        version=other.version;
+        status_code=other.status_code;
+        status_message=std::move(other.status_message);
+        headers=std::move(other.headers);
+        header_views=std::move(other.header_views);
+        content_length=other.content_length;
+        chunked=other.chunked;
+        keep_alive=other.keep_alive;
+        owned_views_=other.owned_views_;
+        if (owned_views_) rebind_views();
+        return *this;
+    }
+    
     void response::clear() {
         status_code=http_status_code::INVALID;
         status_message.clear();
         version=http_version::INVALID;
-        headers.clear();
+        detail::clear_headers(headers);
+        header_views.clear();
         content_length=0;
+        chunked=false;
         keep_alive=false;
+        owned_views_=false;
+    }
+    
+    void response::shrink(size_t limit) {
+        if (status_message.capacity()>limit) std::string().swap(status_message);
+        headers.shrink(limit);
+        header_views.shrink(limit);
     }
     
     bool response::read_header(std::istream &is) {
+        input_buffer *buf=dynamic_cast<input_buffer *>(is.rdbuf());
+        if (buf) {
+            if (!read_header(*buf)) return false;
+        } else {
+            // Temporary buffer, give read-ahead bytes back to the stream afterward,
+            // views refer to it so they're copied before it goes away
+            input_buffer tmp(is.rdbuf());
+            bool ret=read_header(tmp);
+            if (ret) copy_headers();
+            tmp.unread();
+            return ret;
+        }
+        copy_headers();
+        return true;
+    }
+    
+    bool response::read_header(input_buffer &buf) {
+        if (detail::simd_parser_enabled()) {
+            switch (detail::simd_read_header(buf, *this)) {
+                case detail::simd_parse_result::complete:
+                    return true;
+                case detail::simd_parse_result::failed:
+                    return false;
+                case detail::simd_parse_result::fallback:
+                    // Unusual message, let http_parser handle it
+                    break;
+            }
+        }
         detail::response_parser parser(*this);
-        return parser.parse(is);
+        return parser.parse(buf);
     }
     
-    bool response::write_header(std::ostream &os) {
+    void response::copy_headers() {
+        // Views may already refer to owned storage, build a new map first
+        header_map h(headers.get_allocator());
+        for (auto &v : header_views) {
+            h.insert(std::make_pair(v.first, v.second));
+        }
+        headers.swap(h);
+        // Views now refer to owned storage, raw buffer can be reused
+        rebind_views();
+    }
+    
+    void response::rebind_views() {
+        owned_views_=true;
+        header_views.clear();
+        for (auto &h : headers) {
+            header_views.insert(std::make_pair(string_view(h.first), string_view(h.second)));
+        }
+    }
+    
+    bool response::serialize_header(std::string &buf) const {
         // Some validation
         if (status_code==http_status_code::INVALID) return false;
         //if (status_message.empty()) return false;
         if (version==http_version::INVALID) return false;
         
-        // HTTP_VER " " STATUS_CODE URL " "  "\r\n"
-        auto v=detail::http_version_name_map.find(version);
-        if (v==detail::http_version_name_map.end()) return false;
-        os.write(&(v->second[0]), v->second.size());
-        os.write(" ", 1);
-        
-        std::string sc=boost::lexical_cast<std::string>(static_cast<unsigned short>(status_code));
-        os.write(&(sc[0]), sc.size());
-        os.write(" ", 1);
-
-        auto s=detail::status_msg_map.find(status_code);
-        if (s==detail::status_msg_map.end()) return false;
-        os.write(&(s->second[0]), s->second.size());
-        os.write("\r\n", 2);
+        // HTTP_VER " " STATUS_CODE " " STATUS_MESSAGE "\r\n", pre-serialized
+        const detail::token *l=detail::status_line(version, status_code);
+        if (!l) return false;
+        buf.append(l->data, l->size);
         
         // Write headers
         for (auto &p: headers) {
-            os.write(&(p.first[0]), p.first.size());
-            os.write(": ", 2);
-            os.write(&(p.second[0]), p.second.size());
-            os.write("\r\n", 2);
+            buf.append(p.first.data(), p.first.size());
+            buf.append(": ", 2);
+            buf.append(p.second.data(), p.second.size());
+            buf.append("\r\n", 2);
         }
         // End of header
-        os.write("\r\n", 2);
+        buf.append("\r\n", 2);
+        return true;
+    }
+    
+    bool response::write_header(std::ostream &os) {
+        std::string buf;
+        if (!serialize_header(buf)) return false;
+        os.write(buf.data(), buf.size());
         return true;
     }
 }}} // End of namespace fibio::http::common
@@ -0,0 +1,294 @@
+//
+//  compression.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/30.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <climits>
+#include <cstring>
+#include <zlib.h>
+#include <openssl/sha.h>
+#include <boost/algorithm/string/predicate.hpp>
+#include "compression.hpp"
+#include "http_tokens.hpp"
+
+namespace fibio { namespace http { namespace detail {
+    namespace {
+        inline void skip_spaces(const char *&p, const char *e) {
+            while (p<e && (*p==' ' || *p=='\t')) p++;
+        }
+
+        // q-value in thousandths, malformed values count as 0
+        int parse_qvalue(const char *p, const char *e) {
+            skip_spaces(p, e);
+            while (e>p && (e[-1]==' ' || e[-1]=='\t')) e--;
+            if (p==e || (*p!='0' && *p!='1')) return 0;
+            int v=(*p++-'0')*1000;
+            if (p<e && *p=='.') {
+                p++;
+                for (int scale=100; p<e && scale>0; scale/=10, p++) {
+                    if (*p<'0' || *p>'9') return 0;
+                    v+=(*p-'0')*scale;
+                }
+            }
+            return (p==e && v<=1000) ? v : 0;
+        }
+    }
+
+    content_coding negotiate_encoding(const string_view &accept_encoding) {
+        common::iequal eq;
+        int gzip_q=-1, deflate_q=-1, any_q=-1;
+        const char *p=accept_encoding.begin();
+        const char *e=accept_encoding.end();
+        while (p<e) {
+            const char *end=std::find(p, e, ',');
+            skip_spaces(p, end);
+            const char *t=p;
+            while (t<end && *t!=';' && *t!=' ' && *t!='\t') t++;
+            string_view coding(p, t-p);
+            int q=1000;
+            for (const char *param=std::find(t, end, ';'); param<end; ) {
+                const char *next=std::find(param+1, end, ';');
+                const char *n=param+1;
+                skip_spaces(n, next);
+                if (next-n>=2 && (n[0]=='q' || n[0]=='Q') && n[1]=='=') q=parse_qvalue(n+2, next);
+                param=next;
+            }
+            if (eq(coding, string_view("gzip")) || eq(coding, string_view("x-gzip"))) {
+                gzip_q=q;
+            } else if (eq(coding, string_view("deflate"))) {
+                deflate_q=q;
+            } else if (coding=="*") {
+                any_q=q;
+            }
+            p=end+1;
+        }
+        // "*" covers codings not listed
+        if (gzip_q<0) gzip_q=any_q;
+        if (deflate_q<0) deflate_q=any_q;
+        if (gzip_q<=0 && deflate_q<=0) return content_coding::IDENTITY;
+        return gzip_q>=deflate_q ? content_coding::GZIP : content_coding::DEFLATE;
+    }
+
+    const char *coding_name(content_coding c) {
+        switch (c) {
+            case content_coding::GZIP: return "gzip";
+            case content_coding::DEFLATE: return "deflate";
+            default: return "identity";
+        }
+    }
+
+    int window_bits(content_coding c) {
+        // gzip wrapper is selected by adding 16 to window bits
+        return (c==content_coding::GZIP) ? 15+16 : 15;
+    }
+
+    bool compress(content_coding c, int level, const char *data, size_t size, std::string &out) {
+        if (c==content_coding::IDENTITY || size>UINT_MAX) return false;
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, level, Z_DEFLATED, window_bits(c), 8, Z_DEFAULT_STRATEGY)!=Z_OK) return false;
+        // Bound is large enough to finish in one call
+        out.resize(deflateBound(&zs, size));
+        zs.next_in=reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zs.avail_in=uInt(size);
+        zs.next_out=reinterpret_cast<Bytef *>(&out[0]);
+        zs.avail_out=uInt(out.size());
+        int r=deflate(&zs, Z_FINISH);
+        deflateEnd(&zs);
+        if (r!=Z_STREAM_END) return false;
+        out.resize(zs.total_out);
+        return true;
+    }
+
+    bool compressible_type(const string_view &content_type) {
+        static constexpr const char *compressed_types[]={
+            "image/",
+            "video/",
+            "audio/",
+            "font/woff",
+            "application/font-woff",
+            "application/zip",
+            "application/gzip",
+            "application/x-gzip",
+            "application/x-bzip2",
+            "application/x-xz",
+            "application/x-7z-compressed",
+            "application/x-rar-compressed",
+            "application/octet-stream",
+        };
+        if (boost::algorithm::istarts_with(content_type, "image/svg")) return true;
+        for (auto t : compressed_types) {
+            if (boost::algorithm::istarts_with(content_type, t)) return false;
+        }
+        return true;
+    }
+
+    content_digest digest(const string_view &body) {
+        content_digest d;
+        SHA256(reinterpret_cast<const unsigned char *>(body.data()), body.size(), d.data());
+        return d;
+    }
+
+    bool compression_cache::key_type::operator<(const key_type &other) const {
+        if (owner.owner_before(other.owner)) return true;
+        if (other.owner.owner_before(owner)) return false;
+        if (data!=other.data) return std::less<const char *>()(data, other.data);
+        if (size!=other.size) return size<other.size;
+        if (coding!=other.coding) return coding<other.coding;
+        return digest<other.digest;
+    }
+
+    compression_cache::compression_cache(size_t budget)
+    : budget_(budget)
+    {}
+
+    compression_cache::entry_ptr compression_cache::find(const key_type &key) {
+        std::lock_guard<mutex> lock(mtx_);
+        auto i=index_.find(key);
+        if (i==index_.end()) return entry_ptr();
+        lru_.splice(lru_.begin(), lru_, i->second);
+        return lru_.front();
+    }
+
+    void compression_cache::insert(entry_ptr e) {
+        // A few large bodies shouldn't flush everything else
+        if (cost(*e)>budget_/8) return;
+        std::lock_guard<mutex> lock(mtx_);
+        if (index_.find(e->key)!=index_.end()) return;
+        usage_+=cost(*e);
+        lru_.push_front(std::move(e));
+        index_.emplace(lru_.front()->key, lru_.begin());
+        while (usage_>budget_ && !lru_.empty()) {
+            const entry &victim=*lru_.back();
+            usage_-=cost(victim);
+            index_.erase(victim.key);
+            lru_.pop_back();
+        }
+    }
+
+    namespace {
+        // Responses that may be compressed differ by Accept-Encoding
+        void add_vary(server_response &resp) {
+            auto vary=resp.headers.find(header_id::VARY);
+            if (vary==resp.headers.end()) {
+                resp.headers.insert(std::make_pair("Vary", "Accept-Encoding"));
+            } else if (!boost::algorithm::icontains(vary->second, "Accept-Encoding")) {
+                vary->second.append(", Accept-Encoding");
+            }
+        }
+
+        // Strong validators belong to the identity body, keep them weak
+        void weaken_etag(server_response &resp) {
+            if (!resp.static_headers_.empty()) {
+                std::string headers;
+                const char *p=resp.static_headers_.begin();
+                const char *end=resp.static_headers_.end();
+                while (p<end) {
+                    const char *eol=std::min(std::find(p, end, '\r')+2, end);
+                    if (boost::algorithm::istarts_with(string_view(p, eol-p), "ETag: \"")) {
+                        headers.append("ETag: W/");
+                        headers.append(p+6, eol);
+                    } else {
+                        headers.append(p, eol);
+                    }
+                    p=eol;
+                }
+                resp.range_headers_.swap(headers);
+                resp.static_headers_=resp.range_headers_;
+            }
+            auto etag=resp.headers.find(header_id::ETAG);
+            if (etag!=resp.headers.end() && !boost::algorithm::starts_with(etag->second, "W/")) {
+                etag->second.insert(0, "W/");
+            }
+        }
+
+        // Body is compressed for clients accepting it
+        bool qualifies(server_response &resp, const compressor &c) {
+            if (resp.chunked() || resp.has_file_body()) return false;
+            if (!resp.find_header("Content-Encoding").empty()) return false;
+            size_t size=resp.static_owner_ ? resp.static_body_.size() : resp.get_body().size();
+            return size>=c.min_size && compressible_type(resp.find_header("Content-Type"));
+        }
+
+        // Coding accepted by the client, identity if none
+        content_coding accepted_coding(const common::header_view_map &request_headers) {
+            auto ae=request_headers.find(header_id::ACCEPT_ENCODING);
+            if (ae==request_headers.end()) return content_coding::IDENTITY;
+            return negotiate_encoding(ae->second);
+        }
+    }
+
+    bool vary_on_encoding(server_response &resp, const compressor &c) {
+        if (resp.status_code!=http_status_code::OK && resp.status_code!=http_status_code::NOT_MODIFIED) return false;
+        if (!qualifies(resp, c)) return false;
+        add_vary(resp);
+        return true;
+    }
+
+    void compress_response(server_response &resp,
+                           const common::header_view_map &request_headers,
+                           compressor &c)
+    {
+        // Only 200, ranges are served from the identity body, a 304 of a static
+        // body gets the same ETag as the 200 without being compressed
+        bool not_modified=(resp.status_code==http_status_code::NOT_MODIFIED);
+        if (resp.status_code!=http_status_code::OK && !not_modified) return;
+        if (!qualifies(resp, c)) return;
+        string_view body=resp.static_owner_ ? resp.static_body_ : string_view(resp.get_body());
+        content_coding coding=accepted_coding(request_headers);
+        if (coding==content_coding::IDENTITY) return;
+
+        compression_cache::entry_ptr e;
+        if (!not_modified) {
+            compression_cache::key_type key{resp.static_owner_, body.data(), body.size(), coding, {}};
+            if (c.cache && !resp.static_owner_) {
+                // Buffered bodies are built for each response, the same content is
+                // found by its digest, hashing is much cheaper than deflate
+                key.data=nullptr;
+                key.digest=digest(body);
+            }
+            if (c.cache) e=c.cache->find(key);
+            if (!e) {
+                std::shared_ptr<compression_cache::entry> n(new compression_cache::entry);
+                if (!compress(coding, c.level, body.data(), body.size(), n->compressed)) return;
+                // Not worth it
+                if (n->compressed.size()>=body.size()) return;
+                if (c.cache) {
+                    n->key=std::move(key);
+                    c.cache->insert(n);
+                }
+                e=n;
+            }
+        }
+
+        weaken_etag(resp);
+        if (not_modified) return;
+        resp.headers.insert(std::make_pair("Content-Encoding", coding_name(coding)));
+        std::string v;
+        resp.raw_body_stream_.swap_vector(v);
+        v.clear();
+        resp.raw_body_stream_.swap_vector(v);
+        resp.set_static_body(e, string_view(e->compressed), resp.static_headers_);
+    }
+
+    void compress_stream(server_response &resp,
+                         const common::header_view_map &request_headers,
+                         const compressor &c,
+                         size_t size,
+                         bool last)
+    {
+        if (resp.status_code!=http_status_code::OK) return;
+        if (!resp.find_header("Content-Encoding").empty()) return;
+        // Whole body is known if it fits in the first chunk
+        if ((last && size<c.min_size) || !compressible_type(resp.find_header("Content-Type"))) return;
+        add_vary(resp);
+        content_coding coding=accepted_coding(request_headers);
+        if (coding==content_coding::IDENTITY) return;
+        if (!resp.chunked_buf_->set_deflate(c.level, window_bits(coding))) return;
+        weaken_etag(resp);
+        resp.headers.insert(std::make_pair("Content-Encoding", coding_name(coding)));
+    }
+}}} // End of namespace fibio::http::detail
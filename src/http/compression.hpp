@@ -0,0 +1,136 @@
+//
+//  compression.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/30.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_compression_hpp
+#define fibio_http_compression_hpp
+
+#include <cstdint>
+#include <array>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <fibio/mutex.hpp>
+#include <fibio/http/common/common_types.hpp>
+#include <fibio/http/common/header_map.hpp>
+#include <fibio/http/server/response.hpp>
+
+namespace fibio { namespace http { namespace detail {
+    enum class content_coding {
+        IDENTITY,
+        GZIP,
+        DEFLATE,
+    };
+
+    /**
+     * Pick a coding from Accept-Encoding by q-values, gzip is preferred on a tie,
+     * codings with q=0 are never chosen
+     */
+    content_coding negotiate_encoding(const string_view &accept_encoding);
+
+    // Token used in Content-Encoding
+    const char *coding_name(content_coding c);
+
+    // zlib window bits giving the coding's wrapper
+    int window_bits(content_coding c);
+
+    // Compress whole input in one pass, out is replaced
+    bool compress(content_coding c, int level, const char *data, size_t size, std::string &out);
+
+    // Already compressed media types are not worth compressing again
+    bool compressible_type(const string_view &content_type);
+
+    // SHA-256 of a buffered body
+    typedef std::array<unsigned char, 32> content_digest;
+
+    content_digest digest(const string_view &body);
+
+    /**
+     * Compressed bodies, least recently used ones are evicted when the budget is
+     * exceeded, only compressed bytes are kept
+     *
+     * Static bodies don't change while their owner lives, they're keyed by owner
+     * and location, a weak reference to the owner keeps its identity from being
+     * reused, so nothing is hashed or compared. Buffered bodies have no owner and
+     * are keyed by length and digest of their content.
+     */
+    struct compression_cache {
+        struct key_type {
+            bool operator<(const key_type &other) const;
+
+            std::weak_ptr<const void> owner;
+            // Null for buffered bodies
+            const char *data;
+            size_t size;
+            content_coding coding;
+            // Only set for buffered bodies
+            content_digest digest;
+        };
+
+        struct entry {
+            key_type key;
+            std::string compressed;
+        };
+        typedef std::shared_ptr<const entry> entry_ptr;
+
+        explicit compression_cache(size_t budget);
+
+        entry_ptr find(const key_type &key);
+
+        void insert(entry_ptr e);
+
+        size_t budget() const { return budget_; }
+
+    private:
+        typedef std::list<entry_ptr> lru_type;
+
+        static size_t cost(const entry &e) { return e.compressed.size()+sizeof(entry); }
+
+        mutex mtx_;
+        size_t budget_;
+        size_t usage_=0;
+        // Most recently used first
+        lru_type lru_;
+        std::map<key_type, lru_type::iterator> index_;
+    };
+
+    struct compressor {
+        int level;
+        size_t min_size;
+        std::unique_ptr<compression_cache> cache;
+    };
+
+    /**
+     * Add "Vary: Accept-Encoding" to a 200 or 304 whose body may be compressed,
+     * called before ranges are applied so 206 and 416 of the body get it as well,
+     * returns true if the body qualifies
+     */
+    bool vary_on_encoding(server_response &resp, const compressor &c);
+
+    /**
+     * Compress a buffered or cached body if the client accepts it, file bodies
+     * are sent as is, both buffered and cached bodies go into the compression
+     * cache, Vary is left to vary_on_encoding()
+     */
+    void compress_response(server_response &resp,
+                           const common::header_view_map &request_headers,
+                           compressor &c);
+
+    /**
+     * Called before the first chunk of a streamed body, turns on deflate in the
+     * chunked stream if the client accepts it, size and last are of first chunk
+     */
+    void compress_stream(server_response &resp,
+                         const common::header_view_map &request_headers,
+                         const compressor &c,
+                         size_t size,
+                         bool last);
+}}} // End of namespace fibio::http::detail
+
+#endif
@@ -0,0 +1,359 @@
+//
+//  http_tokens.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/21.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_http_tokens_hpp
+#define fibio_http_http_tokens_hpp
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <fibio/http/common/common_types.hpp>
+#include <fibio/http/common/header_map.hpp>
+
+namespace fibio { namespace http { namespace common { namespace detail {
+    /**
+     * Pre-serialized protocol tokens, all of them are compile-time constants,
+     * so writing a status line or method name is a single memcpy
+     */
+    struct token {
+        const char *data;
+        size_t size;
+
+        string_view view() const { return string_view(data, size); }
+    };
+
+#define FIBIO_HTTP_TOKEN(s) {s, sizeof(s)-1}
+
+#define FIBIO_HTTP_STATUS_CODES(X) \
+    X(100, "Continue") \
+    X(101, "Switching Protocols") \
+    X(200, "OK") \
+    X(201, "Created") \
+    X(202, "Accepted") \
+    X(203, "Non-Authoritative Information") \
+    X(204, "No Content") \
+    X(205, "Reset Content") \
+    X(206, "Partial Content") \
+    X(300, "Multiple Choices") \
+    X(301, "Moved Permanently") \
+    X(302, "Found") \
+    X(303, "See Other") \
+    X(304, "Not Modified") \
+    X(305, "Use Proxy") \
+    X(307, "Temporary Redirect") \
+    X(400, "Bad Request") \
+    X(401, "Unauthorized") \
+    X(402, "Payment Required") \
+    X(403, "Forbidden") \
+    X(404, "Not Found") \
+    X(405, "Method Not Allowed") \
+    X(406, "Not Acceptable") \
+    X(407, "Proxy Authentication Required") \
+    X(408, "Request Timeout") \
+    X(409, "Conflict") \
+    X(410, "Gone") \
+    X(411, "Length Required") \
+    X(412, "Precondition Failed") \
+    X(413, "Request Entity Too Large") \
+    X(414, "Request-URI Too Long") \
+    X(415, "Unsupported Media Type") \
+    X(416, "Requested Range Not Satisfiable") \
+    X(417, "Expectation Failed") \
+    X(426, "Upgrade Required") \
+    X(428, "Precondition Required") \
+    X(429, "Too Many Requests") \
+    X(431, "Request Header Fields Too Large") \
+    X(500, "Internal Server Error") \
+    X(501, "Not Implemented") \
+    X(502, "Bad Gateway") \
+    X(503, "Service Unavailable") \
+    X(504, "Gateway Timeout") \
+    X(505, "HTTP Version Not Supported")
+
+    // Position of a status code in status tables
+    enum status_index_type : int {
+#define FIBIO_HTTP_STATUS_INDEX(code, msg) STATUS_INDEX_##code,
+        FIBIO_HTTP_STATUS_CODES(FIBIO_HTTP_STATUS_INDEX)
+#undef FIBIO_HTTP_STATUS_INDEX
+        STATUS_INDEX_COUNT,
+        STATUS_INDEX_INVALID=-1,
+    };
+
+    inline status_index_type status_index(http_status_code c) {
+        switch (c) {
+#define FIBIO_HTTP_STATUS_CASE(code, msg) case static_cast<http_status_code>(code): return STATUS_INDEX_##code;
+            FIBIO_HTTP_STATUS_CODES(FIBIO_HTTP_STATUS_CASE)
+#undef FIBIO_HTTP_STATUS_CASE
+            default: return STATUS_INDEX_INVALID;
+        }
+    }
+
+    // Position of a version in version tables
+    enum version_index_type : int {
+        VERSION_INDEX_0_9,
+        VERSION_INDEX_1_0,
+        VERSION_INDEX_1_1,
+        VERSION_INDEX_COUNT,
+        VERSION_INDEX_INVALID=-1,
+    };
+
+    inline version_index_type version_index(http_version v) {
+        switch (v) {
+            case http_version::HTTP_0_9: return VERSION_INDEX_0_9;
+            case http_version::HTTP_1_0: return VERSION_INDEX_1_0;
+            case http_version::HTTP_1_1: return VERSION_INDEX_1_1;
+            default: return VERSION_INDEX_INVALID;
+        }
+    }
+
+    constexpr token version_names[VERSION_INDEX_COUNT]={
+        FIBIO_HTTP_TOKEN("HTTP/0.9"),
+        FIBIO_HTTP_TOKEN("HTTP/1.0"),
+        FIBIO_HTTP_TOKEN("HTTP/1.1"),
+    };
+
+    // Complete status lines, i.e. "HTTP/1.1 200 OK\r\n"
+    constexpr token status_lines[VERSION_INDEX_COUNT][STATUS_INDEX_COUNT]={
+        {
+#define FIBIO_HTTP_STATUS_LINE(code, msg) FIBIO_HTTP_TOKEN("HTTP/0.9 " #code " " msg "\r\n"),
+            FIBIO_HTTP_STATUS_CODES(FIBIO_HTTP_STATUS_LINE)
+#undef FIBIO_HTTP_STATUS_LINE
+        },
+        {
+#define FIBIO_HTTP_STATUS_LINE(code, msg) FIBIO_HTTP_TOKEN("HTTP/1.0 " #code " " msg "\r\n"),
+            FIBIO_HTTP_STATUS_CODES(FIBIO_HTTP_STATUS_LINE)
+#undef FIBIO_HTTP_STATUS_LINE
+        },
+        {
+#define FIBIO_HTTP_STATUS_LINE(code, msg) FIBIO_HTTP_TOKEN("HTTP/1.1 " #code " " msg "\r\n"),
+            FIBIO_HTTP_STATUS_CODES(FIBIO_HTTP_STATUS_LINE)
+#undef FIBIO_HTTP_STATUS_LINE
+        },
+    };
+
+    // Indexed by http_method value
+    constexpr token method_names[]={
+        FIBIO_HTTP_TOKEN("DELETE"),
+        FIBIO_HTTP_TOKEN("GET"),
+        FIBIO_HTTP_TOKEN("HEAD"),
+        FIBIO_HTTP_TOKEN("POST"),
+        FIBIO_HTTP_TOKEN("PUT"),
+        /* pathological */
+        FIBIO_HTTP_TOKEN("CONNECT"),
+        FIBIO_HTTP_TOKEN("OPTIONS"),
+        FIBIO_HTTP_TOKEN("TRACE"),
+        /* webdav */
+        FIBIO_HTTP_TOKEN("COPY"),
+        FIBIO_HTTP_TOKEN("LOCK"),
+        FIBIO_HTTP_TOKEN("MKCOL"),
+        FIBIO_HTTP_TOKEN("MOVE"),
+        FIBIO_HTTP_TOKEN("PROPFIND"),
+        FIBIO_HTTP_TOKEN("PROPPATCH"),
+        FIBIO_HTTP_TOKEN("SEARCH"),
+        FIBIO_HTTP_TOKEN("UNLOCK"),
+        /* subversion */
+        FIBIO_HTTP_TOKEN("REPORT"),
+        FIBIO_HTTP_TOKEN("MKACTIVITY"),
+        FIBIO_HTTP_TOKEN("CHECKOUT"),
+        FIBIO_HTTP_TOKEN("MERGE"),
+        /* upnp */
+        FIBIO_HTTP_TOKEN("MSEARCH"),
+        FIBIO_HTTP_TOKEN("NOTIFY"),
+        FIBIO_HTTP_TOKEN("SUBSCRIBE"),
+        FIBIO_HTTP_TOKEN("UNSUBSCRIBE"),
+        /* RFC-5789 */
+        FIBIO_HTTP_TOKEN("PATCH"),
+        FIBIO_HTTP_TOKEN("PURGE"),
+    };
+
+    constexpr size_t method_count=sizeof(method_names)/sizeof(method_names[0]);
+
+    // Returns nullptr if method is unknown
+    inline const token *method_name(http_method m) {
+        size_t i=static_cast<size_t>(m);
+        return (i<method_count) ? &method_names[i] : nullptr;
+    }
+
+    // Returns nullptr if version is unknown
+    inline const token *version_name(http_version v) {
+        version_index_type i=version_index(v);
+        return (i==VERSION_INDEX_INVALID) ? nullptr : &version_names[i];
+    }
+
+    // Returns nullptr if either version or status code is unknown
+    inline const token *status_line(http_version v, http_status_code c) {
+        version_index_type vi=version_index(v);
+        status_index_type si=status_index(c);
+        if (vi==VERSION_INDEX_INVALID || si==STATUS_INDEX_INVALID) return nullptr;
+        return &status_lines[vi][si];
+    }
+
+    // Canonical names of well-known headers, indexed by header_id value
+    constexpr token header_names[header_id_count]={
+        FIBIO_HTTP_TOKEN(""),
+        FIBIO_HTTP_TOKEN("Accept"),
+        FIBIO_HTTP_TOKEN("Accept-Encoding"),
+        FIBIO_HTTP_TOKEN("Accept-Ranges"),
+        FIBIO_HTTP_TOKEN("Authorization"),
+        FIBIO_HTTP_TOKEN("Cache-Control"),
+        FIBIO_HTTP_TOKEN("Connection"),
+        FIBIO_HTTP_TOKEN("Content-Disposition"),
+        FIBIO_HTTP_TOKEN("Content-Encoding"),
+        FIBIO_HTTP_TOKEN("Content-Length"),
+        FIBIO_HTTP_TOKEN("Content-Range"),
+        FIBIO_HTTP_TOKEN("Content-Type"),
+        FIBIO_HTTP_TOKEN("Cookie"),
+        FIBIO_HTTP_TOKEN("Date"),
+        FIBIO_HTTP_TOKEN("ETag"),
+        FIBIO_HTTP_TOKEN("Expect"),
+        FIBIO_HTTP_TOKEN("Host"),
+        FIBIO_HTTP_TOKEN("If-Modified-Since"),
+        FIBIO_HTTP_TOKEN("If-None-Match"),
+        FIBIO_HTTP_TOKEN("If-Range"),
+        FIBIO_HTTP_TOKEN("Last-Modified"),
+        FIBIO_HTTP_TOKEN("Location"),
+        FIBIO_HTTP_TOKEN("Range"),
+        FIBIO_HTTP_TOKEN("Retry-After"),
+        FIBIO_HTTP_TOKEN("Set-Cookie"),
+        FIBIO_HTTP_TOKEN("Transfer-Encoding"),
+        FIBIO_HTTP_TOKEN("Upgrade"),
+        FIBIO_HTTP_TOKEN("User-Agent"),
+        FIBIO_HTTP_TOKEN("Vary"),
+    };
+
+    constexpr token crlf=FIBIO_HTTP_TOKEN("\r\n");
+    
+    // Pre-serialized header lines, emitted without touching header_map
+    constexpr token connection_keep_alive_line=FIBIO_HTTP_TOKEN("Connection: keep-alive\r\n");
+    constexpr token connection_close_line=FIBIO_HTTP_TOKEN("Connection: close\r\n");
+    constexpr token transfer_encoding_chunked_line=FIBIO_HTTP_TOKEN("Transfer-Encoding: chunked\r\n");
+    constexpr token default_content_type_line=FIBIO_HTTP_TOKEN("Content-Type: text/plain\r\n");
+    constexpr token continue_response=FIBIO_HTTP_TOKEN("HTTP/1.1 100 Continue\r\n\r\n");
+    constexpr token accept_ranges_bytes_line=FIBIO_HTTP_TOKEN("Accept-Ranges: bytes\r\n");
+    constexpr token content_length_prefix=FIBIO_HTTP_TOKEN("Content-Length: ");
+    constexpr token date_prefix=FIBIO_HTTP_TOKEN("Date: ");
+    
+    constexpr char digit_pairs[]=
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    
+    // Enough for any 64-bit unsigned integer
+    constexpr size_t max_decimal_size=20;
+    
+    /**
+     * Format v in decimal into the buffer ending at end, two digits at a time,
+     * returns the beginning of the formatted number
+     */
+    inline char *format_decimal(char *end, uint64_t v) {
+        char *p=end;
+        while (v>=100) {
+            const char *d=digit_pairs+(v%100)*2;
+            v/=100;
+            *--p=d[1];
+            *--p=d[0];
+        }
+        if (v>=10) {
+            const char *d=digit_pairs+v*2;
+            *--p=d[1];
+            *--p=d[0];
+        } else {
+            *--p=char('0'+v);
+        }
+        return p;
+    }
+    
+    inline void append_decimal(std::string &buf, uint64_t v) {
+        char tmp[max_decimal_size];
+        char *e=tmp+max_decimal_size;
+        char *b=format_decimal(e, v);
+        buf.append(b, e-b);
+    }
+    
+    // Content hash, not meant to resist crafted collisions
+    inline uint64_t fnv1a_64(const char *p, size_t n) {
+        uint64_t h=14695981039346656037ull;
+        for (size_t i=0; i<n; i++) {
+            h^=static_cast<uint8_t>(p[i]);
+            h*=1099511628211ull;
+        }
+        return h;
+    }
+    
+    // "Sun, 06 Nov 1994 08:49:37 GMT", RFC 1123 format, 29 bytes
+    inline size_t format_http_date(std::time_t t, char *buf) {
+        static constexpr char days[]="SunMonTueWedThuFriSat";
+        static constexpr char months[]="JanFebMarAprMayJunJulAugSepOctNovDec";
+        std::tm tm;
+        gmtime_r(&t, &tm);
+        char *p=buf;
+        auto two_digits=[&p](int v) {
+            *p++=char('0'+v/10);
+            *p++=char('0'+v%10);
+        };
+        std::memcpy(p, days+tm.tm_wday*3, 3);
+        p+=3;
+        *p++=',';
+        *p++=' ';
+        two_digits(tm.tm_mday);
+        *p++=' ';
+        std::memcpy(p, months+tm.tm_mon*3, 3);
+        p+=3;
+        *p++=' ';
+        two_digits((tm.tm_year+1900)/100);
+        two_digits((tm.tm_year+1900)%100);
+        *p++=' ';
+        two_digits(tm.tm_hour);
+        *p++=':';
+        two_digits(tm.tm_min);
+        *p++=':';
+        two_digits(tm.tm_sec);
+        std::memcpy(p, " GMT", 4);
+        p+=4;
+        return p-buf;
+    }
+    
+    // Parse RFC 1123 date, obsolete formats are not accepted
+    inline bool parse_http_date(const string_view &s, std::time_t &t) {
+        static constexpr char months[]="JanFebMarAprMayJunJulAugSepOctNovDec";
+        if (s.size()!=29 || s[3]!=',' || s.substr(25)!=" GMT") return false;
+        auto digits=[&s](size_t pos, size_t n, int &v) {
+            v=0;
+            for (size_t i=pos; i<pos+n; i++) {
+                if (s[i]<'0' || s[i]>'9') return false;
+                v=v*10+(s[i]-'0');
+            }
+            return true;
+        };
+        int day, year, hour, min, sec;
+        if (!digits(5, 2, day) || !digits(12, 4, year)
+            || !digits(17, 2, hour) || !digits(20, 2, min) || !digits(23, 2, sec))
+        {
+            return false;
+        }
+        const char *m=std::search(months, months+36, s.begin()+8, s.begin()+11);
+        if (m==months+36 || (m-months)%3!=0) return false;
+        int month=int(m-months)/3+1;
+        // Days since epoch of a proleptic Gregorian date
+        int y=year-(month<=2);
+        int era=(y>=0 ? y : y-399)/400;
+        int yoe=y-era*400;
+        int doy=(153*(month+(month>2 ? -3 : 9))+2)/5+day-1;
+        int doe=yoe*365+yoe/4-yoe/100+doy;
+        int64_t days=int64_t(era)*146097+doe-719468;
+        t=std::time_t(days*86400+hour*3600+min*60+sec);
+        return true;
+    }
+}}}}    // End of namespace fibio::http::common::detail
+
+#endif
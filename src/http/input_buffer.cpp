@@ -0,0 +1,195 @@
+//
+//  input_buffer.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/20.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <cstring>
+#include <algorithm>
+#include <fibio/http/common/input_buffer.hpp>
+
+namespace fibio { namespace http { namespace common {
+    buffer_pool::buffer_pool(size_t block_size, size_t max_free)
+    : block_size_(block_size)
+    , max_free_(max_free)
+    {}
+
+    std::unique_ptr<char[]> buffer_pool::acquire() {
+        {
+            std::lock_guard<mutex> lock(mtx_);
+            if (!free_.empty()) {
+                std::unique_ptr<char[]> b(std::move(free_.back()));
+                free_.pop_back();
+                return b;
+            }
+        }
+        return std::unique_ptr<char[]>(new char[block_size_]);
+    }
+
+    void buffer_pool::release(std::unique_ptr<char[]> b) {
+        std::lock_guard<mutex> lock(mtx_);
+        if (free_.size()<max_free_) free_.push_back(std::move(b));
+    }
+
+    input_buffer::input_buffer(std::streambuf *source, size_t initial_size, size_t max_size, buffer_pool *pool)
+    : source_(source)
+    , pool_(pool && pool->block_size()==initial_size ? pool : nullptr)
+    , buffer_(pool_ ? pool_->acquire() : std::unique_ptr<char[]>(new char[initial_size]))
+    , initial_size_(initial_size)
+    , capacity_(initial_size)
+    , max_size_(std::max(initial_size, max_size))
+    {
+        setg(buffer_.get(), buffer_.get(), buffer_.get());
+    }
+
+    input_buffer::~input_buffer() {
+        release_buffer();
+    }
+
+    void input_buffer::consume(size_t n) {
+        n=std::min(n, size());
+        setg(eback(), gptr()+n, egptr());
+    }
+
+    size_t input_buffer::fill() {
+        if (egptr()==eback()+capacity_) {
+            // No room at the end, move unconsumed data forward or grow the buffer
+            if (size_t(gptr()-eback())>pinned_) {
+                compact();
+            } else if (capacity_<max_size_) {
+                grow(std::min(capacity_*2, max_size_));
+            } else {
+                return 0;
+            }
+        }
+        std::streamsize n=read_some(egptr(), eback()+capacity_-egptr());
+        if (n<=0) return 0;
+        setg(eback(), gptr(), egptr()+n);
+        return n;
+    }
+
+    bool input_buffer::full() const {
+        return (egptr()==eback()+capacity_)
+            && (size_t(gptr()-eback())<=pinned_)
+            && (capacity_>=max_size_);
+    }
+
+    void input_buffer::pin() {
+        pinned_=gptr()-eback();
+    }
+
+    void input_buffer::unpin() {
+        pinned_=0;
+        compact();
+    }
+
+    bool input_buffer::unread() {
+        std::streamsize n=size();
+        if (n==0) return true;
+        if (source_->pubseekoff(-n, std::ios_base::cur, std::ios_base::in)==std::streambuf::pos_type(std::streambuf::off_type(-1))) {
+            return false;
+        }
+        setg(eback(), egptr(), egptr());
+        return true;
+    }
+
+    bool input_buffer::park() {
+        if (parked()) return true;
+        if (size()>0) return false;
+        release_buffer();
+        capacity_=0;
+        pinned_=0;
+        setg(nullptr, nullptr, nullptr);
+        return true;
+    }
+
+    void input_buffer::unpark() {
+        if (!parked()) return;
+        buffer_=pool_ ? pool_->acquire() : std::unique_ptr<char[]>(new char[initial_size_]);
+        capacity_=initial_size_;
+        setg(buffer_.get(), buffer_.get(), buffer_.get());
+    }
+
+    input_buffer::int_type input_buffer::underflow() {
+        if (gptr()<egptr()) return traits_type::to_int_type(*gptr());
+        // Everything has been consumed, reuse the space after pinned header block
+        char *p=eback()+pinned_;
+        setg(eback(), p, p);
+        if (pinned_==capacity_) {
+            // Header block takes whole buffer, make some room for the body
+            grow(capacity_*2);
+        }
+        std::streamsize n=read_some(egptr(), eback()+capacity_-egptr());
+        if (n<=0) return traits_type::eof();
+        setg(eback(), gptr(), egptr()+n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize input_buffer::xsgetn(char_type *s, std::streamsize n) {
+        std::streamsize ret=std::min<std::streamsize>(n, size());
+        std::memcpy(s, gptr(), ret);
+        consume(ret);
+        if (ret==n) return ret;
+        if (size_t(n-ret)>=capacity_/2) {
+            // Large read, bypass the buffer and read from the source directly
+            return ret+source_->sgetn(s+ret, n-ret);
+        }
+        while (ret<n) {
+            if (traits_type::eq_int_type(underflow(), traits_type::eof())) break;
+            std::streamsize c=std::min<std::streamsize>(n-ret, size());
+            std::memcpy(s+ret, gptr(), c);
+            consume(c);
+            ret+=c;
+        }
+        return ret;
+    }
+
+    std::streamsize input_buffer::showmanyc() {
+        // Called only if the buffer is empty
+        return source_->in_avail();
+    }
+
+    std::streamsize input_buffer::read_some(char *p, std::streamsize n) {
+        std::streamsize avail=source_->in_avail();
+        if (avail<0) {
+            // Source reaches EOF
+            return 0;
+        } else if (avail==0) {
+            // Nothing buffered in the source, wait for more data
+            if (traits_type::eq_int_type(source_->sgetc(), traits_type::eof())) return 0;
+            avail=std::max<std::streamsize>(source_->in_avail(), 1);
+        }
+        return source_->sgetn(p, std::min(avail, n));
+    }
+
+    void input_buffer::compact() {
+        size_t n=size();
+        char *dst=eback()+pinned_;
+        if (dst==gptr()) return;
+        std::memmove(dst, gptr(), n);
+        setg(eback(), dst, dst+n);
+    }
+
+    void input_buffer::release_buffer() {
+        // Grown buffers are not pooled
+        if (pool_ && buffer_ && capacity_==initial_size_) {
+            pool_->release(std::move(buffer_));
+        }
+        buffer_.reset();
+    }
+
+    void input_buffer::grow(size_t new_capacity) {
+        if (new_capacity<=capacity_) return;
+        std::unique_ptr<char[]> b(new char[new_capacity]);
+        // Keep offsets unchanged, pinned bytes are moved as well
+        size_t g=gptr()-eback();
+        size_t e=egptr()-eback();
+        std::memcpy(b.get(), eback(), e);
+        buffer_.swap(b);
+        if (pool_ && capacity_==initial_size_) pool_->release(std::move(b));
+        capacity_=new_capacity;
+        setg(buffer_.get(), buffer_.get()+g, buffer_.get()+e);
+    }
+}}} // End of namespace fibio::http::common
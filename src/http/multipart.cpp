@@ -0,0 +1,403 @@
+//
+//  multipart.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/11/02.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/algorithm/string/predicate.hpp>
+#include <fibio/http/server/multipart.hpp>
+
+namespace fibio { namespace http {
+    namespace detail {
+        constexpr size_t MAX_BOUNDARY_LENGTH=70;
+
+        inline bool is_ows(char c) {
+            return c==' ' || c=='\t';
+        }
+
+        /**
+         * Get a parameter from a header value like `form-data; name="a"; filename="b"`,
+         * quoted values are unescaped
+         */
+        bool header_param(const string_view &value, const char *name, std::string &out) {
+            const char *p=std::find(value.begin(), value.end(), ';');
+            const char *e=value.end();
+            while (p<e) {
+                // Skip ';' and spaces
+                p++;
+                while (p<e && is_ows(*p)) p++;
+                const char *n=p;
+                while (p<e && *p!='=' && *p!=';' && !is_ows(*p)) p++;
+                string_view param(n, p-n);
+                while (p<e && is_ows(*p)) p++;
+                if (p==e || *p!='=') continue;
+                p++;
+                while (p<e && is_ows(*p)) p++;
+                std::string v;
+                if (p<e && *p=='"') {
+                    for (p++; p<e && *p!='"'; p++) {
+                        if (*p=='\\' && p+1<e) p++;
+                        v.push_back(*p);
+                    }
+                    // Closing quote
+                    if (p==e) return false;
+                    p=std::find(p, e, ';');
+                } else {
+                    const char *b=p;
+                    p=std::find(p, e, ';');
+                    const char *ve=p;
+                    while (ve>b && is_ows(ve[-1])) ve--;
+                    v.assign(b, ve);
+                }
+                if (boost::algorithm::iequals(param, name)) {
+                    out.swap(v);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline bool write_all(int fd, const char *p, size_t n) {
+            while (n>0) {
+                ssize_t r=::write(fd, p, n);
+                if (r<0 && errno==EINTR) continue;
+                if (r<=0) return false;
+                p+=r;
+                n-=r;
+            }
+            return true;
+        }
+
+        struct free_deleter {
+            void operator()(char *p) const { std::free(p); }
+        };
+    }   // End of namespace detail
+
+    bool multipart_boundary(const string_view &content_type, std::string &boundary) {
+        if (!boost::algorithm::istarts_with(content_type, "multipart/")) return false;
+        if (!detail::header_param(content_type, "boundary", boundary)) return false;
+        return !boundary.empty() && boundary.size()<=detail::MAX_BOUNDARY_LENGTH;
+    }
+
+    void multipart_reader::part::clear() {
+        headers.clear();
+        name.clear();
+        filename.clear();
+        has_filename=false;
+        content_type.clear();
+    }
+
+    /**
+     * Unconsumed data is buffer_[begin_, end_), get area is always at begin_ and
+     * ends before the next delimiter, or before a tail that may be the beginning
+     * of one
+     */
+    struct multipart_reader::impl : std::streambuf {
+        enum class state {
+            part,
+            // begin_ is at a delimiter
+            boundary,
+            done,
+            error,
+        };
+
+        impl(std::istream &body, const std::string &boundary, size_t buffer_size)
+        : source_(body)
+        , delimiter_("\r\n--"+boundary)
+        // Room for a part header and the delimiters around it
+        , capacity_(std::max(buffer_size, MAX_MULTIPART_HEADER_SIZE+4*delimiter_.size()))
+        , buffer_(new char[capacity_])
+        {
+            size_t n=delimiter_.size();
+            for (size_t i=0; i<256; i++) skip_[i]=n;
+            for (size_t i=0; i+1<n; i++) skip_[static_cast<unsigned char>(delimiter_[i])]=n-1-i;
+            // First delimiter may come without leading CRLF, anything before it is preamble
+            buffer_[0]='\r';
+            buffer_[1]='\n';
+            end_=2;
+        }
+
+        // Get area has been read
+        void release_window() {
+            if (eback()) begin_=gptr()-buffer_.get();
+            setg(nullptr, nullptr, nullptr);
+        }
+
+        // Move unconsumed data to the beginning and read more, false on EOF
+        bool fill() {
+            if (begin_>0) {
+                std::memmove(buffer_.get(), buffer_.get()+begin_, end_-begin_);
+                end_-=begin_;
+                scanned_=(scanned_>begin_) ? scanned_-begin_ : 0;
+                begin_=0;
+            }
+            if (end_==capacity_) return false;
+            source_.read(buffer_.get()+end_, capacity_-end_);
+            std::streamsize n=source_.gcount();
+            if (n<=0) return false;
+            end_+=n;
+            return true;
+        }
+
+        // Make sure n bytes are buffered
+        bool ensure(size_t n) {
+            while (end_-begin_<n) {
+                if (!fill()) return false;
+            }
+            return true;
+        }
+
+        /**
+         * Boyer-Moore-Horspool search for the delimiter, returns its position or
+         * end_, positions known not to start a delimiter are not searched again
+         */
+        size_t find() {
+            const char *b=buffer_.get();
+            const char *d=delimiter_.data();
+            size_t n=delimiter_.size();
+            size_t i=std::max(begin_, scanned_);
+            while (i+n<=end_) {
+                size_t j=n-1;
+                while (b[i+j]==d[j]) {
+                    if (j==0) {
+                        scanned_=i;
+                        return i;
+                    }
+                    j--;
+                }
+                i+=skip_[static_cast<unsigned char>(b[i+n-1])];
+            }
+            scanned_=i;
+            return end_;
+        }
+
+        virtual int_type underflow() override {
+            release_window();
+            if (state_!=state::part) return traits_type::eof();
+            while (true) {
+                size_t p=find();
+                if (p!=end_) {
+                    if (p==begin_) {
+                        state_=state::boundary;
+                        return traits_type::eof();
+                    }
+                } else {
+                    // Tail may be the beginning of a delimiter
+                    size_t keep=delimiter_.size()-1;
+                    p=(end_-begin_>keep) ? end_-keep : begin_;
+                }
+                if (p>begin_) {
+                    char *g=buffer_.get();
+                    setg(g+begin_, g+begin_, g+p);
+                    return traits_type::to_int_type(*gptr());
+                }
+                if (!fill()) {
+                    // Body ends in the middle of a part
+                    state_=state::error;
+                    return traits_type::eof();
+                }
+            }
+        }
+
+        virtual std::streamsize showmanyc() override {
+            return (state_==state::part) ? 0 : -1;
+        }
+
+        // Find next CRLF, line is [begin_, eol)
+        bool read_line(size_t &eol) {
+            while (true) {
+                const char *b=buffer_.get()+begin_;
+                const char *e=buffer_.get()+end_;
+                static constexpr char crlf[]="\r\n";
+                const char *p=std::search(b, e, crlf, crlf+2);
+                if (p!=e) {
+                    eol=p-buffer_.get();
+                    return true;
+                }
+                if (end_-begin_>MAX_MULTIPART_HEADER_SIZE || !fill()) return false;
+            }
+        }
+
+        bool next(part &p) {
+            p.clear();
+            // Skip the rest of current part
+            while (underflow()!=traits_type::eof()) {
+                setg(egptr(), egptr(), egptr());
+            }
+            release_window();
+            if (state_!=state::boundary) return false;
+            if (!ensure(delimiter_.size()+2)) return fail();
+            begin_+=delimiter_.size();
+            if (buffer_[begin_]=='-' && buffer_[begin_+1]=='-') {
+                // Close delimiter, epilogue is ignored
+                state_=state::done;
+                return false;
+            }
+            // Transport padding before CRLF
+            size_t eol;
+            if (!read_line(eol)) return fail();
+            for (size_t i=begin_; i<eol; i++) {
+                if (!detail::is_ows(buffer_[i])) return fail();
+            }
+            begin_=eol+2;
+            size_t header_size=0;
+            while (true) {
+                if (!read_line(eol)) return fail();
+                header_size+=eol-begin_+2;
+                if (header_size>MAX_MULTIPART_HEADER_SIZE) return fail();
+                if (eol==begin_) {
+                    begin_+=2;
+                    break;
+                }
+                const char *b=buffer_.get()+begin_;
+                const char *e=buffer_.get()+eol;
+                const char *colon=std::find(b, e, ':');
+                if (colon==b || colon==e) return fail();
+                const char *v=colon+1;
+                while (v<e && detail::is_ows(*v)) v++;
+                const char *ve=e;
+                while (ve>v && detail::is_ows(ve[-1])) ve--;
+                p.headers.emplace(string_view(b, colon-b), string_view(v, ve-v));
+                begin_=eol+2;
+            }
+            auto i=p.headers.find(common::header_id::CONTENT_DISPOSITION);
+            if (i!=p.headers.end()) {
+                detail::header_param(i->second, "name", p.name);
+                p.has_filename=detail::header_param(i->second, "filename", p.filename);
+            }
+            i=p.headers.find(common::header_id::CONTENT_TYPE);
+            if (i!=p.headers.end()) p.content_type=to_string(i->second);
+            state_=state::part;
+            scanned_=begin_;
+            return true;
+        }
+
+        bool fail() {
+            state_=state::error;
+            return false;
+        }
+
+        std::istream &source_;
+        std::string delimiter_;
+        size_t capacity_;
+        std::unique_ptr<char[]> buffer_;
+        size_t begin_=0;
+        size_t end_=0;
+        // Delimiter doesn't start before this position
+        size_t scanned_=0;
+        size_t skip_[256];
+        // Preamble is read as a part
+        state state_=state::part;
+    };
+
+    multipart_reader::multipart_reader(std::istream &body,
+                                       const std::string &boundary,
+                                       size_t buffer_size)
+    : impl_(new impl(body, boundary, buffer_size))
+    , stream_(impl_.get())
+    {}
+
+    multipart_reader::~multipart_reader()=default;
+
+    bool multipart_reader::next(part &p) {
+        stream_.clear();
+        return impl_->next(p);
+    }
+
+    bool multipart_reader::failed() const {
+        return impl_->state_==impl::state::error;
+    }
+
+    bool spool_to_file(std::istream &is,
+                       const std::string &dir,
+                       std::string &path,
+                       uint64_t &size,
+                       size_t buffer_size)
+    {
+        std::string tmpl(dir);
+        if (tmpl.empty() || tmpl.back()!='/') tmpl.push_back('/');
+        tmpl.append("fibio-upload-XXXXXX");
+        int fd=::mkstemp(&tmpl[0]);
+        if (fd<0) return false;
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        // Whole pages from a page aligned buffer, so file offsets stay aligned too
+        size_t page=size_t(::sysconf(_SC_PAGESIZE));
+        size_t n=(std::max(buffer_size, page)+page-1)/page*page;
+        void *mem=nullptr;
+        if (::posix_memalign(&mem, page, n)!=0) {
+            ::close(fd);
+            ::unlink(tmpl.c_str());
+            return false;
+        }
+        std::unique_ptr<char, detail::free_deleter> buf(static_cast<char *>(mem));
+        size=0;
+        bool ok=true;
+        while (ok && is) {
+            // Fills the buffer unless the stream ends
+            is.read(buf.get(), n);
+            std::streamsize r=is.gcount();
+            if (r<=0) break;
+            ok=detail::write_all(fd, buf.get(), r);
+            size+=r;
+        }
+        ok=ok && !is.bad();
+        if (::close(fd)!=0) ok=false;
+        if (!ok) {
+            ::unlink(tmpl.c_str());
+            return false;
+        }
+        path.swap(tmpl);
+        return true;
+    }
+
+    form_data::~form_data() {
+        for (auto &f : files) {
+            if (!f.path.empty()) ::unlink(f.path.c_str());
+        }
+    }
+
+    bool read_form_data(server::request &req,
+                        form_data &form,
+                        const std::string &tmp_dir,
+                        size_t max_field_size)
+    {
+        auto i=req.header_views.find(common::header_id::CONTENT_TYPE);
+        std::string boundary;
+        if (i==req.header_views.end()
+            || !boost::algorithm::istarts_with(i->second, "multipart/form-data")
+            || !multipart_boundary(i->second, boundary)
+            || !req.has_body())
+        {
+            return false;
+        }
+        multipart_reader reader(req.body_stream(), boundary);
+        multipart_reader::part p;
+        while (reader.next(p)) {
+            std::istream &s=reader.stream();
+            if (p.has_filename) {
+                form_data::file f;
+                if (!spool_to_file(s, tmp_dir, f.path, f.size)) return false;
+                f.name.swap(p.name);
+                f.filename.swap(p.filename);
+                f.content_type.swap(p.content_type);
+                form.files.push_back(std::move(f));
+            } else {
+                std::string v;
+                char buf[4096];
+                while (s.read(buf, sizeof(buf)), s.gcount()>0) {
+                    if (v.size()+s.gcount()>max_field_size) return false;
+                    v.append(buf, s.gcount());
+                }
+                form.fields.insert(std::make_pair(p.name, std::move(v)));
+            }
+        }
+        return !reader.failed();
+    }
+}}  // End of namespace fibio::http
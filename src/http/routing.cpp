@@ -7,6 +7,7 @@
 //
 
 #include <fibio/http/server/routing.hpp>
+#include <fibio/http/common/content_type.hpp>
 #include "url_parser.hpp"
 
 namespace fibio { namespace http {
@@ -51,7 +52,7 @@ namespace fibio { namespace http {
                             server::response &resp,
                             server::connection &conn)
             {
-                parse_url(req.url, req.parsed_url);
+                parse_url(req.url_view, req.parsed_url);
                 for(auto &e : routing_table_) {
                     if(e.first(req)) {
                         return e.second(req, resp, conn);
@@ -67,6 +68,67 @@ namespace fibio { namespace http {
         return handler{table, default_handler};
     }
 
+    server::request_handler_type with_limits(const request_limits &limits,
+                                             server::request_handler_type handler)
+    {
+        return [limits, handler](server::request &req,
+                                 server::response &resp,
+                                 server::connection &conn)->bool
+        {
+            http_status_code c=limits.check(req);
+            if (c!=http_status_code::OK) {
+                resp.keep_alive=false;
+                return stock_handler{c}(req, resp, conn);
+            }
+            req.limit_body(limits.max_body_size);
+            return handler(req, resp, conn);
+        };
+    }
+
+    bool file_handler::operator()(server::request &req,
+                                  server::response &resp,
+                                  server::connection &) const
+    {
+        std::string path;
+        resp.status_code=map_path(req, path);
+        if (resp.status_code!=http_status_code::OK) return true;
+        if (!resp.set_file_body(path)) {
+            resp.status_code=http_status_code::NOT_FOUND;
+            return true;
+        }
+        resp.set_content_type(common::content_type_by_extension(path));
+        return true;
+    }
+    
+    http_status_code file_handler::map_path(server::request &req, std::string &path) const {
+        // HEAD is answered like GET, the server leaves the body out
+        if (req.method!=http_method::GET && req.method!=http_method::HEAD) return http_status_code::METHOD_NOT_ALLOWED;
+        parse_url(req.url_view, req.parsed_url, false, false);
+        // Components are decoded and normalized, a path going out of root fails
+        std::list<std::string> components, prefix_components;
+        if (!common::parse_path_components(req.parsed_url.path, components)
+            || !common::parse_path_components(prefix, prefix_components))
+        {
+            return http_status_code::FORBIDDEN;
+        }
+        for (auto &p : prefix_components) {
+            if (components.empty() || components.front()!=p) return http_status_code::NOT_FOUND;
+            components.pop_front();
+        }
+        path=root;
+        for (auto &c : components) {
+            // Encoded separators and NULs are not allowed in file names
+            if (c.find_first_of(std::string("/\0", 2))!=std::string::npos) return http_status_code::FORBIDDEN;
+            if (path.empty() || path.back()!='/') path.push_back('/');
+            path.append(c);
+        }
+        if (components.empty() || req.parsed_url.path.back()=='/') {
+            if (path.empty() || path.back()!='/') path.push_back('/');
+            path.append("index.html");
+        }
+        return http_status_code::OK;
+    }
+    
     server::request_handler_type subroute(const routing_table_type &table,
                                           server::request_handler_type default_handler)
     {
@@ -75,7 +137,7 @@ namespace fibio { namespace http {
                             server::response &resp,
                             server::connection &conn)
             {
-                parse_url(req.url, req.parsed_url);
+                parse_url(req.url_view, req.parsed_url);
                 for(auto &e : routing_table_) {
                     if(e.first(req)) {
                         return e.second(req, resp, conn);
@@ -129,8 +191,9 @@ namespace fibio { namespace http {
             typedef components_type::const_iterator component_iterator;
             
             bool operator()(server::request &req) {
-                std::map<std::string, std::string> m;
-                parse_url(req.url, req.parsed_url);
+                // Parameters are allocated from the request arena
+                server::request::params_type m(req.params.get_allocator());
+                parse_url(req.url_view, req.parsed_url);
                 component_iterator p=pattern.cbegin();
                 for (auto &i : req.parsed_url.path_components) {
                     if (i.empty()) {
@@ -142,17 +205,19 @@ namespace fibio { namespace http {
                         return false;
                     } else if ((*p)[0]==':') {
                         // This pattern component is a parameter
-                        m.insert({std::string(p->begin()+1, p->end()), i});
+                        m.emplace(std::piecewise_construct,
+                                  std::forward_as_tuple(p->begin()+1, p->end()),
+                                  std::forward_as_tuple(i));
                     } else if ((*p)[0]=='*') {
                         if (p->length()==1) {
                             // Ignore anything remains if the wildcard doesn't have a name
                             return true;
                         }
-                        std::string param_name(p->begin()+1, p->end());
+                        common::arena_string param_name(p->begin()+1, p->end(), m.get_allocator());
                         auto mi=m.find(param_name);
                         if (mi==m.end()) {
                             // Not found
-                            m.insert({param_name, i});
+                            m.emplace(param_name, i);
                         } else {
                             // Concat this component to existing parameter
                             mi->second.push_back('/');
@@ -193,4 +258,8 @@ namespace fibio { namespace http {
     match_type PUT(const std::string &pattern) {
         return method_is(http_method::PUT) && path_matches(pattern);
     }
+    
+    match_type HEAD(const std::string &pattern) {
+        return method_is(http_method::HEAD) && path_matches(pattern);
+    }
 }}  // End of namespace fibio::http
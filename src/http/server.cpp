@@ -6,19 +6,184 @@
 //  Copyright (c) 2014 0d0a.com. All rights reserved.
 //
 
-#include <boost/asio/basic_waitable_timer.hpp>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+#include <atomic>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#   include <sys/sendfile.h>
+#endif
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/iostreams/restrict.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <fibio/future.hpp>
 #include <fibio/http/server/server.hpp>
+#include "http_tokens.hpp"
+#include "timing_wheel.hpp"
+#include "codel.hpp"
+#include "byte_range.hpp"
+#include "compression.hpp"
 
 namespace fibio { namespace http {
     namespace detail {
         typedef fibio::http::server_request request;
         typedef fibio::http::server_response response;
-        typedef boost::asio::basic_waitable_timer<std::chrono::steady_clock> watchdog_timer_t;
+        
+        struct cached_date_line {
+            std::time_t time;
+            size_t size;
+            char data[64];
+        };
+        
+        /**
+         * Complete "Date: ...\r\n" line, cached per thread and re-formatted only when
+         * the second changes
+         */
+        inline common::detail::token date_line() {
+            namespace tokens=common::detail;
+            static thread_local cached_date_line cache;
+            std::time_t now=std::time(nullptr);
+            if (cache.size==0 || cache.time!=now) {
+                char *p=cache.data;
+                std::memcpy(p, tokens::date_prefix.data, tokens::date_prefix.size);
+                p+=tokens::date_prefix.size;
+                p+=tokens::format_http_date(now, p);
+                std::memcpy(p, tokens::crlf.data, tokens::crlf.size);
+                p+=tokens::crlf.size;
+                cache.size=p-cache.data;
+                cache.time=now;
+            }
+            return {cache.data, cache.size};
+        }
+        
+        /**
+         * Fails the stream once more than limit bytes are read through it, keeps
+         * a decompressor from expanding a small body without bound
+         */
+        struct size_limit_filter : boost::iostreams::multichar_input_filter {
+            size_limit_filter(size_t limit, bool *exceeded)
+            : limit_(limit)
+            , exceeded_(exceeded)
+            {}
+            
+            template<typename Source>
+            std::streamsize read(Source &src, char *s, std::streamsize n) {
+                std::streamsize r=boost::iostreams::read(src, s, n);
+                if (r>0) {
+                    total_+=r;
+                    if (total_>limit_) {
+                        *exceeded_=true;
+                        throw std::ios_base::failure("Decompressed body is too large");
+                    }
+                }
+                return r;
+            }
+            
+            size_t limit_;
+            size_t total_=0;
+            bool *exceeded_;
+        };
+        
+        // Copy part of a file into an ostream
+        inline bool write_file_range(std::ostream &os, int fd, uint64_t offset, uint64_t length) {
+            char buf[8192];
+            while (length>0 && os) {
+                ssize_t n=::pread(fd, buf, std::min<uint64_t>(sizeof(buf), length), offset);
+                if (n<0 && errno==EINTR) continue;
+                if (n<=0) return false;
+                os.write(buf, n);
+                offset+=n;
+                length-=n;
+            }
+            return true;
+        }
+        
+        // Random multipart boundary, not expected to appear in the body
+        inline std::string make_boundary() {
+            static thread_local std::mt19937_64 rng{std::random_device()()};
+            std::string b("fibio-");
+            uint64_t v=rng();
+            for (int i=0; i<16; i++, v>>=4) b.push_back("0123456789abcdef"[v & 0xF]);
+            return b;
+        }
+        
+        inline void append_content_range(std::string &buf, uint64_t first, uint64_t length, uint64_t size) {
+            namespace tokens=common::detail;
+            buf.append("bytes ");
+            tokens::append_decimal(buf, first);
+            buf.push_back('-');
+            tokens::append_decimal(buf, first+length-1);
+            buf.push_back('/');
+            tokens::append_decimal(buf, size);
+        }
+        
+        // 1xx, 204 and 304 never carry a body
+        inline bool status_has_body(http_status_code c) {
+            return uint16_t(c)>=200 && c!=http_status_code::NO_CONTENT && c!=http_status_code::NOT_MODIFIED;
+        }
+        
+        // HEAD gets the headers of the body it would have had, but not the body
+        inline bool sends_body(const server_response &resp) {
+            return !resp.head_ && status_has_body(resp.status_code);
+        }
+        
+        // Header lines a 304 keeps from the block of the response it stands for
+        inline void append_validator_lines(std::string &buf, const string_view &block) {
+            static constexpr const char *names[]={
+                "ETag:",
+                "Last-Modified:",
+                "Vary:",
+                "Cache-Control:",
+                "Expires:",
+                "Content-Location:",
+            };
+            const char *p=block.begin();
+            const char *end=block.end();
+            while (p<end) {
+                const char *eol=std::min(std::find(p, end, '\r')+2, end);
+                for (auto n : names) {
+                    if (boost::algorithm::istarts_with(string_view(p, eol-p), n)) {
+                        buf.append(p, eol);
+                        break;
+                    }
+                }
+                p=eol;
+            }
+        }
+        
+        // Max bytes per sendfile(2) call, so other fibers get a chance to run
+        constexpr size_t MAX_SENDFILE_SIZE=1<<20;
+        constexpr size_t FILE_BUFFER_SIZE=65536;
+        
+        typedef boost::asio::ip::tcp::acceptor listening_socket;
+        
+        // Open a listening socket with SO_REUSEPORT, so several of them can share one address
+        inline std::unique_ptr<listening_socket> open_reuse_port_listener(const std::string &addr, unsigned short port) {
+#ifdef SO_REUSEPORT
+            typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+            boost::asio::ip::tcp::endpoint ep(boost::asio::ip::address::from_string(addr), port);
+            std::unique_ptr<listening_socket> l(new listening_socket(asio::get_io_service()));
+            l->open(ep.protocol());
+            l->set_option(listening_socket::reuse_address(true));
+#ifdef SO_REUSEPORT
+            l->set_option(reuse_port(true));
+#endif
+            l->bind(ep);
+            l->listen();
+            return l;
+        }
         
         template<typename Stream>
         struct stream_traits {};
@@ -33,6 +198,45 @@ namespace fibio { namespace http {
             static stream_type *construct(arg_type) {
                 return new stream_type;
             }
+            static constexpr bool can_park=true;
+#ifdef __linux__
+            static constexpr bool can_sendfile=true;
+#else
+            static constexpr bool can_sendfile=false;
+#endif
+            // Send up to n bytes of the file from offset, yields while the socket is full
+            static size_t send_file(stream_type &s, int fd, uint64_t offset, size_t n, boost::system::error_code &ec) {
+#ifdef __linux__
+                auto &sock=s.stream_descriptor();
+                sock.native_non_blocking(true, ec);
+                while (!ec) {
+                    off_t off=offset;
+                    ssize_t r=::sendfile(sock.native_handle(), fd, &off, n);
+                    if (r>=0) return r;
+                    if (errno==EAGAIN) {
+                        sock.async_write_some(boost::asio::null_buffers(), asio::yield[ec]);
+                    } else if (errno!=EINTR) {
+                        ec.assign(errno, boost::system::system_category());
+                    }
+                }
+#else
+                ec=boost::asio::error::operation_not_supported;
+#endif
+                return 0;
+            }
+            static bool wait_readable(stream_type &s) {
+                boost::system::error_code ec;
+                s.stream_descriptor().async_read_some(boost::asio::null_buffers(), asio::yield[ec]);
+                return !ec;
+            }
+            static int native_handle(stream_type &s) {
+                return s.stream_descriptor().native_handle();
+            }
+            static boost::system::error_code accept(listening_socket &l, stream_type &s) {
+                boost::system::error_code ec;
+                l.async_accept(s.stream_descriptor(), asio::yield[ec]);
+                return ec;
+            }
         };
         
         template<>
@@ -45,6 +249,110 @@ namespace fibio { namespace http {
             static stream_type *construct(arg_type arg) {
                 return new stream_type(*arg);
             }
+            // Decrypted data may be pending in the SSL layer, socket readiness doesn't tell
+            static constexpr bool can_park=false;
+            // Data must be encrypted in user space
+            static constexpr bool can_sendfile=false;
+            static size_t send_file(stream_type &, int, uint64_t, size_t, boost::system::error_code &ec) {
+                ec=boost::asio::error::operation_not_supported;
+                return 0;
+            }
+            static bool wait_readable(stream_type &) { return true; }
+            static int native_handle(stream_type &s) {
+                return s.stream_descriptor().lowest_layer().native_handle();
+            }
+            static boost::system::error_code accept(listening_socket &l, stream_type &s) {
+                boost::system::error_code ec;
+                l.async_accept(s.stream_descriptor().lowest_layer(), asio::yield[ec]);
+                if (ec) return ec;
+                s.stream_descriptor().async_handshake(boost::asio::ssl::stream_base::server, asio::yield[ec]);
+                return ec;
+            }
+        };
+        
+        /**
+         * Serialized responses waiting to be sent
+         *
+         * Header blocks and bodies are moved in and sent with one gather write,
+         * storage is kept for next batch
+         */
+        struct output_batch {
+            bool empty() const { return used_==0; }
+            
+            bool append(response &resp) {
+                std::string &header_block=next_block();
+                std::string &body=next_block();
+                if (!resp.serialize(header_block, body)) return false;
+                if (resp.static_owner_ && !resp.static_body_.empty() && sends_body(resp)) {
+                    // Sent in place of the empty body block, owner is held until written
+                    statics_.emplace_back(used_-1, boost::asio::buffer(resp.static_body_.data(), resp.static_body_.size()));
+                    owners_.push_back(resp.static_owner_);
+                }
+                return true;
+            }
+            
+            template<typename AsyncWriteStream>
+            boost::system::error_code write(AsyncWriteStream &s) {
+                // Build buffer list here, blocks may have been moved while growing
+                buffers_.clear();
+                auto st=statics_.begin();
+                for (size_t i=0; i<used_; i++) {
+                    if (st!=statics_.end() && st->first==i) {
+                        buffers_.push_back(st->second);
+                        ++st;
+                    } else if (!blocks_[i].empty()) {
+                        buffers_.push_back(boost::asio::buffer(blocks_[i]));
+                    }
+                }
+                boost::system::error_code ec;
+                if (!buffers_.empty()) {
+                    boost::asio::async_write(s, buffers_, asio::yield[ec]);
+                }
+                clear();
+                return ec;
+            }
+            
+            void clear() {
+                for (size_t i=0; i<used_; i++) {
+                    blocks_[i].clear();
+                }
+                used_=0;
+                statics_.clear();
+                owners_.clear();
+            }
+            
+            // Response without body, status line and rest of headers are pre-serialized
+            void append(const common::detail::token &status_line, const std::string &headers, bool keep_alive) {
+                namespace tokens=common::detail;
+                std::string &b=next_block();
+                b.assign(status_line.data, status_line.size);
+                b.append(headers);
+                tokens::token d=date_line();
+                b.append(d.data, d.size);
+                const tokens::token &c=keep_alive ? tokens::connection_keep_alive_line : tokens::connection_close_line;
+                b.append(c.data, c.size);
+                b.append(tokens::crlf.data, tokens::crlf.size);
+            }
+            
+            // Release blocks grown beyond limit
+            void shrink(size_t limit) {
+                for (auto &b : blocks_) {
+                    if (b.capacity()>limit) std::string().swap(b);
+                }
+            }
+            
+        private:
+            std::string &next_block() {
+                if (used_==blocks_.size()) blocks_.emplace_back();
+                return blocks_[used_++];
+            }
+            
+            std::vector<std::string> blocks_;
+            size_t used_=0;
+            std::vector<boost::asio::const_buffer> buffers_;
+            // Bodies not owned by the batch, with index of the block they replace
+            std::vector<std::pair<size_t, boost::asio::const_buffer>> statics_;
+            std::vector<std::shared_ptr<const void>> owners_;
         };
         
         template<typename Stream>
@@ -52,15 +360,41 @@ namespace fibio { namespace http {
             typedef stream_traits<Stream> traits_type;
             typedef typename traits_type::stream_type stream_type;
             typedef typename traits_type::arg_type arg_type;
+            
+            /**
+             * Expires in the ticker fiber, which may run on another thread than the
+             * servant, so the stream is not touched here
+             *
+             * Shutting down the socket wakes up pending reads and writes with EOF or
+             * an error, the servant then closes the stream on its own thread. The
+             * socket is closed only after the timer is cancelled, so the fd can't be
+             * reused while the wheel still refers to it
+             */
+            struct stream_timer : timing_wheel::entry {
+                stream_timer(int fd) : fd_(fd) {}
+                virtual void expire() override {
+                    expired_=true;
+                    ::shutdown(fd_, SHUT_RDWR);
+                }
+                bool expired() const { return expired_; }
+                int fd_;
+                std::atomic<bool> expired_{false};
+            };
 
             connection(const std::string &host,
                        timeout_type read_timeout,
                        timeout_type write_timeout,
+                       size_t read_buffer_size,
+                       size_t max_read_buffer_size,
+                       common::buffer_pool *pool,
                        arg_type arg)
             : host_(host)
             , read_timeout_(read_timeout)
             , write_timeout_(write_timeout)
             , stream_(traits_type::construct(arg))
+            , input_buffer_(new common::input_buffer(stream_->rdbuf(), read_buffer_size, max_read_buffer_size, pool))
+            , input_stream_(new std::istream(input_buffer_.get()))
+            , arena_(new common::arena)
             {}
             
             connection(connection &&other)=default;
@@ -69,74 +403,243 @@ namespace fibio { namespace http {
                 close();
             }
             
-            void start_watchdog() {
-                watchdog_timer_.reset(new watchdog_timer_t(asio::get_io_service()));
-                watchdog_fiber_.reset(new fiber(fiber::attributes(fiber::attributes::stick_with_parent),
-                                                &connection::watchdog_fiber,
-                                                this));
-            }
-            
-            void watchdog_fiber() {
-                boost::system::error_code ignore_ec;
-                while (is_open()) {
-                    watchdog_timer_->async_wait(asio::yield[ignore_ec]);
-                    // close the stream if timeout
-                    auto dur=watchdog_timer_->expires_from_now();
-                std::chrono::seconds s=std::chrono::duration_cast<std::chrono::seconds>(dur);
-                    if (s <= std::chrono::seconds(0)) {
-                        stream().close();
-                    }
-                }
+            // Read/write deadlines are tracked by the wheel, it shuts down the socket on expiry
+            void start_watchdog(timing_wheel *wheel) {
+                wheel_=wheel;
+                timer_.reset(new stream_timer(traits_type::native_handle(stream())));
             }
             
             bool recv(request &req) {
                 bool ret=false;
                 if (bad()) return false;
-                if(read_timeout_>std::chrono::seconds(0)) {
+                if(!idle_armed_) {
                     // Set read timeout
-                    watchdog_timer_->expires_from_now(read_timeout_);
+                    set_deadline(read_timeout_);
                 }
-                ret=req.read(stream());
+                idle_armed_=false;
+                input_stream().clear();
+                ret=req.read(input_stream());
                 return ret;
             }
             
             bool send(response &resp) {
                 bool ret=false;
                 if (bad()) return false;
-                if(write_timeout_>std::chrono::seconds(0)) {
-                    // Set write timeout
-                    watchdog_timer_->expires_from_now(write_timeout_);
-                }
-                ret=resp.write(stream());
+                // Set write timeout
+                set_deadline(write_timeout_);
+                ret=output_.append(resp);
                 if (!resp.keep_alive) {
-                    stream().close();
+                    flush();
+                    close_stream();
                     return false;
                 }
                 return ret;
             }
             
+            // Send a pre-serialized response
+            bool send(const common::detail::token &status_line, const std::string &headers, bool keep_alive) {
+                if (bad()) return false;
+                // Set write timeout
+                set_deadline(write_timeout_);
+                output_.append(status_line, headers, keep_alive);
+                if (!keep_alive) {
+                    flush();
+                    close_stream();
+                    return false;
+                }
+                return true;
+            }
+            
+            // Header goes with pending responses, file content follows
+            bool send_file(response &resp) {
+                if (bad()) return false;
+                // Set write timeout
+                set_deadline(write_timeout_);
+                output_.append(resp);
+                if (!flush()) return false;
+                bool ok=true;
+                if (resp.file_parts_.empty()) {
+                    ok=write_file(resp.file_fd_, resp.file_offset_, resp.file_length_);
+                } else {
+                    // multipart/byteranges, part headers are interleaved with file ranges
+                    for (auto &part : resp.file_parts_) {
+                        ok=write_buffer(part.prefix) && write_file(resp.file_fd_, part.offset, part.length);
+                        if (!ok) break;
+                    }
+                    ok=ok && write_buffer(resp.file_parts_trailer_);
+                }
+                if (!ok) {
+                    close_stream();
+                    return false;
+                }
+                if (!resp.keep_alive) {
+                    close_stream();
+                    return false;
+                }
+                return true;
+            }
+            
+            bool write_buffer(const std::string &buf) {
+                boost::system::error_code ec;
+                boost::asio::async_write(stream().stream_descriptor(), boost::asio::buffer(buf), asio::yield[ec]);
+                return !ec;
+            }
+            
+            // Deadline is extended on each progress, so only stalled transfers time out
+            bool write_file(int fd, uint64_t offset, uint64_t length) {
+                boost::system::error_code ec;
+                if (traits_type::can_sendfile) {
+                    while (length>0) {
+                        size_t n=traits_type::send_file(stream(), fd, offset, std::min<uint64_t>(length, MAX_SENDFILE_SIZE), ec);
+                        // Zero means the file is truncated
+                        if (ec || n==0) return false;
+                        offset+=n;
+                        length-=n;
+                        set_deadline(write_timeout_);
+                    }
+                    return true;
+                }
+                if (!file_buffer_) file_buffer_.reset(new char[FILE_BUFFER_SIZE]);
+                while (length>0) {
+                    ssize_t n=::pread(fd, file_buffer_.get(), std::min<uint64_t>(length, FILE_BUFFER_SIZE), offset);
+                    if (n<0 && errno==EINTR) continue;
+                    if (n<=0) return false;
+                    boost::asio::async_write(stream().stream_descriptor(), boost::asio::buffer(file_buffer_.get(), n), asio::yield[ec]);
+                    if (ec) return false;
+                    offset+=n;
+                    length-=n;
+                    set_deadline(write_timeout_);
+                }
+                return true;
+            }
+            
+            // Interim response, body is read right after it
+            bool send_continue() {
+                namespace tokens=common::detail;
+                std::vector<boost::asio::const_buffer> bufs{
+                    boost::asio::buffer(tokens::continue_response.data, tokens::continue_response.size)
+                };
+                if (!write(bufs)) return false;
+                set_deadline(read_timeout_);
+                return true;
+            }
+            
+            // Write directly to the stream after pending responses
+            bool write(std::vector<boost::asio::const_buffer> &bufs) {
+                if (!flush()) return false;
+                // Set write timeout
+                set_deadline(write_timeout_);
+                boost::system::error_code ec;
+                boost::asio::async_write(stream().stream_descriptor(), bufs, asio::yield[ec]);
+                if (ec) {
+                    close_stream();
+                    return false;
+                }
+                return true;
+            }
+            
+            // Send all pending responses
+            bool flush() {
+                if (bad()) return false;
+                // Keep order with anything written via stream
+                stream().flush();
+                if (output_.empty()) return true;
+                if (output_.write(stream().stream_descriptor())) {
+                    close_stream();
+                    return false;
+                }
+                return true;
+            }
+            
+            /**
+             * Wait for next request on a keep-alive connection, returns false if the
+             * connection is closed
+             *
+             * Read buffer goes back to the pool and request/response/arena storage
+             * is released while waiting, buffers inside the fibio stream itself stay
+             * allocated as the stream has no way to give them back
+             */
+            bool park(request &req, response &resp, timeout_type idle_timeout) {
+                if (bad()) return false;
+                // Next request is already buffered
+                if (input_buffer_->size()>0 || stream().rdbuf()->in_avail()>0) return true;
+                bool has_idle_timeout=idle_timeout>std::chrono::seconds(0);
+                set_deadline(has_idle_timeout ? idle_timeout : read_timeout_);
+                if (!traits_type::can_park) {
+                    // Idle timeout covers reading next header as well
+                    idle_armed_=has_idle_timeout;
+                    return true;
+                }
+                req.shrink(0);
+                resp.shrink(0);
+                shrink(0);
+                arena_->release();
+                input_buffer_->park();
+                bool ret=traits_type::wait_readable(stream());
+                input_buffer_->unpark();
+                return ret && good();
+            }
+            
             bool is_open() const { return stream_ && stream().is_open(); }
             
+            void set_deadline(timeout_type t) {
+                if (!timer_ || timer_->expired() || !is_open()) return;
+                if (t>std::chrono::seconds(0)) {
+                    wheel_->schedule(*timer_, t);
+                } else {
+                    wheel_->cancel(*timer_);
+                }
+            }
+            
+            // Stream object stays alive for the servant, only the socket is closed
+            void close_stream() {
+                // Cancel first, the timer refers to the socket
+                if (timer_) wheel_->cancel(*timer_);
+                stream().close();
+            }
+            
             void close() {
+                // Cancel first, the timer refers to the socket
+                if (timer_) {
+                    wheel_->cancel(*timer_);
+                    timer_.reset();
+                }
                 if (stream_) {
                     stream_->close();
                     stream_.reset();
                 }
-                if (watchdog_timer_) {
-                    watchdog_timer_->cancel();
-                }
-                if (watchdog_fiber_) {
-                    watchdog_fiber_->join();
-                    watchdog_fiber_.reset();
-                }
-                watchdog_timer_.reset();
             }
             
             stream_type &stream() { return *stream_; };
             const stream_type &stream() const { return *stream_; };
+            
+            // Buffered input, both request header and body are read from it
+            std::istream &input_stream() { return *input_stream_; }
+            
+            // Per-request storage, reset after responses are flushed
+            common::arena *arena() { return arena_.get(); }
+            
+            void shrink(size_t limit) {
+                output_.shrink(limit);
+                if (FILE_BUFFER_SIZE>limit) file_buffer_.reset();
+            }
+            
+            // Last recv() failed as the header doesn't fit in the read buffer
+            bool header_too_large() const {
+                return good() && input_buffer_->full();
+            }
+            
+            // A complete request header is already in the buffer
+            bool has_pending_request() const {
+                static constexpr char eoh[]="\r\n\r\n";
+                const char *b=input_buffer_->data();
+                const char *e=b+input_buffer_->size();
+                return std::search(b, e, eoh, eoh+4)!=e;
+            }
 
             bool bad() const {
                 if(!stream_) return true;
+                if (timer_ && timer_->expired()) return true;
                 return !stream().is_open() || stream().eof() || stream().fail() || stream().bad();
             }
             
@@ -149,8 +652,15 @@ namespace fibio { namespace http {
             timeout_type write_timeout_;
             
             std::unique_ptr<stream_type> stream_;
-            std::unique_ptr<watchdog_timer_t> watchdog_timer_;
-            std::unique_ptr<fiber> watchdog_fiber_;
+            std::unique_ptr<common::input_buffer> input_buffer_;
+            std::unique_ptr<std::istream> input_stream_;
+            std::unique_ptr<common::arena> arena_;
+            output_batch output_;
+            timing_wheel *wheel_=nullptr;
+            std::unique_ptr<stream_timer> timer_;
+            bool idle_armed_=false;
+            // Only used for file bodies on SSL connections
+            std::unique_ptr<char[]> file_buffer_;
         };
         
         template<typename Stream>
@@ -165,38 +675,197 @@ namespace fibio { namespace http {
                           const std::string &addr,
                           unsigned short port,
                           const std::string &host,
-                          server::request_handler_type default_request_handler)
+                          server::request_handler_type default_request_handler,
+                          unsigned listeners=1)
             : host_(host)
-            , acceptor_(addr.c_str(), port)
             , default_request_handler_(std::move(default_request_handler))
             , active_connection_(0)
             , arg_(arg)
-            {}
+            {
+#ifdef SO_REUSEPORT
+                if (listeners>1) {
+                    for (unsigned i=0; i<listeners; i++) {
+                        listeners_.push_back(open_reuse_port_listener(addr, port));
+                    }
+                }
+#endif
+                if (listeners_.empty()) {
+                    acceptor_.reset(new acceptor_type(addr.c_str(), port));
+                }
+                accepted_.reset(new std::atomic<uint64_t>[num_listeners()]());
+                create_wheels();
+            }
 
             server_engine(unsigned short port, const std::string &host)
             : host_(host)
-            , acceptor_(port)
-            {}
+            , acceptor_(new acceptor_type(port))
+            , accepted_(new std::atomic<uint64_t>[1]())
+            {
+                create_wheels();
+            }
+            
+            // One timing wheel per listener, shared by all its connections
+            void create_wheels() {
+                for (size_t i=0; i<num_listeners(); i++) {
+                    wheels_.emplace_back(new timing_wheel);
+                }
+            }
+            
+            bool has_timeout() const {
+                return read_timeout_>std::chrono::seconds(0)
+                    || write_timeout_>std::chrono::seconds(0)
+                    || idle_timeout_>std::chrono::seconds(0);
+            }
+            
+            size_t num_listeners() const {
+                return listeners_.empty() ? 1 : listeners_.size();
+            }
             
             void start() {
+                buffer_pool_.reset(new common::buffer_pool(read_buffer_size_));
+                codel_.reset(new codel(codel_target_, codel_interval_));
+                if (compress_responses_) {
+                    compressor_.reset(new compressor{compression_level_, compression_min_size_, nullptr});
+                    if (compression_cache_size_>0) compressor_->cache.reset(new compression_cache(compression_cache_size_));
+                }
+                // Everything but status line, Date and Connection
+                shed_headers_.assign(common::detail::header_names[size_t(header_id::RETRY_AFTER)].data,
+                                     common::detail::header_names[size_t(header_id::RETRY_AFTER)].size);
+                shed_headers_.append(": ");
+                common::detail::append_decimal(shed_headers_, retry_after_);
+                shed_headers_.append("\r\nContent-Length: 0\r\n");
+                limit_headers_.assign("Content-Length: 0\r\n");
                 watchdog_.reset(new fiber(fiber::attributes(fiber::attributes::stick_with_parent),
                                           &server_engine::watchdog,
                                           this));
+                if (listeners_.empty()) {
+                    accept_loop(0);
+                } else {
+                    // One accept fiber per listener, the scheduler spreads them over worker threads
+                    std::vector<std::unique_ptr<fiber>> accept_fibers;
+                    for (size_t i=0; i<listeners_.size(); i++) {
+                        accept_fibers.emplace_back(new fiber(&server_engine::accept_loop, this, i));
+                    }
+                    for (auto &f : accept_fibers) {
+                        f->join();
+                    }
+                }
+                watchdog_->join();
+            }
+            
+            void accept_loop(size_t n) {
+                std::unique_ptr<fiber> ticker;
+                if (has_timeout()) {
+                    ticker.reset(new fiber(fiber::attributes(fiber::attributes::stick_with_parent),
+                                           &server_engine::ticker,
+                                           this,
+                                           wheels_[n].get()));
+                }
                 boost::system::error_code ec;
                 // Loop until accept closed
                 while (true) {
-                    connection_type sc(host_, read_timeout_, write_timeout_, arg_);
-                    ec=accept(sc);
+                    wait_for_capacity();
+                    connection_type sc(host_,
+                                       read_timeout_,
+                                       write_timeout_,
+                                       read_buffer_size_,
+                                       max_read_buffer_size_,
+                                       buffer_pool_.get(),
+                                       arg_);
+                    ec=accept(sc, n);
                     if(ec) break;
                     sc.read_timeout_=read_timeout_;
                     sc.write_timeout_=write_timeout_;
-                    fiber(&server_engine::servant, this, std::move(sc)).detach();
+                    if (has_timeout()) {
+                        sc.start_watchdog(wheels_[n].get());
+                    }
+                    if (listeners_.empty()) {
+                        fiber(&server_engine::servant, this, std::move(sc)).detach();
+                    } else {
+                        // Keep the connection on the thread its listener runs on
+                        fiber(fiber::attributes(fiber::attributes::stick_with_parent),
+                              &server_engine::servant,
+                              this,
+                              std::move(sc)).detach();
+                    }
+                }
+                if (ticker) {
+                    // Connections may still be alive, ticker runs until all of them are closed
+                    ticker->join();
+                }
+            }
+            
+            // Pause accepting at the hard limit until some connection is closed
+            void wait_for_capacity() {
+                if (max_connections_==0 || active_connection_<max_connections_) return;
+                accept_pauses_++;
+                std::unique_lock<mutex> l(connection_counter_mtx_);
+                while(active_connection_>=max_connections_ && !exiting_) {
+                    connection_close_.wait(l);
+                }
+            }
+            
+            // Past soft connection limit, requests are shed and connections are closed
+            bool too_many_connections() const {
+                return soft_max_connections_ && active_connection_>soft_max_connections_;
+            }
+            
+            /**
+             * Take a handler slot, returns false if the request should be shed
+             *
+             * Without CoDel requests are shed at max_inflight_requests, otherwise they
+             * queue for a slot, and CoDel decides by how long they have waited since
+             * the header was parsed
+             */
+            bool acquire_slot(codel::clock_type::time_point arrival) {
+                if (!codel_->enabled()) {
+                    uint32_t n=inflight_requests_.load(std::memory_order_relaxed);
+                    do {
+                        if (max_inflight_requests_ && n>=max_inflight_requests_) return false;
+                    } while (!inflight_requests_.compare_exchange_weak(n, n+1));
+                    return true;
+                }
+                {
+                    std::unique_lock<mutex> l(slot_mtx_);
+                    while (max_inflight_requests_ && inflight_requests_>=max_inflight_requests_) {
+                        slot_available_.wait(l);
+                    }
+                    inflight_requests_++;
+                }
+                if (codel_->should_drop(codel::clock_type::now()-arrival)) {
+                    release_slot();
+                    delay_shed_requests_++;
+                    return false;
+                }
+                return true;
+            }
+            
+            void release_slot() {
+                if (!codel_->enabled()) {
+                    inflight_requests_--;
+                    return;
+                }
+                std::unique_lock<mutex> l(slot_mtx_);
+                inflight_requests_--;
+                slot_available_.notify_one();
+            }
+            
+            // Close expired connections, a batch per tick
+            void ticker(timing_wheel *wheel) {
+                while (!stopped_) {
+                    this_fiber::sleep_for(wheel->tick());
+                    wheel->advance();
                 }
-                watchdog_->join();
             }
             
             void close() {
                 exit_signal_.set_value();
+                {
+                    // Wake up paused accept loops
+                    std::unique_lock<mutex> l(connection_counter_mtx_);
+                    exiting_=true;
+                    connection_close_.notify_all();
+                }
                 if(watchdog_)
                     watchdog_->join();
                 // Wait until all connections are closed
@@ -204,59 +873,228 @@ namespace fibio { namespace http {
                 while(active_connection_) {
                     connection_close_.wait(l);
                 }
+                stopped_=true;
             }
             
-            boost::system::error_code accept(connection_type &sc) {
+            boost::system::error_code accept(connection_type &sc, size_t n) {
                 boost::system::error_code ec;
-                acceptor_(sc.stream(), ec);
+                if (listeners_.empty()) {
+                    (*acceptor_)(sc.stream(), ec);
+                } else {
+                    ec=traits_type::accept(*listeners_[n], sc.stream());
+                }
                 if (!ec) {
                     active_connection_++;
+                    accepted_[n]++;
                 }
                 return ec;
             }
             
             void watchdog() {
                 exit_signal_.get_future().wait();
-                acceptor_.close();
+                if (acceptor_) {
+                    acceptor_->close();
+                }
+                for (auto &l : listeners_) {
+                    boost::system::error_code ignore_ec;
+                    l->close(ignore_ec);
+                }
+            }
+            
+            
+            // Returns false with response status set if request must not proceed
+            bool check_expectation(request &req, response &resp) {
+                auto i=req.header_views.find(header_id::EXPECT);
+                if (i==req.header_views.end()) return true;
+                if (!common::iequal()(i->second, string_view("100-continue"))) {
+                    resp.status_code=http_status_code::EXPECTATION_FAILED;
+                    return false;
+                }
+                if (!req.expect_continue || !expect_handler_) return true;
+                if (expect_handler_(req, resp)) return true;
+                if (resp.status_code==http_status_code::OK) resp.status_code=http_status_code::EXPECTATION_FAILED;
+                return false;
             }
             
             void servant(connection_type c) {
-                if (read_timeout_>std::chrono::seconds(0) || write_timeout_>std::chrono::seconds(0)) {
-                    c.start_watchdog();
+                // Both are reused for all requests on the connection
+                request req(c.arena());
+                if (decompress_requests_) req.max_decompressed_size=max_decompressed_body_size_;
+                req.max_drain_size=max_drain_size_;
+                req.continue_writer_=[&c]() {
+                    return c.send_continue();
+                };
+                response resp(c.arena());
+                resp.chunk_writer_=[&c](std::vector<boost::asio::const_buffer> &bufs) {
+                    return c.write(bufs);
+                };
+                if (compressor_) {
+                    resp.stream_compressor_=[this, &req](response &r, size_t size, bool last) {
+                        compress_stream(r, req.header_views, *compressor_, size, last);
+                    };
                 }
-                request req;
                 int count=0;
-                while(c.recv(req)) {
-                    response resp;
+                unsigned pipelined=0;
+                while(true) {
+                    // Keep-alive connection waits for next request
+                    if (count>0 && !c.park(req, resp, idle_timeout_)) break;
+                    // Routes may have lowered it for last request
+                    req.max_body_size=limits_.max_body_size;
+                    if (!c.recv(req)) {
+                        if (c.header_too_large()) {
+                            rejected_requests_++;
+                            c.send(*common::detail::status_line(http_version::HTTP_1_1, http_status_code::REQUEST_HEADER_FIELDS_TOO_LARGE),
+                                   limit_headers_,
+                                   false);
+                        }
+                        break;
+                    }
+                    // Sojourn time starts when the header is parsed
+                    codel::clock_type::time_point arrival=codel::clock_type::now();
+                    if (copy_headers_) req.copy_headers();
                     // Set default attributes for response
+                    resp.clear();
                     resp.status_code=http_status_code::OK;
                     resp.version=req.version;
+                    resp.head_=(req.method==http_method::HEAD);
                     resp.keep_alive=req.keep_alive;
                     if(count>=max_keep_alive_) resp.keep_alive=false;
-                    if(!default_request_handler_(req, resp, c.stream())) {
+                    bool closing=too_many_connections();
+                    http_status_code limit=limits_.check(req);
+                    if (limit!=http_status_code::OK) {
+                        // Body is not read, the connection is closed
+                        rejected_requests_++;
+                        c.send(*common::detail::status_line(req.version, limit), limit_headers_, false);
+                    } else if (!check_expectation(req, resp)) {
+                        // Rejected before the client sent the body
+                        resp.keep_alive=false;
+                        c.send(resp);
+                    } else if (closing || !acquire_slot(arrival)) {
+                        // Shed without running the handler, connections over limit are closed
+                        shed_requests_++;
+                        c.send(*common::detail::status_line(req.version, http_status_code::SERVICE_UNAVAILABLE),
+                               shed_headers_,
+                               resp.keep_alive && !closing && !req.continue_pending());
+                    } else {
+                        bool ret=default_request_handler_(req, resp, c.input_stream());
+                        release_slot();
+                        if(!ret) break;
+                        handled_requests_++;
+                        // Handler may have changed copied headers, views follow them
+                        if (copy_headers_) req.rebind_views();
+                        // Body may still be on its way if the handler didn't ask for it
+                        if (req.continue_pending()) resp.keep_alive=false;
+                        if (resp.chunked()) {
+                            // Body has been streamed, only the tail is left
+                            if (!resp.finish_chunked() || !resp.keep_alive) {
+                                c.close();
+                                break;
+                            }
+                        } else {
+                            // Vary is decided on the whole body, before a range replaces it
+                            bool compressible=compressor_ && vary_on_encoding(resp, *compressor_);
+                            if (req.method==http_method::GET) resp.apply_range(req.header_views);
+                            if (compressible) compress_response(resp, req.header_views, *compressor_);
+                            if (resp.has_file_body() && !resp.head_) {
+                                c.send_file(resp);
+                            } else {
+                                c.send(resp);
+                            }
+                        }
+                    }
+                    // Connection-closing response has been sent, nothing left to drain
+                    if (!c.is_open()) break;
+                    // Make sure we consumed all parts of the request, a large
+                    // body is not worth reading, closing the connection is cheaper
+                    if (!req.drop_body()) {
+                        closed_bodies_++;
+                        c.flush();
+                        c.close();
                         break;
                     }
-                    c.send(resp);
-                    // Make sure we consumed all parts of the request
-                    req.drop_body();
-                    // Make sure all data are received and sent
-                    c.stream().flush();
+                    if (req.dropped_bytes>0) drained_bodies_++;
                     // Keepalive counter
                     count++;
+                    // Pipelined requests are handled in order, their responses are
+                    // coalesced and sent with one gather write
+                    if (++pipelined<pipeline_depth_ && c.has_pending_request()) {
+                        continue;
+                    }
+                    pipelined=0;
+                    // Make sure all data are received and sent
+                    c.flush();
+                    // Nothing refers to the arena after both are cleared
+                    req.clear();
+                    resp.clear();
+                    c.arena()->reset();
+                    // Don't hold buffers grown by an unusually large message
+                    req.shrink(high_water_mark_);
+                    resp.shrink(high_water_mark_);
+                    c.shrink(high_water_mark_);
+                }
+                if (pipelined>0 && c.is_open()) {
+                    // Send out responses to pipelined requests
+                    c.flush();
                 }
                 c.close();
                 
+                std::unique_lock<mutex> l(connection_counter_mtx_);
                 active_connection_--;
-                connection_close_.notify_one();
+                // Both close() and paused accept loops may be waiting
+                connection_close_.notify_all();
+            }
+            
+            void get_stats(server::stats &st) const {
+                for (size_t i=0; i<num_listeners(); i++) {
+                    st.accepted.push_back(accepted_[i].load(std::memory_order_relaxed));
+                }
+                st.active_connections=active_connection_;
+                st.accept_pauses=accept_pauses_;
+                st.handled_requests=handled_requests_;
+                st.shed_requests=shed_requests_;
+                st.delay_shed_requests=delay_shed_requests_;
+                st.rejected_requests=rejected_requests_;
+                st.drained_bodies=drained_bodies_;
+                st.closed_bodies=closed_bodies_;
             }
             
             std::string host_;
-            acceptor_type acceptor_;
+            // Either a single acceptor or SO_REUSEPORT listeners
+            std::unique_ptr<acceptor_type> acceptor_;
+            std::vector<std::unique_ptr<listening_socket>> listeners_;
+            std::unique_ptr<std::atomic<uint64_t>[]> accepted_;
+            std::vector<std::unique_ptr<timing_wheel>> wheels_;
+            std::unique_ptr<common::buffer_pool> buffer_pool_;
+            std::unique_ptr<codel> codel_;
             server::request_handler_type default_request_handler_;
             promise<void> exit_signal_;
             timeout_type read_timeout_=std::chrono::seconds(0);
             timeout_type write_timeout_=std::chrono::seconds(0);
+            timeout_type idle_timeout_=std::chrono::seconds(0);
             unsigned max_keep_alive_=DEFAULT_KEEP_ALIVE_REQ_PER_CONNECTION;
+            bool copy_headers_=false;
+            unsigned pipeline_depth_=DEFAULT_PIPELINE_DEPTH;
+            size_t read_buffer_size_=common::DEFAULT_READ_BUFFER_SIZE;
+            size_t max_read_buffer_size_=common::DEFAULT_MAX_READ_BUFFER_SIZE;
+            size_t high_water_mark_=DEFAULT_HIGH_WATER_MARK;
+            unsigned max_connections_=0;
+            unsigned soft_max_connections_=0;
+            unsigned max_inflight_requests_=0;
+            unsigned retry_after_=1;
+            timeout_type codel_target_=std::chrono::seconds(0);
+            timeout_type codel_interval_=DEFAULT_CODEL_INTERVAL;
+            bool compress_responses_=false;
+            int compression_level_=DEFAULT_COMPRESSION_LEVEL;
+            size_t compression_min_size_=DEFAULT_COMPRESSION_MIN_SIZE;
+            size_t compression_cache_size_=DEFAULT_COMPRESSION_CACHE_SIZE;
+            std::unique_ptr<compressor> compressor_;
+            bool decompress_requests_=false;
+            size_t max_decompressed_body_size_=DEFAULT_MAX_DECOMPRESSED_BODY_SIZE;
+            server::expect_handler_type expect_handler_;
+            request_limits limits_;
+            size_t max_drain_size_=DEFAULT_MAX_DRAIN_SIZE;
+            std::string shed_headers_;
+            std::string limit_headers_;
             arg_type arg_;
             
             std::unique_ptr<fiber> watchdog_;
@@ -266,6 +1104,19 @@ namespace fibio { namespace http {
             std::atomic<uint32_t> active_connection_;
             mutex connection_counter_mtx_;
             condition_variable connection_close_;
+            std::atomic<bool> stopped_{false};
+            bool exiting_=false;
+            
+            std::atomic<uint32_t> inflight_requests_{0};
+            std::atomic<uint64_t> accept_pauses_{0};
+            std::atomic<uint64_t> handled_requests_{0};
+            std::atomic<uint64_t> shed_requests_{0};
+            std::atomic<uint64_t> delay_shed_requests_{0};
+            std::atomic<uint64_t> rejected_requests_{0};
+            std::atomic<uint64_t> drained_bodies_{0};
+            std::atomic<uint64_t> closed_bodies_{0};
+            mutex slot_mtx_;
+            condition_variable slot_available_;
         };
     }   // End of namespace detail
     
@@ -277,50 +1128,172 @@ namespace fibio { namespace http {
         // Make sure there is no pending data in the last request
         drop_body();
         common::request::clear();
+        trailers.clear();
+        expect_continue=false;
+        continue_sent_=false;
+        body_requested_=false;
+    }
+    
+    void server_request::send_continue() {
+        continue_sent_=true;
+        if (continue_writer_) continue_writer_();
     }
     
     bool server_request::accept_compressed() const {
-        auto i=headers.find("Accept-Encoding");
-        if (i==headers.end()) return false;
-        // TODO: Kinda buggy
-        return strcasestr(i->second.c_str(), "gzip")!=NULL;
+        auto i=header_views.find(header_id::ACCEPT_ENCODING);
+        if (i==header_views.end()) return false;
+        return detail::negotiate_encoding(i->second)!=detail::content_coding::IDENTITY;
     }
     
     bool server_request::read(std::istream &is) {
         clear();
-        if (!common::request::read_header(is)) return false;
-        if (content_length>0) {
+        common::input_buffer *buf=dynamic_cast<common::input_buffer *>(is.rdbuf());
+        if (buf) {
+            // Headers are views into the connection buffer
+            if (!common::request::read_header(*buf)) return false;
+        } else {
+            if (!common::request::read_header(is)) return false;
+        }
+        auto i=header_views.find(header_id::EXPECT);
+        expect_continue=(i!=header_views.end()
+                         && version==http_version::HTTP_1_1
+                         && (content_length>0 || chunked)
+                         && common::iequal()(i->second, string_view("100-continue")));
+        return setup_body_stream(is);
+    }
+    
+    bool server_request::setup_body_stream(std::istream &is) {
+        namespace bio = boost::iostreams;
+        std::unique_ptr<std::istream> raw;
+        if (chunked) {
+            // Decoded in place on the connection buffer
+            if (!chunked_buf_) chunked_buf_.reset(new common::chunked_istreambuf);
+            chunked_buf_->reset(is.rdbuf(), &trailers);
+            chunked_buf_->set_max_size(max_body_size);
+            raw.reset(new std::istream(chunked_buf_.get()));
+        } else if (content_length>0) {
             // Setup body stream
-            namespace bio = boost::iostreams;
             restriction_.reset(new bio::restriction<std::istream>(is, 0, content_length));
             bio::filtering_istream *in=new bio::filtering_istream;
             in->push(*restriction_);
-            body_stream_.reset(in);
+            raw.reset(in);
+        } else {
+            return true;
+        }
+        auto i=header_views.find(header_id::CONTENT_ENCODING);
+        if (max_decompressed_size==0 || i==header_views.end()) {
+            body_stream_=std::move(raw);
+            return true;
+        }
+        common::iequal eq;
+        bio::filtering_istream *in=new bio::filtering_istream;
+        if (eq(i->second, string_view("gzip")) || eq(i->second, string_view("x-gzip"))) {
+            in->push(detail::size_limit_filter(max_decompressed_size, &decompressed_size_exceeded));
+            in->push(bio::gzip_decompressor());
+        } else if (eq(i->second, string_view("deflate"))) {
+            in->push(detail::size_limit_filter(max_decompressed_size, &decompressed_size_exceeded));
+            in->push(bio::zlib_decompressor());
         }
+        // Unknown codings are passed through for the handler to deal with
+        encoded_stream_=std::move(raw);
+        in->push(*encoded_stream_);
+        body_stream_.reset(in);
         return true;
     }
     
-    void server_request::drop_body() {
+    bool server_request::drop_body() {
+        bool ok=true;
+        dropped_bytes=0;
         // Discard body content iff body stream exists
         if (body_stream_) {
-            while (!body_stream().eof()) {
-                char buf[1024];
-                body_stream().read(buf, sizeof(buf));
+            // No need to decompress what nobody reads
+            std::istream &s=encoded_stream_ ? *encoded_stream_ : *body_stream_;
+            if (continue_pending()) {
+                // Body was never asked for, connection is closed instead
+                ok=false;
+            } else if (max_drain_size && !body_requested_ && !chunked && content_length>max_drain_size) {
+                // Untouched, so all of it is left
+                ok=false;
+            } else {
+                // Handler may have left the stream failed in the middle
+                if (!s.eof()) s.clear();
+                char buf[8192];
+                while (s && !s.eof()) {
+                    if (max_drain_size && dropped_bytes>max_drain_size) break;
+                    s.read(buf, sizeof(buf));
+                    dropped_bytes+=s.gcount();
+                }
+                ok=s.eof() && !(chunked && chunked_buf_->failed());
             }
             body_stream_.reset();
+            encoded_stream_.reset();
             restriction_.reset();
         }
+        decompressed_size_exceeded=false;
+        return ok;
+    }
+    
+    void server_request::limit_body(size_t n) {
+        if (n==0 || (max_body_size && max_body_size<=n)) return;
+        max_body_size=n;
+        if (chunked && chunked_buf_) chunked_buf_->set_max_size(n);
+    }
+    
+    //////////////////////////////////////////////////////////////////////////////////////////
+    // request_limits
+    //////////////////////////////////////////////////////////////////////////////////////////
+    
+    http_status_code request_limits::check(const server_request &req) const {
+        if (max_url_length && req.url_view.size()>max_url_length) {
+            return http_status_code::REQUEST_URI_TOO_LONG;
+        }
+        if (max_header_size) {
+            size_t n=0;
+            for (auto &h : req.header_views) {
+                // "name: value\r\n"
+                n+=h.first.size()+h.second.size()+4;
+            }
+            if (n>max_header_size) return http_status_code::REQUEST_HEADER_FIELDS_TOO_LARGE;
+        }
+        if (max_body_size && req.content_length>max_body_size) {
+            return http_status_code::REQUEST_ENTITY_TOO_LARGE;
+        }
+        return http_status_code::OK;
     }
     
     //////////////////////////////////////////////////////////////////////////////////////////
     // server_response
     //////////////////////////////////////////////////////////////////////////////////////////
     
+    server_response::~server_response() {
+        clear_file_body();
+    }
+    
     void server_response::clear() {
         common::response::clear();
-        std::string e;
-        if (!raw_body_stream_.vector().empty())
-            raw_body_stream_.swap_vector(e);
+        clear_file_body();
+        static_owner_.reset();
+        static_body_.clear();
+        static_headers_.clear();
+        range_headers_.clear();
+        chunked_=false;
+        header_sent_=false;
+        head_=false;
+        if (!raw_body_stream_.vector().empty()) {
+            // Keep capacity of the body buffer
+            std::string v;
+            raw_body_stream_.swap_vector(v);
+            v.clear();
+            raw_body_stream_.swap_vector(v);
+        }
+    }
+    
+    void server_response::shrink(size_t limit) {
+        common::response::shrink(limit);
+        std::string v;
+        raw_body_stream_.swap_vector(v);
+        if (v.capacity()>limit) std::string().swap(v);
+        raw_body_stream_.swap_vector(v);
     }
     
     const std::string &server_response::get_body() const {
@@ -331,50 +1304,330 @@ namespace fibio { namespace http {
         return raw_body_stream_;
     }
     
+    std::ostream &server_response::chunked_body_stream() {
+        if (chunked_) return *chunked_stream_;
+        if (!chunked_buf_) {
+            chunked_buf_.reset(new common::chunked_ostreambuf);
+            chunked_stream_.reset(new std::ostream(chunked_buf_.get()));
+        }
+        chunked_=true;
+        // HTTP/1.0 doesn't know chunked, body ends when connection closes
+        bool framing=(version==http_version::HTTP_1_1);
+        if (!framing) keep_alive=false;
+        chunked_stream_->clear();
+        chunked_buf_->reset([this](std::vector<boost::asio::const_buffer> &bufs)->bool{
+            if (!chunk_writer_) return false;
+            if (head_) {
+                // Only the header goes out, chunks are discarded
+                if (header_sent_) return true;
+                bufs.clear();
+            }
+            if (!header_sent_) {
+                chunk_header_block_.clear();
+                if (!serialize_header(chunk_header_block_)) return false;
+                bufs.insert(bufs.begin(), boost::asio::buffer(chunk_header_block_));
+                header_sent_=true;
+            }
+            return chunk_writer_(bufs);
+        }, framing, [this](size_t size, bool last) {
+            if (stream_compressor_) stream_compressor_(*this, size, last);
+        });
+        return *chunked_stream_;
+    }
+    
+    bool server_response::finish_chunked() {
+        if (!chunked_) return false;
+        chunked_stream_->flush();
+        return chunked_buf_->finish();
+    }
+    
     size_t server_response::get_content_length() const {
+        if (has_file_body()) {
+            if (file_parts_.empty()) return file_length_;
+            size_t n=file_parts_trailer_.size();
+            for (auto &part : file_parts_) n+=part.prefix.size()+part.length;
+            return n;
+        }
+        if (static_owner_) return static_body_.size();
         return raw_body_stream_.vector().size();
     }
     
+    void server_response::set_static_body(std::shared_ptr<const void> owner,
+                                          const string_view &body,
+                                          const string_view &headers)
+    {
+        static_owner_=std::move(owner);
+        static_body_=body;
+        static_headers_=headers;
+    }
+    
+    bool server_response::set_file_body(const std::string &path) {
+        clear_file_body();
+        int fd=::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd<0) return false;
+        struct stat st;
+        if (::fstat(fd, &st)!=0 || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return false;
+        }
+        file_fd_=fd;
+        file_offset_=0;
+        file_length_=st.st_size;
+        file_size_=st.st_size;
+        return true;
+    }
+    
+    string_view server_response::find_header(const string_view &name) const {
+        auto i=headers.find(name);
+        if (i!=headers.end()) return string_view(i->second);
+        // Lines of "Name: value\r\n"
+        const char *p=static_headers_.begin();
+        const char *e=static_headers_.end();
+        while (p<e) {
+            const char *eol=std::find(p, e, '\r');
+            const char *colon=std::find(p, eol, ':');
+            if (colon<eol && common::iequal()(string_view(p, colon-p), name)) {
+                const char *v=colon+1;
+                while (v<eol && *v==' ') v++;
+                return string_view(v, eol-v);
+            }
+            p=eol+2;
+        }
+        return string_view();
+    }
+    
+    void server_response::apply_range(const common::header_view_map &request_headers) {
+        namespace tokens=common::detail;
+        if (status_code!=http_status_code::OK || chunked_) return;
+        auto r=request_headers.find(header_id::RANGE);
+        if (r==request_headers.end()) return;
+        auto ir=request_headers.find(header_id::IF_RANGE);
+        if (ir!=request_headers.end()) {
+            // Range is honored only if the validator still matches, weak tags never do
+            string_view v=ir->second;
+            bool is_tag=!v.empty() && (v[0]=='"' || v.starts_with("W/"));
+            string_view current=find_header(is_tag ? "ETag" : "Last-Modified");
+            if (current.empty() || v!=current || v.starts_with("W/")) return;
+        }
+        uint64_t size=get_content_length();
+        std::vector<detail::byte_range> ranges;
+        detail::range_result result=detail::parse_byte_ranges(r->second, size, ranges);
+        if (result==detail::range_result::IGNORE) return;
+        if (result==detail::range_result::UNSATISFIABLE) {
+            status_code=http_status_code::REQUESTED_RANGE_NOT_SATISFIABLE;
+            std::string cr("bytes */");
+            tokens::append_decimal(cr, size);
+            headers.insert(std::make_pair("Content-Range", cr));
+            clear_file_body();
+            static_owner_.reset();
+            static_body_.clear();
+            std::string v;
+            raw_body_stream_.swap_vector(v);
+            v.clear();
+            raw_body_stream_.swap_vector(v);
+            return;
+        }
+        status_code=http_status_code::PARTIAL_CONTENT;
+        if (ranges.size()==1) {
+            const detail::byte_range &range=ranges.front();
+            std::string cr;
+            detail::append_content_range(cr, range.first, range.length, size);
+            headers.insert(std::make_pair("Content-Range", cr));
+            if (has_file_body()) {
+                // Still zero-copy
+                file_offset_+=range.first;
+                file_length_=range.length;
+            } else if (static_owner_) {
+                static_body_=static_body_.substr(range.first, range.length);
+            } else {
+                std::string v;
+                raw_body_stream_.swap_vector(v);
+                v.erase(range.first+range.length);
+                v.erase(0, range.first);
+                raw_body_stream_.swap_vector(v);
+            }
+            return;
+        }
+        
+        // multipart/byteranges, original Content-Type goes into each part
+        std::string boundary=detail::make_boundary();
+        string_view ct=find_header("Content-Type");
+        std::string content_type=ct.empty() ? std::string("text/plain") : std::string(ct.data(), ct.size());
+        if (!static_headers_.empty()) {
+            // Copy the pre-serialized block without its Content-Type line
+            range_headers_.clear();
+            const char *p=static_headers_.begin();
+            const char *e=static_headers_.end();
+            while (p<e) {
+                const char *eol=std::min(std::find(p, e, '\r')+2, e);
+                if (!boost::algorithm::istarts_with(string_view(p, eol-p), "Content-Type:")) range_headers_.append(p, eol);
+                p=eol;
+            }
+            static_headers_=range_headers_;
+        }
+        set_content_type("multipart/byteranges; boundary="+boundary);
+        std::vector<std::string> prefixes;
+        for (auto &range : ranges) {
+            std::string prefix(prefixes.empty() ? "--" : "\r\n--");
+            prefix.append(boundary);
+            prefix.append("\r\nContent-Type: ");
+            prefix.append(content_type);
+            prefix.append("\r\nContent-Range: ");
+            detail::append_content_range(prefix, range.first, range.length, size);
+            prefix.append("\r\n\r\n");
+            prefixes.push_back(std::move(prefix));
+        }
+        std::string trailer("\r\n--");
+        trailer.append(boundary);
+        trailer.append("--\r\n");
+        if (has_file_body()) {
+            file_parts_.clear();
+            for (size_t i=0; i<ranges.size(); i++) {
+                file_parts_.push_back(file_part{std::move(prefixes[i]), file_offset_+ranges[i].first, ranges[i].length});
+            }
+            file_parts_trailer_=std::move(trailer);
+            return;
+        }
+        // Buffered and static bodies are assembled in memory
+        std::string body;
+        raw_body_stream_.swap_vector(body);
+        string_view src=static_owner_ ? static_body_ : string_view(body);
+        std::string out;
+        for (size_t i=0; i<ranges.size(); i++) {
+            out.append(prefixes[i]);
+            out.append(src.data()+ranges[i].first, ranges[i].length);
+        }
+        out.append(trailer);
+        static_owner_.reset();
+        static_body_.clear();
+        raw_body_stream_.swap_vector(out);
+    }
+    
+    void server_response::clear_file_body() {
+        if (file_fd_>=0) {
+            ::close(file_fd_);
+            file_fd_=-1;
+        }
+        file_offset_=file_length_=file_size_=0;
+        file_parts_.clear();
+        file_parts_trailer_.clear();
+    }
+    
     void server_response::set_content_type(const std::string &ct) {
-        auto i=headers.find("content-type");
+        auto i=headers.find(header_id::CONTENT_TYPE);
         if (i==headers.end()) {
             headers.insert(std::make_pair("Content-Type", ct));
         } else {
-            i->second.assign(ct);
+            i->second.assign(ct.data(), ct.size());
         }
     }
     
-    bool server_response::write_header(std::ostream &os) {
-        std::string ka;
-        if (keep_alive) {
-            ka="keep-alive";
-        } else {
-            ka="close";
+    bool server_response::serialize_header(std::string &buf) const {
+        namespace tokens=common::detail;
+        const tokens::token *l=tokens::status_line(version, status_code);
+        if (!l) return false;
+        buf.append(l->data, l->size);
+        
+        bool has_date=false;
+        bool has_content_type=false;
+        for (auto &p: headers) {
+            if (p.id==header_id::CONTENT_LENGTH
+                || p.id==header_id::CONNECTION
+                || (chunked_ && p.id==header_id::TRANSFER_ENCODING))
+            {
+                // Always generated
+                continue;
+            } else if (p.id==header_id::DATE) {
+                has_date=true;
+            } else if (p.id==header_id::CONTENT_TYPE) {
+                has_content_type=true;
+            }
+            buf.append(p.first.data(), p.first.size());
+            buf.append(": ", 2);
+            buf.append(p.second.data(), p.second.size());
+            buf.append(tokens::crlf.data, tokens::crlf.size);
         }
-        auto i=headers.find("connection");
-        if (i==headers.end()) {
-            headers.insert(std::make_pair("Connection", ka));
+        bool has_body=detail::status_has_body(status_code);
+        if (!static_headers_.empty()) {
+            // Pre-serialized block carries Content-Type if needed, a 304 only
+            // keeps the validators of the body it stands for
+            if (has_body) {
+                buf.append(static_headers_.data(), static_headers_.size());
+            } else {
+                detail::append_validator_lines(buf, static_headers_);
+            }
+            has_content_type=true;
+        }
+        if (!has_date) {
+            tokens::token d=detail::date_line();
+            buf.append(d.data, d.size);
+        }
+        if (has_file_body()) {
+            buf.append(tokens::accept_ranges_bytes_line.data, tokens::accept_ranges_bytes_line.size);
+        }
+        if (chunked_) {
+            if (!has_content_type) {
+                buf.append(tokens::default_content_type_line.data, tokens::default_content_type_line.size);
+            }
+            // HTTP/1.0 body is delimited by closing the connection
+            if (version==http_version::HTTP_1_1) {
+                buf.append(tokens::transfer_encoding_chunked_line.data, tokens::transfer_encoding_chunked_line.size);
+            }
+        } else if (has_body) {
+            size_t cl=get_content_length();
+            if (!has_content_type && cl>0) {
+                buf.append(tokens::default_content_type_line.data, tokens::default_content_type_line.size);
+            }
+            buf.append(tokens::content_length_prefix.data, tokens::content_length_prefix.size);
+            tokens::append_decimal(buf, cl);
+            buf.append(tokens::crlf.data, tokens::crlf.size);
+        }
+        if (keep_alive) {
+            buf.append(tokens::connection_keep_alive_line.data, tokens::connection_keep_alive_line.size);
         } else {
-            i->second.assign(ka);
+            buf.append(tokens::connection_close_line.data, tokens::connection_close_line.size);
         }
-        if (!common::response::write_header(os)) return false;
+        // End of header
+        buf.append(tokens::crlf.data, tokens::crlf.size);
+        return true;
+    }
+    
+    bool server_response::write_header(std::ostream &os) {
+        std::string buf;
+        if (!serialize_header(buf)) return false;
+        os.write(buf.data(), buf.size());
         return !os.eof() && !os.fail() && !os.bad();
     }
     
     bool server_response::write(std::ostream &os) {
-        // Set "content-length" header
-        auto i=headers.find("content-length");
-        if (i==headers.end()) {
-            headers.insert(std::make_pair("Content-Length", boost::lexical_cast<std::string>(get_content_length())));
-        } else {
-            i->second.assign(boost::lexical_cast<std::string>(get_content_length()));
-        }
         // Write headers
         if (!write_header(os)) return false;
         // Write body
-        os.write(&(raw_body_stream_.vector()[0]), raw_body_stream_.vector().size());
+        if (!detail::sends_body(*this)) return true;
+        if (has_file_body() && file_parts_.empty()) {
+            if (!detail::write_file_range(os, file_fd_, file_offset_, file_length_)) return false;
+        } else if (has_file_body()) {
+            for (auto &part : file_parts_) {
+                os.write(part.prefix.data(), part.prefix.size());
+                if (!detail::write_file_range(os, file_fd_, part.offset, part.length)) return false;
+            }
+            os.write(file_parts_trailer_.data(), file_parts_trailer_.size());
+        } else if (static_owner_) {
+            os.write(static_body_.data(), static_body_.size());
+        } else {
+            os.write(&(raw_body_stream_.vector()[0]), raw_body_stream_.vector().size());
+        }
         return !os.eof() && !os.fail() && !os.bad();
     }
+    
+    bool server_response::serialize(std::string &header_block, std::string &body) {
+        header_block.clear();
+        if (!serialize_header(header_block)) return false;
+        // Move body out, no copy
+        body.clear();
+        if (detail::sends_body(*this)) raw_body_stream_.swap_vector(body);
+        return true;
+    }
 
     //////////////////////////////////////////////////////////////////////////////////////////
     // server
@@ -404,24 +1657,70 @@ namespace fibio { namespace http {
     server::server(settings s)
     : ssl_(s.ctx)
     {
+        // Without a slot limit there is no queue, CoDel would never see a delay
+        assert(s.codel_target==std::chrono::seconds(0) || s.max_inflight_requests>0);
         if(ssl_) {
             engine_=reinterpret_cast<impl *>(new ssl_server_engine(s.ctx,
                                                                    s.address,
                                                                    s.port,
                                                                    get_default_host_name<ssl::tcp_stream>(s.port),
-                                                                   std::move(s.default_request_handler)));
+                                                                   std::move(s.default_request_handler),
+                                                                   s.listeners));
             get_ssl_engine(engine_)->read_timeout_=s.read_timeout;
             get_ssl_engine(engine_)->write_timeout_=s.write_timeout;
+            get_ssl_engine(engine_)->idle_timeout_=s.idle_timeout;
             get_ssl_engine(engine_)->max_keep_alive_=s.max_keep_alive;
+            get_ssl_engine(engine_)->copy_headers_=s.copy_headers;
+            get_ssl_engine(engine_)->pipeline_depth_=std::max(s.pipeline_depth, 1u);
+            get_ssl_engine(engine_)->read_buffer_size_=s.read_buffer_size;
+            get_ssl_engine(engine_)->max_read_buffer_size_=s.max_read_buffer_size;
+            get_ssl_engine(engine_)->high_water_mark_=s.high_water_mark;
+            get_ssl_engine(engine_)->max_connections_=s.max_connections;
+            get_ssl_engine(engine_)->soft_max_connections_=s.soft_max_connections;
+            get_ssl_engine(engine_)->max_inflight_requests_=s.max_inflight_requests;
+            get_ssl_engine(engine_)->retry_after_=s.retry_after;
+            get_ssl_engine(engine_)->codel_target_=s.codel_target;
+            get_ssl_engine(engine_)->codel_interval_=s.codel_interval;
+            get_ssl_engine(engine_)->compress_responses_=s.compress_responses;
+            get_ssl_engine(engine_)->compression_level_=s.compression_level;
+            get_ssl_engine(engine_)->compression_min_size_=s.compression_min_size;
+            get_ssl_engine(engine_)->compression_cache_size_=s.compression_cache_size;
+            get_ssl_engine(engine_)->decompress_requests_=s.decompress_requests;
+            get_ssl_engine(engine_)->max_decompressed_body_size_=s.max_decompressed_body_size;
+            get_ssl_engine(engine_)->expect_handler_=s.expect_handler;
+            get_ssl_engine(engine_)->limits_=s.limits;
+            get_ssl_engine(engine_)->max_drain_size_=s.max_drain_size;
         } else {
             engine_=reinterpret_cast<impl *>(new server_engine(0,
                                                                s.address,
                                                                s.port,
                                                                get_default_host_name<tcp_stream>(s.port),
-                                                               std::move(s.default_request_handler)));
+                                                               std::move(s.default_request_handler),
+                                                               s.listeners));
             get_engine(engine_)->read_timeout_=s.read_timeout;
             get_engine(engine_)->write_timeout_=s.write_timeout;
+            get_engine(engine_)->idle_timeout_=s.idle_timeout;
             get_engine(engine_)->max_keep_alive_=s.max_keep_alive;
+            get_engine(engine_)->copy_headers_=s.copy_headers;
+            get_engine(engine_)->pipeline_depth_=std::max(s.pipeline_depth, 1u);
+            get_engine(engine_)->read_buffer_size_=s.read_buffer_size;
+            get_engine(engine_)->max_read_buffer_size_=s.max_read_buffer_size;
+            get_engine(engine_)->high_water_mark_=s.high_water_mark;
+            get_engine(engine_)->max_connections_=s.max_connections;
+            get_engine(engine_)->soft_max_connections_=s.soft_max_connections;
+            get_engine(engine_)->max_inflight_requests_=s.max_inflight_requests;
+            get_engine(engine_)->retry_after_=s.retry_after;
+            get_engine(engine_)->codel_target_=s.codel_target;
+            get_engine(engine_)->codel_interval_=s.codel_interval;
+            get_engine(engine_)->compress_responses_=s.compress_responses;
+            get_engine(engine_)->compression_level_=s.compression_level;
+            get_engine(engine_)->compression_min_size_=s.compression_min_size;
+            get_engine(engine_)->compression_cache_size_=s.compression_cache_size;
+            get_engine(engine_)->decompress_requests_=s.decompress_requests;
+            get_engine(engine_)->max_decompressed_body_size_=s.max_decompressed_body_size;
+            get_engine(engine_)->expect_handler_=s.expect_handler;
+            get_engine(engine_)->limits_=s.limits;
+            get_engine(engine_)->max_drain_size_=s.max_drain_size;
         }
     }
     
@@ -458,4 +1757,14 @@ namespace fibio { namespace http {
             servant_.reset();
         }
     }
+    
+    server::stats server::get_stats() const {
+        stats ret;
+        if (ssl_) {
+            get_ssl_engine(engine_)->get_stats(ret);
+        } else {
+            get_engine(engine_)->get_stats(ret);
+        }
+        return ret;
+    }
 }}  // End of namespace fibio::http
@@ -0,0 +1,455 @@
+//
+//  simd_parser.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/23.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <atomic>
+#include <cstring>
+#if !defined(FIBIO_HTTP_NO_SIMD_PARSER) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define FIBIO_HTTP_X86_SIMD 1
+#   include <immintrin.h>
+#endif
+#include "simd_parser.hpp"
+#include "http_tokens.hpp"
+
+namespace fibio { namespace http { namespace common { namespace detail {
+    namespace simd {
+        // RFC 7230 tchar
+        inline bool is_token_char(unsigned char c) {
+            if (c<=0x20 || c>=0x7f) return false;
+            switch (c) {
+                case '"': case '(': case ')': case ',': case '/': case ':': case ';':
+                case '<': case '=': case '>': case '?': case '@': case '[': case '\\':
+                case ']': case '{': case '}':
+                    return false;
+                default:
+                    return true;
+            }
+        }
+
+        // CTL except HT ends a header value
+        inline bool is_value_char(unsigned char c) {
+            return (c>=0x20 || c=='\t') && c!=0x7f;
+        }
+
+        // CTL and SP end request target
+        inline bool is_url_char(unsigned char c) {
+            return c>0x20 && c!=0x7f;
+        }
+
+        /**
+         * Scanning primitives, each returns the first byte not belonging to the token
+         */
+        struct scanner {
+            parser_backend backend;
+            const char *(*skip_name)(const char *p, const char *end);
+            const char *(*skip_value)(const char *p, const char *end);
+            const char *(*skip_url)(const char *p, const char *end);
+        };
+
+        const char *scalar_skip_name(const char *p, const char *end) {
+            while (p<end && is_token_char(*p)) ++p;
+            return p;
+        }
+
+        const char *scalar_skip_value(const char *p, const char *end) {
+            while (p<end && is_value_char(*p)) ++p;
+            return p;
+        }
+
+        const char *scalar_skip_url(const char *p, const char *end) {
+            while (p<end && is_url_char(*p)) ++p;
+            return p;
+        }
+
+#ifdef FIBIO_HTTP_X86_SIMD
+        // Byte ranges for PCMPESTRI, scanning stops on any byte within these ranges
+        // Conservative, '|' and '~' stop SIMD scanning as well, scalar code continues
+        alignas(16) const char name_ranges[16]={
+            '\x00', ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', '\xff'
+        };
+        alignas(16) const char value_ranges[16]={
+            '\x00', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'
+        };
+        alignas(16) const char url_ranges[16]={
+            '\x00', ' ', '\x7f', '\x7f'
+        };
+
+        __attribute__((target("sse4.2")))
+        const char *sse42_skip_ranges(const char *p, const char *end, const char *ranges, int ranges_size) {
+            __m128i r=_mm_load_si128(reinterpret_cast<const __m128i *>(ranges));
+            while (end-p>=16) {
+                __m128i b=_mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                int i=_mm_cmpestri(r, ranges_size, b, 16,
+                                   _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES|_SIDD_LEAST_SIGNIFICANT);
+                if (i!=16) return p+i;
+                p+=16;
+            }
+            return p;
+        }
+
+        const char *sse42_skip_name(const char *p, const char *end) {
+            return scalar_skip_name(sse42_skip_ranges(p, end, name_ranges, 16), end);
+        }
+
+        const char *sse42_skip_value(const char *p, const char *end) {
+            return scalar_skip_value(sse42_skip_ranges(p, end, value_ranges, 6), end);
+        }
+
+        const char *sse42_skip_url(const char *p, const char *end) {
+            return scalar_skip_url(sse42_skip_ranges(p, end, url_ranges, 4), end);
+        }
+
+        // Skip 32 bytes at a time while all bytes are above max_ctl, except HT if allow_ht, and not DEL
+        __attribute__((target("avx2")))
+        const char *avx2_skip_ctl(const char *p, const char *end, char max_ctl, bool allow_ht) {
+            const __m256i ctl=_mm256_set1_epi8(max_ctl);
+            const __m256i ht=_mm256_set1_epi8(allow_ht ? '\t' : '\x7f');
+            const __m256i del=_mm256_set1_epi8('\x7f');
+            while (end-p>=32) {
+                __m256i b=_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+                // Unsigned b<=max_ctl
+                __m256i m=_mm256_cmpeq_epi8(_mm256_min_epu8(b, ctl), b);
+                m=_mm256_andnot_si256(_mm256_cmpeq_epi8(b, ht), m);
+                m=_mm256_or_si256(m, _mm256_cmpeq_epi8(b, del));
+                uint32_t bits=static_cast<uint32_t>(_mm256_movemask_epi8(m));
+                if (bits) return p+__builtin_ctz(bits);
+                p+=32;
+            }
+            return p;
+        }
+
+        const char *avx2_skip_value(const char *p, const char *end) {
+            return scalar_skip_value(avx2_skip_ctl(p, end, '\x1f', true), end);
+        }
+
+        const char *avx2_skip_url(const char *p, const char *end) {
+            return scalar_skip_url(avx2_skip_ctl(p, end, ' ', false), end);
+        }
+
+        const scanner sse42_scanner={
+            parser_backend::SSE4_2,
+            &sse42_skip_name,
+            &sse42_skip_value,
+            &sse42_skip_url,
+        };
+
+        // Header names are short, PCMPESTRI handles them better
+        const scanner avx2_scanner={
+            parser_backend::AVX2,
+            &sse42_skip_name,
+            &avx2_skip_value,
+            &avx2_skip_url,
+        };
+#endif
+
+        bool cpu_supports(parser_backend b) {
+#ifdef FIBIO_HTTP_X86_SIMD
+            __builtin_cpu_init();
+            switch (b) {
+                case parser_backend::SSE4_2:
+                    return __builtin_cpu_supports("sse4.2");
+                case parser_backend::AVX2:
+                    return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("avx2");
+                default:
+                    break;
+            }
+#endif
+            return b==parser_backend::HTTP_PARSER;
+        }
+
+        // Returns nullptr for HTTP_PARSER or unsupported backend
+        const scanner *scanner_for(parser_backend b) {
+#ifdef FIBIO_HTTP_X86_SIMD
+            switch (b) {
+                case parser_backend::AUTO:
+                    if (cpu_supports(parser_backend::AVX2)) return &avx2_scanner;
+                    if (cpu_supports(parser_backend::SSE4_2)) return &sse42_scanner;
+                    break;
+                case parser_backend::SSE4_2:
+                    if (cpu_supports(b)) return &sse42_scanner;
+                    break;
+                case parser_backend::AVX2:
+                    if (cpu_supports(b)) return &avx2_scanner;
+                    break;
+                default:
+                    break;
+            }
+#endif
+            return nullptr;
+        }
+
+        std::atomic<const scanner *> &current_scanner() {
+            static std::atomic<const scanner *> s(scanner_for(parser_backend::AUTO));
+            return s;
+        }
+
+        enum class block_result {
+            complete,
+            incomplete,
+            fallback,
+        };
+
+        // Headers affecting message framing and connection management
+        struct header_flags {
+            bool connection_close=false;
+            bool connection_keep_alive=false;
+            bool has_content_length=false;
+            uint64_t content_length=0;
+        };
+
+        inline bool parse_content_length(const string_view &v, uint64_t &length) {
+            // Leave anything unusual to http_parser
+            if (v.empty() || v.size()>max_decimal_size-1) return false;
+            uint64_t n=0;
+            for (char c : v) {
+                if (c<'0' || c>'9') return false;
+                n=n*10+(c-'0');
+            }
+            length=n;
+            return true;
+        }
+
+        // Same rule as http_should_keep_alive, body is never read by the parser
+        inline bool should_keep_alive(http_version v, const header_flags &f) {
+            return (v==http_version::HTTP_1_1) ? !f.connection_close : f.connection_keep_alive;
+        }
+
+        inline block_result parse_crlf(const char *&p, const char *end) {
+            if (end-p<2) return block_result::incomplete;
+            if (p[0]!='\r' || p[1]!='\n') return block_result::fallback;
+            p+=2;
+            return block_result::complete;
+        }
+
+        block_result parse_headers(const scanner &s,
+                                   const char *&p,
+                                   const char *end,
+                                   header_view_map &headers,
+                                   header_flags &f)
+        {
+            while (true) {
+                if (p==end) return block_result::incomplete;
+                if (*p=='\r') {
+                    // End of header block
+                    return parse_crlf(p, end);
+                }
+                const char *name=p;
+                p=s.skip_name(p, end);
+                if (p==end) return block_result::incomplete;
+                // Empty name, whitespace before ':' and obs-fold all go here
+                if (*p!=':' || p==name) return block_result::fallback;
+                string_view n(name, p-name);
+                ++p;
+                while (p<end && (*p==' ' || *p=='\t')) ++p;
+                const char *value=p;
+                p=s.skip_value(p, end);
+                if (p==end) return block_result::incomplete;
+                const char *value_end=p;
+                if (value_end>value && (value_end[-1]==' ' || value_end[-1]=='\t')) {
+                    // Trailing whitespace
+                    return block_result::fallback;
+                }
+                block_result r=parse_crlf(p, end);
+                if (r!=block_result::complete) return r;
+
+                auto i=headers.emplace(n, string_view(value, value_end-value));
+                header_id id=i->id;
+                if (id==header_id::UNKNOWN && iequal()(n, string_view("Proxy-Connection"))) {
+                    // http_parser treats it as Connection
+                    id=header_id::CONNECTION;
+                }
+                switch (id) {
+                    case header_id::CONTENT_LENGTH:
+                        if (f.has_content_length || !parse_content_length(i->second, f.content_length)) {
+                            return block_result::fallback;
+                        }
+                        f.has_content_length=true;
+                        break;
+                    case header_id::CONNECTION:
+                        if (iequal()(i->second, string_view("close"))) {
+                            f.connection_close=true;
+                        } else if (iequal()(i->second, string_view("keep-alive"))) {
+                            f.connection_keep_alive=true;
+                        }
+                        break;
+                    case header_id::TRANSFER_ENCODING:
+                    case header_id::UPGRADE:
+                        // Body framing and protocol switching are handled by http_parser
+                        return block_result::fallback;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        // "HTTP/1.0" or "HTTP/1.1"
+        inline bool parse_version(const char *p, http_version &v) {
+            if (std::memcmp(p, "HTTP/1.", 7)!=0) return false;
+            if (p[7]=='1') {
+                v=http_version::HTTP_1_1;
+            } else if (p[7]=='0') {
+                v=http_version::HTTP_1_0;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        inline http_method parse_method(const char *p, size_t size) {
+            for (size_t i=0; i<method_count; i++) {
+                if (method_names[i].size==size && std::memcmp(method_names[i].data, p, size)==0) {
+                    return static_cast<http_method>(i);
+                }
+            }
+            return http_method::INVALID;
+        }
+
+        block_result parse_request(const scanner &s, const char *&p, const char *end, request &req) {
+            req.clear();
+            // Method
+            const char *m=p;
+            while (p<end && *p>='A' && *p<='Z') ++p;
+            if (p==end) return block_result::incomplete;
+            if (*p!=' ' || p==m) return block_result::fallback;
+            req.method=parse_method(m, p-m);
+            switch (req.method) {
+                case http_method::INVALID:
+                case http_method::CONNECT:
+                case http_method::MSEARCH:
+                    // Authority form, "M-SEARCH", etc.
+                    return block_result::fallback;
+                default:
+                    break;
+            }
+            ++p;
+            // Request target, only origin form
+            const char *u=p;
+            p=s.skip_url(p, end);
+            if (p==end) return block_result::incomplete;
+            if (*p!=' ' || p==u || *u!='/') return block_result::fallback;
+            req.url_view=string_view(u, p-u);
+            ++p;
+            // Version
+            if (end-p<8) return block_result::incomplete;
+            if (!parse_version(p, req.version)) return block_result::fallback;
+            p+=8;
+            block_result r=parse_crlf(p, end);
+            if (r!=block_result::complete) return r;
+
+            header_flags f;
+            r=parse_headers(s, p, end, req.header_views, f);
+            if (r!=block_result::complete) return r;
+            req.keep_alive=should_keep_alive(req.version, f);
+            req.content_length=f.content_length;
+            return block_result::complete;
+        }
+
+        block_result parse_response(const scanner &s, const char *&p, const char *end, response &resp) {
+            resp.clear();
+            // "HTTP/1.x 200 "
+            if (end-p<13) return block_result::incomplete;
+            if (!parse_version(p, resp.version) || p[8]!=' ' || p[12]!=' ') return block_result::fallback;
+            unsigned code=0;
+            for (int i=9; i<12; i++) {
+                if (p[i]<'0' || p[i]>'9') return block_result::fallback;
+                code=code*10+(p[i]-'0');
+            }
+            resp.status_code=static_cast<http_status_code>(code);
+            p+=13;
+            // Reason phrase
+            const char *msg=p;
+            p=s.skip_value(p, end);
+            if (p==end) return block_result::incomplete;
+            const char *msg_end=p;
+            block_result r=parse_crlf(p, end);
+            if (r!=block_result::complete) return r;
+
+            header_flags f;
+            r=parse_headers(s, p, end, resp.header_views, f);
+            if (r!=block_result::complete) return r;
+            // Status message is short, always keep a copy
+            resp.status_message.assign(msg, msg_end-msg);
+            resp.keep_alive=should_keep_alive(resp.version, f);
+            resp.content_length=f.content_length;
+            return block_result::complete;
+        }
+
+        // Look for an empty line, scanned is the size already searched
+        inline bool has_empty_line(const char *data, size_t size, size_t &scanned) {
+            const char *end=data+size;
+            const char *p=data+(scanned>2 ? scanned-2 : 0);
+            scanned=size;
+            while ((p=static_cast<const char *>(std::memchr(p, '\n', end-p)))!=nullptr) {
+                ++p;
+                if (p<end && *p=='\n') return true;
+                if (end-p>=2 && p[0]=='\r' && p[1]=='\n') return true;
+            }
+            return false;
+        }
+
+        template<typename Message>
+        simd_parse_result read_header(input_buffer &buf,
+                                      Message &m,
+                                      block_result (*parse)(const scanner &, const char *&, const char *, Message &))
+        {
+            const scanner *s=current_scanner().load(std::memory_order_relaxed);
+            if (!s) return simd_parse_result::fallback;
+            // Previous header block is not needed anymore, new one starts at the beginning
+            buf.unpin();
+
+            size_t scanned=0;
+            while (true) {
+                // Only parse complete header block, so a slowly arriving header is not re-parsed
+                // again and again, everything is re-parsed anyway if buffered data is moved
+                if (buf.size()>0 && has_empty_line(buf.data(), buf.size(), scanned)) {
+                    const char *p=buf.data();
+                    if (parse(*s, p, buf.data()+buf.size(), m)!=block_result::complete) {
+                        return simd_parse_result::fallback;
+                    }
+                    // Keep header block in the buffer while the body is being read
+                    buf.consume(p-buf.data());
+                    buf.pin();
+                    return simd_parse_result::complete;
+                }
+                if (buf.fill()==0) {
+                    // Let http_parser decide what to do with buffered data
+                    return buf.size()>0 ? simd_parse_result::fallback : simd_parse_result::failed;
+                }
+            }
+        }
+    }   // End of namespace fibio::http::common::detail::simd
+
+    bool simd_parser_enabled() {
+        return simd::current_scanner().load(std::memory_order_relaxed)!=nullptr;
+    }
+
+    simd_parse_result simd_read_header(input_buffer &buf, request &req) {
+        return simd::read_header(buf, req, &simd::parse_request);
+    }
+
+    simd_parse_result simd_read_header(input_buffer &buf, response &resp) {
+        return simd::read_header(buf, resp, &simd::parse_response);
+    }
+}   // End of namespace fibio::http::common::detail
+
+    bool parser_backend_supported(parser_backend b) {
+        return b==parser_backend::AUTO
+            || b==parser_backend::HTTP_PARSER
+            || detail::simd::scanner_for(b)!=nullptr;
+    }
+
+    bool set_parser_backend(parser_backend b) {
+        if (!parser_backend_supported(b)) return false;
+        detail::simd::current_scanner().store(detail::simd::scanner_for(b));
+        return true;
+    }
+
+    parser_backend get_parser_backend() {
+        const detail::simd::scanner *s=detail::simd::current_scanner().load();
+        return s ? s->backend : parser_backend::HTTP_PARSER;
+    }
+}}} // End of namespace fibio::http::common
@@ -0,0 +1,31 @@
+//
+//  simd_parser.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/23.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_simd_parser_hpp
+#define fibio_http_simd_parser_hpp
+
+#include <fibio/http/common/request.hpp>
+#include <fibio/http/common/response.hpp>
+#include <fibio/http/common/input_buffer.hpp>
+#include <fibio/http/common/parser_backend.hpp>
+
+namespace fibio { namespace http { namespace common { namespace detail {
+    enum class simd_parse_result {
+        complete,   // Header block is parsed and pinned in the buffer
+        failed,     // Connection closed or header block is too large
+        fallback,   // Let http_parser parse buffered data
+    };
+
+    // SIMD backend is selected
+    bool simd_parser_enabled();
+
+    simd_parse_result simd_read_header(input_buffer &buf, request &req);
+    simd_parse_result simd_read_header(input_buffer &buf, response &resp);
+}}}}    // End of namespace fibio::http::common::detail
+
+#endif
@@ -0,0 +1,399 @@
+//
+//  static_cache.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/28.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#   include <sys/inotify.h>
+#endif
+#include <fibio/mutex.hpp>
+#include <fibio/http/common/content_type.hpp>
+#include <fibio/http/server/static_cache.hpp>
+#include "http_tokens.hpp"
+
+namespace fibio { namespace http {
+    namespace detail {
+        // Pending invalidations are picked up at most this late
+        constexpr std::chrono::milliseconds CACHE_CHECK_INTERVAL(100);
+
+        inline void append_hex(std::string &buf, uint64_t v) {
+            char tmp[16];
+            char *p=tmp+16;
+            do {
+                *--p="0123456789abcdef"[v & 0xF];
+                v>>=4;
+            } while (v);
+            buf.append(p, tmp+16-p);
+        }
+
+        inline int64_t now_ms() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        inline uint64_t mtime_ns(const struct stat &st) {
+#ifdef __APPLE__
+            return uint64_t(st.st_mtimespec.tv_sec)*1000000000u+st.st_mtimespec.tv_nsec;
+#else
+            return uint64_t(st.st_mtim.tv_sec)*1000000000u+st.st_mtim.tv_nsec;
+#endif
+        }
+
+        // Read whole file, fails if it's shorter than expected
+        inline bool read_all(int fd, char *p, size_t size) {
+            off_t offset=0;
+            while (size_t(offset)<size) {
+                ssize_t n=::pread(fd, p+offset, size-offset, offset);
+                if (n<0 && errno==EINTR) continue;
+                if (n<=0) return false;
+                offset+=n;
+            }
+            return true;
+        }
+
+        static_cache::asset_ptr load_asset(const std::string &path, size_t max_file_size, size_t min_mapped_size) {
+            int fd=::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd<0) return static_cache::asset_ptr();
+            struct stat st;
+            if (::fstat(fd, &st)!=0 || !S_ISREG(st.st_mode) || size_t(st.st_size)>max_file_size) {
+                ::close(fd);
+                return static_cache::asset_ptr();
+            }
+            std::shared_ptr<static_cache::asset> a(new static_cache::asset);
+            if (size_t(st.st_size)>=min_mapped_size && st.st_size>0) {
+                void *p=::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p==MAP_FAILED) {
+                    ::close(fd);
+                    return static_cache::asset_ptr();
+                }
+                a->data=static_cast<const char *>(p);
+                a->size=st.st_size;
+                // Kept open to tell if the file is truncated in place
+                a->fd=fd;
+            } else {
+                if (st.st_size>0) {
+                    a->owned.reset(new char[st.st_size]);
+                    if (!read_all(fd, a->owned.get(), st.st_size)) {
+                        ::close(fd);
+                        return static_cache::asset_ptr();
+                    }
+                    a->data=a->owned.get();
+                    a->size=st.st_size;
+                }
+                ::close(fd);
+            }
+            a->path=path;
+            a->last_modified=st.st_mtime;
+            a->etag.push_back('"');
+            if (a->fd>=0) {
+                // Hashing would fault the whole mapping in, file identity, size and
+                // modification time tell versions apart instead
+                append_hex(a->etag, st.st_ino);
+                a->etag.push_back('-');
+                append_hex(a->etag, a->size);
+                a->etag.push_back('-');
+                append_hex(a->etag, mtime_ns(st));
+            } else {
+                append_hex(a->etag, common::detail::fnv1a_64(a->data, a->size));
+                a->etag.push_back('-');
+                append_hex(a->etag, a->size);
+            }
+            a->etag.push_back('"');
+
+            namespace tokens=common::detail;
+            std::string &h=a->headers;
+            h.append("Content-Type: ");
+            h.append(common::content_type_by_extension(path));
+            h.append(tokens::crlf.data, tokens::crlf.size);
+            h.append(tokens::accept_ranges_bytes_line.data, tokens::accept_ranges_bytes_line.size);
+            h.append("ETag: ");
+            h.append(a->etag);
+            h.append(tokens::crlf.data, tokens::crlf.size);
+            char date[64];
+            h.append("Last-Modified: ");
+            h.append(date, tokens::format_http_date(a->last_modified, date));
+            h.append(tokens::crlf.data, tokens::crlf.size);
+            return a;
+        }
+
+        // Weak comparison, as required for If-None-Match
+        inline bool etag_matches(const string_view &list, const std::string &etag) {
+            string_view tag(etag);
+            const char *p=list.begin();
+            const char *e=list.end();
+            while (p<e) {
+                while (p<e && (*p==' ' || *p=='\t' || *p==',')) p++;
+                if (p==e) break;
+                if (*p=='*') return true;
+                if (e-p>2 && p[0]=='W' && p[1]=='/') p+=2;
+                if (*p!='"') return false;
+                const char *q=std::find(p+1, e, '"');
+                if (q==e) return false;
+                if (string_view(p, q+1-p)==tag) return true;
+                p=q+1;
+            }
+            return false;
+        }
+    }   // End of namespace detail
+
+    static_cache::asset::~asset() {
+        if (fd>=0) {
+            ::munmap(const_cast<char *>(data), size);
+            ::close(fd);
+        }
+    }
+
+    struct static_cache::impl {
+        typedef std::list<asset_ptr> lru_type;
+
+        struct entry {
+            lru_type::iterator lru;
+            int wd;
+            // Last time the file was checked, only used without inotify
+            int64_t checked_ms;
+        };
+
+        impl(size_t budget, size_t max_file_size, size_t min_mapped_size)
+        : budget_(budget)
+        , max_file_size_(std::min(budget, max_file_size))
+        , min_mapped_size_(min_mapped_size)
+        {
+#ifdef __linux__
+            inotify_fd_=::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+        }
+
+        ~impl() {
+            if (inotify_fd_>=0) ::close(inotify_fd_);
+        }
+
+        // Called with mtx_ held
+        void erase(std::unordered_map<std::string, entry>::iterator i) {
+#ifdef __linux__
+            if (i->second.wd>=0) {
+                ::inotify_rm_watch(inotify_fd_, i->second.wd);
+                watches_.erase(i->second.wd);
+            }
+#endif
+            memory_usage_-=cost(**i->second.lru);
+            lru_.erase(i->second.lru);
+            entries_.erase(i);
+        }
+
+        static size_t cost(const asset &a) {
+            return a.size+a.path.size()+a.etag.size()+a.headers.size()+sizeof(asset);
+        }
+
+        // Drain inotify events, at most once per interval and by one thread at a time
+        void poll() {
+#ifdef __linux__
+            if (inotify_fd_<0) return;
+            int64_t now=detail::now_ms();
+            int64_t next=next_poll_ms_.load(std::memory_order_relaxed);
+            if (now<next || !next_poll_ms_.compare_exchange_strong(next, now+detail::CACHE_CHECK_INTERVAL.count())) return;
+            alignas(struct inotify_event) char buf[4096];
+            for (;;) {
+                ssize_t n=::read(inotify_fd_, buf, sizeof(buf));
+                if (n<0 && errno==EINTR) continue;
+                if (n<=0) break;
+                std::lock_guard<mutex> lock(mtx_);
+                for (char *p=buf; p<buf+n; ) {
+                    const struct inotify_event *ev=reinterpret_cast<const struct inotify_event *>(p);
+                    p+=sizeof(struct inotify_event)+ev->len;
+                    auto w=watches_.find(ev->wd);
+                    if (w==watches_.end()) continue;
+                    auto i=entries_.find(w->second);
+                    if (ev->mask & IN_IGNORED) {
+                        // Watch is already gone
+                        watches_.erase(w);
+                        if (i!=entries_.end()) i->second.wd=-1;
+                    }
+                    if (i!=entries_.end()) {
+                        erase(i);
+                        stats_.invalidations++;
+                    }
+                }
+            }
+#endif
+        }
+
+        // Without inotify, mtime and size of a hit are checked once per interval,
+        // called with mtx_ held
+        bool path_check_due(entry &e) {
+            if (inotify_fd_>=0) return false;
+            int64_t now=detail::now_ms();
+            if (now-e.checked_ms<detail::CACHE_CHECK_INTERVAL.count()) return false;
+            e.checked_ms=now;
+            return true;
+        }
+
+        // Size of a mapped file is always checked, reading a truncated mapping faults
+        static bool changed(const asset &a, bool check_path) {
+            struct stat st;
+            if (a.fd>=0 && (::fstat(a.fd, &st)!=0 || size_t(st.st_size)!=a.size)) return true;
+            if (!check_path) return false;
+            return ::stat(a.path.c_str(), &st)!=0 || st.st_mtime!=a.last_modified || size_t(st.st_size)!=a.size;
+        }
+
+        // Called with mtx_ held
+        void touch(const std::string &path, const asset_ptr &a) {
+            stats_.hits++;
+            auto i=entries_.find(path);
+            // Unless it's been replaced meanwhile
+            if (i!=entries_.end() && *i->second.lru==a) lru_.splice(lru_.begin(), lru_, i->second.lru);
+        }
+
+        asset_ptr get(const std::string &path) {
+            poll();
+            asset_ptr cached;
+            bool check_path=false;
+            {
+                std::lock_guard<mutex> lock(mtx_);
+                auto i=entries_.find(path);
+                if (i!=entries_.end()) {
+                    cached=*i->second.lru;
+                    check_path=path_check_due(i->second);
+                    if (cached->fd<0 && !check_path) {
+                        touch(path, cached);
+                        return cached;
+                    }
+                }
+            }
+            // The file is checked without blocking other lookups, the asset held
+            // keeps its fd open
+            bool stale=cached && changed(*cached, check_path);
+            {
+                std::lock_guard<mutex> lock(mtx_);
+                if (cached && !stale) {
+                    touch(path, cached);
+                    return cached;
+                }
+                if (cached) {
+                    auto i=entries_.find(path);
+                    if (i!=entries_.end() && *i->second.lru==cached) {
+                        erase(i);
+                        stats_.invalidations++;
+                    }
+                }
+                stats_.misses++;
+            }
+            // Don't block other lookups while loading
+            asset_ptr a=detail::load_asset(path, max_file_size_, min_mapped_size_);
+            if (!a) return a;
+            std::lock_guard<mutex> lock(mtx_);
+            auto i=entries_.find(path);
+            if (i!=entries_.end()) {
+                // Loaded by someone else meanwhile
+                return *i->second.lru;
+            }
+            entry e;
+            e.wd=-1;
+            e.checked_ms=detail::now_ms();
+#ifdef __linux__
+            if (inotify_fd_>=0) {
+                e.wd=::inotify_add_watch(inotify_fd_, path.c_str(), IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+                // Don't cache what we can't invalidate
+                if (e.wd<0) return a;
+                auto w=watches_.find(e.wd);
+                if (w!=watches_.end()) {
+                    // Same file under another path, one entry per watch
+                    auto j=entries_.find(w->second);
+                    if (j!=entries_.end()) {
+                        j->second.wd=-1;
+                        erase(j);
+                    }
+                }
+                watches_[e.wd]=path;
+            }
+#endif
+            lru_.push_front(a);
+            e.lru=lru_.begin();
+            entries_.emplace(path, e);
+            memory_usage_+=cost(*a);
+            while (memory_usage_>budget_ && lru_.size()>1) {
+                erase(entries_.find(lru_.back()->path));
+                stats_.evictions++;
+            }
+            return a;
+        }
+
+        mutable mutex mtx_;
+        size_t budget_;
+        size_t max_file_size_;
+        size_t min_mapped_size_;
+        size_t memory_usage_=0;
+        // Most recently used first
+        lru_type lru_;
+        std::unordered_map<std::string, entry> entries_;
+        std::unordered_map<int, std::string> watches_;
+        int inotify_fd_=-1;
+        std::atomic<int64_t> next_poll_ms_{0};
+        stats stats_;
+    };
+
+    static_cache::static_cache(size_t memory_budget, size_t max_file_size, size_t min_mapped_size)
+    : impl_(new impl(memory_budget, max_file_size, min_mapped_size))
+    {}
+
+    static_cache::~static_cache()=default;
+
+    static_cache::asset_ptr static_cache::get(const std::string &path) {
+        return impl_->get(path);
+    }
+
+    void static_cache::invalidate(const std::string &path) {
+        std::lock_guard<mutex> lock(impl_->mtx_);
+        auto i=impl_->entries_.find(path);
+        if (i!=impl_->entries_.end()) {
+            impl_->erase(i);
+            impl_->stats_.invalidations++;
+        }
+    }
+
+    static_cache::stats static_cache::get_stats() const {
+        std::lock_guard<mutex> lock(impl_->mtx_);
+        stats s=impl_->stats_;
+        s.memory_usage=impl_->memory_usage_;
+        s.entries=impl_->entries_.size();
+        return s;
+    }
+
+    bool not_modified(server::request &req, const static_cache::asset &a) {
+        // If-None-Match takes precedence
+        auto i=req.header_views.find(common::header_id::IF_NONE_MATCH);
+        if (i!=req.header_views.end()) return detail::etag_matches(i->second, a.etag);
+        i=req.header_views.find(common::header_id::IF_MODIFIED_SINCE);
+        std::time_t t;
+        return i!=req.header_views.end()
+            && common::detail::parse_http_date(i->second, t)
+            && a.last_modified<=t;
+    }
+
+    bool cached_file_handler::operator()(server::request &req,
+                                         server::response &resp,
+                                         server::connection &conn) const
+    {
+        std::string path;
+        resp.status_code=files.map_path(req, path);
+        if (resp.status_code!=http_status_code::OK) return true;
+        static_cache::asset_ptr a=cache->get(path);
+        if (!a) return files(req, resp, conn);
+        // A 304 never sends the body, it's kept so compression gives the same
+        // ETag and Vary as it would to a 200, only validators are sent
+        if (not_modified(req, *a)) resp.status_code=http_status_code::NOT_MODIFIED;
+        resp.set_static_body(a, string_view(a->data, a->size), a->headers);
+        return true;
+    }
+}}  // End of namespace fibio::http
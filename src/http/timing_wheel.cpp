@@ -0,0 +1,96 @@
+//
+//  timing_wheel.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/27.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <algorithm>
+#include "timing_wheel.hpp"
+
+namespace fibio { namespace http { namespace detail {
+    timing_wheel::timing_wheel(duration tick)
+    : tick_(std::max(tick, duration(1)))
+    , start_(clock_type::now())
+    {
+        for (auto &level : slots_) {
+            for (auto &head : level) {
+                head.prev=head.next=&head;
+            }
+        }
+    }
+
+    void timing_wheel::schedule(entry &e, duration timeout) {
+        // Round up, an entry never expires early
+        uint64_t ticks=(std::max(timeout, duration(0)).count()+tick_.count()-1)/tick_.count();
+        std::lock_guard<mutex> lock(mtx_);
+        unlink(e);
+        e.expiry_=current_+std::min(std::max(ticks, uint64_t(1)), MAX_TICKS);
+        insert(e);
+    }
+
+    void timing_wheel::cancel(entry &e) {
+        std::lock_guard<mutex> lock(mtx_);
+        unlink(e);
+    }
+
+    size_t timing_wheel::advance(clock_type::time_point now) {
+        uint64_t target=(now-start_)/tick_;
+        size_t n=0;
+        std::lock_guard<mutex> lock(mtx_);
+        while (current_<target) {
+            current_++;
+            // Move entries from upper levels when lower level wraps around
+            for (unsigned level=1; level<LEVELS; level++) {
+                if ((current_ & ((uint64_t(1)<<(LEVEL_BITS*level))-1))!=0) break;
+                cascade(level);
+            }
+            link &head=slots_[0][current_ & (SLOTS-1)];
+            while (head.next!=&head) {
+                entry &e=static_cast<entry &>(*head.next);
+                unlink(e);
+                e.expire();
+                n++;
+            }
+        }
+        return n;
+    }
+
+    void timing_wheel::unlink(link &l) {
+        if (!l.prev) return;
+        l.prev->next=l.next;
+        l.next->prev=l.prev;
+        l.prev=l.next=nullptr;
+    }
+
+    void timing_wheel::insert(entry &e) {
+        uint64_t delta=e.expiry_>current_ ? e.expiry_-current_ : 0;
+        unsigned level=0;
+        while (level+1<LEVELS && delta>=(uint64_t(1)<<(LEVEL_BITS*(level+1)))) level++;
+        // Due entries go to current slot, which is handled right after cascading
+        uint64_t expiry=std::max(e.expiry_, current_);
+        link &head=slots_[level][(expiry>>(LEVEL_BITS*level)) & (SLOTS-1)];
+        e.prev=head.prev;
+        e.next=&head;
+        head.prev->next=&e;
+        head.prev=&e;
+    }
+
+    void timing_wheel::cascade(unsigned level) {
+        link &head=slots_[level][(current_>>(LEVEL_BITS*level)) & (SLOTS-1)];
+        // Detach the whole list first, entries may be re-inserted into the same slot
+        link pending;
+        if (head.next==&head) return;
+        pending.next=head.next;
+        pending.prev=head.prev;
+        pending.next->prev=&pending;
+        pending.prev->next=&pending;
+        head.prev=head.next=&head;
+        while (pending.next!=&pending) {
+            entry &e=static_cast<entry &>(*pending.next);
+            unlink(e);
+            insert(e);
+        }
+    }
+}}} // End of namespace fibio::http::detail
@@ -0,0 +1,81 @@
+//
+//  timing_wheel.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/27.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_timing_wheel_hpp
+#define fibio_http_timing_wheel_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <fibio/mutex.hpp>
+
+namespace fibio { namespace http { namespace detail {
+    /**
+     * Hierarchical timing wheel
+     *
+     * Deadlines are kept in intrusive lists, scheduling and cancelling are O(1),
+     * far deadlines are cascaded to lower levels as the wheel turns, entries
+     * expired in one tick are handled as a batch.
+     */
+    struct timing_wheel {
+        typedef std::chrono::steady_clock clock_type;
+        typedef clock_type::duration duration;
+
+        struct link {
+            link *prev=nullptr;
+            link *next=nullptr;
+        };
+
+        struct entry : link {
+            // Called by advance() with the wheel locked, may run on any thread,
+            // must not block or release anything its owner may still be using
+            virtual void expire()=0;
+        protected:
+            ~entry()=default;
+            // In ticks
+            uint64_t expiry_=0;
+            friend struct timing_wheel;
+        };
+
+        explicit timing_wheel(duration tick=std::chrono::milliseconds(100));
+
+        timing_wheel(const timing_wheel &)=delete;
+        timing_wheel &operator=(const timing_wheel &)=delete;
+
+        duration tick() const { return tick_; }
+
+        // (Re)schedule e to expire after timeout
+        void schedule(entry &e, duration timeout);
+
+        // No-op if e is not scheduled
+        void cancel(entry &e);
+
+        // Expire all entries due up to now, returns number of expired entries
+        size_t advance(clock_type::time_point now=clock_type::now());
+
+    private:
+        static constexpr unsigned LEVEL_BITS=6;
+        static constexpr unsigned SLOTS=1u<<LEVEL_BITS;
+        static constexpr unsigned LEVELS=4;
+        static constexpr uint64_t MAX_TICKS=(uint64_t(1)<<(LEVEL_BITS*LEVELS))-1;
+
+        static void unlink(link &l);
+        void insert(entry &e);
+        void cascade(unsigned level);
+
+        mutex mtx_;
+        duration tick_;
+        clock_type::time_point start_;
+        uint64_t current_=0;
+        // Circular lists with sentinel heads
+        link slots_[LEVELS][SLOTS];
+    };
+}}} // End of namespace fibio::http::detail
+
+#endif
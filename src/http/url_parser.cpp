@@ -6,78 +6,79 @@
 //  Copyright (c) 2014 0d0a.com. All rights reserved.
 //
 
-#include <list>
-#include <string>
-#include <boost/algorithm/string.hpp>
-#include <boost/algorithm/string/split.hpp>
-#include <boost/range/iterator_range.hpp>
-#include <iostream>
+#include <iterator>
+#include <algorithm>
 #include <fibio/http/common/url_codec.hpp>
 #include "url_parser.hpp"
 
 namespace fibio { namespace http { namespace common {
-    typedef std::string::const_iterator string_iter;
-    typedef boost::iterator_range<string_iter> string_view;
-    typedef std::list<string_view> range_list;
-
-    inline bool is_dot(const string_view &s) {
-        return (s.end()-s.begin()==1) && (*(s.begin())=='.');
-    }
-    
-    inline bool is_dot_dot(const string_view &s) {
-        return (s.end()-s.begin()==2) && (*(s.begin())=='.') && (*(s.begin()+1)=='.');
-    }
-    
-    bool parse_path_components(const std::string &p, std::list<std::string> &components) {
-        std::string path;
-        path.reserve(p.length());
-        url_decode(p.begin(), p.end(), std::back_insert_iterator<std::string>(path));
-        //range_list r;
-        std::list<std::string> r;
-        boost::split(r, path, boost::is_any_of("/"), boost::token_compress_on);
+    namespace detail {
+        inline bool is_dot(const string_view &s) {
+            return s.size()==1 && s[0]=='.';
+        }
+        
+        inline bool is_dot_dot(const string_view &s) {
+            return s.size()==2 && s[0]=='.' && s[1]=='.';
+        }
         
-        for (auto &i : r) {
-            if (i.empty()) {
-                continue;
+        // Call fn on each non-empty piece separated by sep, stop if fn returns false
+        template<typename Fn>
+        bool for_each_piece(const string_view &s, char sep, Fn fn) {
+            const char *p=s.begin();
+            const char *e=s.end();
+            while (p<e) {
+                const char *q=std::find(p, e, sep);
+                if (q>p && !fn(string_view(p, q-p))) return false;
+                if (q==e) break;
+                p=q+1;
             }
-            if (is_dot_dot(i)) {
+            return true;
+        }
+    }   // End of namespace detail
+    
+    template<typename Components>
+    bool parse_path_components(const string_view &p, Components &components) {
+        typename Components::value_type path(components.get_allocator());
+        path.reserve(p.size());
+        url_decode(p.begin(), p.end(), std::back_inserter(path));
+        return detail::for_each_piece(string_view(path.data(), path.size()), '/', [&](const string_view &i){
+            if (detail::is_dot_dot(i)) {
                 if (components.empty()) {
                     // ERROR: out of root directory
                     return false;
                 }
                 components.pop_back();
-            } else if (!is_dot(i)) {
+            } else if (!detail::is_dot(i)) {
                 // Skip '.'
                 components.emplace_back(i.begin(), i.end());
             }
-        }
-        return true;
+            return true;
+        });
     }
     
-    bool parse_query_string(const std::string &query, std::map<std::string, std::string> &parameters) {
-        range_list r;
-        boost::split(r, query, boost::is_any_of("&"), boost::token_compress_on);
-        
-        for (auto &i : r) {
-            if (i.empty()) {
-                continue;
-            }
+    template<typename Parameters>
+    bool parse_query_string(const string_view &query, Parameters &parameters) {
+        return detail::for_each_piece(query, '&', [&](const string_view &i){
             auto eq=std::find(i.begin(), i.end(), '=');
             if (eq==i.begin()) {
                 // Invalid format "=XXX"
                 return false;
             }
-            std::string key;
+            typename Parameters::key_type key(parameters.get_allocator());
+            typename Parameters::mapped_type value(parameters.get_allocator());
             key.reserve(eq-i.begin());
-            std::string value;
-            url_decode(i.begin(), eq, std::back_insert_iterator<std::string>(key));
+            url_decode(i.begin(), eq, std::back_inserter(key));
             if (eq!=i.end()) {
                 ++eq;
                 value.reserve(i.end()-eq);
-                url_decode(eq, i.end(), std::back_insert_iterator<std::string>(value));
+                url_decode(eq, i.end(), std::back_inserter(value));
             }
-            parameters.insert({std::move(key), std::move(value)});
-        }
-        return true;
+            parameters.emplace(std::move(key), std::move(value));
+            return true;
+        });
     }
-}}} // End of namespace fibio::http::common
\ No newline at end of file
+    
+    template bool parse_path_components(const string_view &, std::list<std::string> &);
+    template bool parse_path_components(const string_view &, arena_string_list &);
+    template bool parse_query_string(const string_view &, arena_string_map &);
+}}} // End of namespace fibio::http::common
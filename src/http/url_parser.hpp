@@ -9,13 +9,23 @@
 #ifndef fibio_http_url_parser_hpp
 #define fibio_http_url_parser_hpp
 
-#include <map>
 #include <list>
 #include <string>
+#include <fibio/http/common/common_types.hpp>
+#include <fibio/http/common/arena.hpp>
 
 namespace fibio { namespace http { namespace common {
-    bool parse_path_components(const std::string &path, std::list<std::string> &components);
-    bool parse_query_string(const std::string &query, std::map<std::string, std::string> &parameters);
+    /**
+     * Components and decoded strings are allocated with the allocator of the container,
+     * so they come from the arena if the container uses one
+     *
+     * Instantiated for std::list<std::string>, arena_string_list and arena_string_map
+     */
+    template<typename Components>
+    bool parse_path_components(const string_view &path, Components &components);
+    
+    template<typename Parameters>
+    bool parse_query_string(const string_view &query, Parameters &parameters);
 }}} // End of namespace fibio::http::common
 
 #endif /* defined(fibio_http_url_parser_hpp) */
@@ -0,0 +1,94 @@
+//
+//  bench_chunked_body.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/31.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <fibio/http/common/input_buffer.hpp>
+#include <fibio/http/common/chunked_stream.hpp>
+
+using namespace fibio::http::common;
+
+/**
+ * Endless source of an encoded body, same block of chunks is handed out again and
+ * again, so a multi-GB body needs no memory
+ */
+struct chunked_source : std::streambuf {
+    chunked_source(size_t chunk_size, uint64_t total) {
+        char size_line[32];
+        snprintf(size_line, sizeof(size_line), "%zx\r\n", chunk_size);
+        // Keep the block around 1MB, it's read in large pieces like a socket would give
+        size_t chunks=std::max<size_t>(1, (1<<20)/chunk_size);
+        for (size_t n=0; n<chunks; n++) {
+            block_.append(size_line);
+            block_.append(chunk_size, 'x');
+            block_.append("\r\n");
+        }
+        blocks_=std::max<uint64_t>(1, total/(chunks*chunk_size));
+        body_size_=blocks_*chunks*chunk_size;
+    }
+
+    // Decoded size of the whole body
+    uint64_t body_size() const { return body_size_; }
+
+protected:
+    virtual int_type underflow() override {
+        if (blocks_>0) {
+            blocks_--;
+            char *p=const_cast<char *>(block_.data());
+            setg(p, p, p+block_.size());
+        } else if (!last_sent_) {
+            last_sent_=true;
+            static char last_chunk[]="0\r\n\r\n";
+            setg(last_chunk, last_chunk, last_chunk+sizeof(last_chunk)-1);
+        } else {
+            return traits_type::eof();
+        }
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::string block_;
+    uint64_t blocks_;
+    uint64_t body_size_;
+    bool last_sent_=false;
+};
+
+// Decode a chunked body of given size (MB, default 4096) and chunk size (bytes,
+// default 16384), prints decoding throughput
+int main(int argc, char *argv[]) {
+    uint64_t total=((argc>1) ? std::strtoull(argv[1], nullptr, 10) : 4096)<<20;
+    size_t chunk_size=(argc>2) ? std::strtoul(argv[2], nullptr, 10) : 16384;
+    if (chunk_size==0) chunk_size=1;
+    chunked_source source(chunk_size, total);
+    uint64_t expected=source.body_size();
+    input_buffer buf(&source, DEFAULT_READ_BUFFER_SIZE, DEFAULT_MAX_READ_BUFFER_SIZE);
+    chunked_istreambuf decoder;
+    decoder.reset(&buf);
+    std::istream body(&decoder);
+    std::vector<char> out(65536);
+    uint64_t size=0;
+    auto start=std::chrono::steady_clock::now();
+    while (body.read(out.data(), out.size()) || body.gcount()>0) {
+        size+=body.gcount();
+    }
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    if (!decoder.done() || size!=expected) {
+        std::cerr << "decoded " << size << " bytes, expected " << expected << std::endl;
+        return 1;
+    }
+    std::cout << (size>>20) << "MB in " << chunk_size << " byte chunks: "
+              << seconds << "s, " << (size>>20)/seconds << "MB/s"
+              << std::endl;
+    return 0;
+}
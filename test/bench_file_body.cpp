@@ -0,0 +1,96 @@
+//
+//  bench_file_body.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/11/01.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fibio/fiber.hpp>
+#include <fibio/fiberize.hpp>
+#include <fibio/http/client/client.hpp>
+#include <fibio/http/server/server.hpp>
+#include <fibio/http/server/routing.hpp>
+
+using namespace fibio;
+using namespace fibio::http;
+
+// Buffered path, the whole file is copied into the response body
+bool buffered_handler(server::request &, server::response &resp, server::connection &) {
+    std::ifstream f("bench_file_body.bin", std::ios::binary);
+    if (!f) return false;
+    resp.set_content_type("application/octet-stream");
+    resp.body_stream() << f.rdbuf();
+    return true;
+}
+
+// Fetch url given times, prints the throughput, returns number of body bytes
+uint64_t fetch(client &c, const char *name, const std::string &url, size_t size, unsigned count) {
+    client::request req;
+    client::response resp;
+    std::vector<char> buf(65536);
+    uint64_t total=0;
+    auto start=std::chrono::steady_clock::now();
+    for (unsigned i=0; i<count; i++) {
+        if (!c.send_request(make_request(req, url), resp)
+            || resp.status_code!=http_status_code::OK)
+        {
+            std::cerr << name << ": request failed" << std::endl;
+            return 0;
+        }
+        while (resp.body_stream().read(buf.data(), buf.size()) || resp.body_stream().gcount()>0) {
+            total+=resp.body_stream().gcount();
+        }
+    }
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    std::cout << name << ": " << count << " x " << (size>>20) << "MB: "
+              << seconds << "s, " << (total>>20)/seconds << "MB/s"
+              << std::endl;
+    return total;
+}
+
+// Fetch a file of given size (MB, default 64) given times (default 32) from
+// file_handler and then from a handler copying it into the body, both over the
+// same keep-alive connection, prints the throughput of each
+int fibio::main(int argc, char *argv[]) {
+    size_t size=((argc>1) ? std::strtoul(argv[1], nullptr, 10) : 64)<<20;
+    unsigned count=(argc>2) ? std::strtoul(argv[2], nullptr, 10) : 32;
+    if (count==0) count=1;
+    {
+        std::ofstream f("bench_file_body.bin", std::ios::binary);
+        std::string block(1<<20, 'x');
+        for (size_t n=0; n<size; n+=block.size()) f.write(block.data(), std::min(block.size(), size-n));
+    }
+    server svr(server::settings{route({
+            {GET("/files/*"), file_handler{".", "/files"}},
+            {GET("/buffered"), buffered_handler},
+        }, stock_handler{http_status_code::NOT_FOUND}),
+        "127.0.0.1",
+        23471,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60),
+        2*count+1
+    });
+    svr.start();
+    client c;
+    if (c.connect("127.0.0.1", 23471)) {
+        std::cerr << "connect failed" << std::endl;
+        return 1;
+    }
+    uint64_t sendfile_total=fetch(c, "sendfile", "/files/bench_file_body.bin", size, count);
+    uint64_t buffered_total=fetch(c, "buffered", "/buffered", size, count);
+    c.disconnect();
+    svr.stop();
+    svr.join();
+    std::remove("bench_file_body.bin");
+    uint64_t expected=uint64_t(size)*count;
+    return (sendfile_total==expected && buffered_total==expected) ? 0 : 1;
+}
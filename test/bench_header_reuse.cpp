@@ -0,0 +1,105 @@
+//
+//  bench_header_reuse.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/25.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <iostream>
+#include <string>
+#include <fibio/fiber.hpp>
+#include <fibio/fiberize.hpp>
+#include <fibio/http/client/client.hpp>
+#include <fibio/http/server/server.hpp>
+
+using namespace fibio;
+using namespace fibio::http;
+
+// Every heap allocation in the process is counted
+static std::atomic<uint64_t> heap_allocations(0);
+
+void *operator new(size_t size) {
+    heap_allocations++;
+    if (void *p=std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+// A small page with a few headers, as a typical dynamic handler would send
+bool handler(server::request &req, server::response &resp, server::connection &) {
+    static const std::string page(4096, 'x');
+    resp.headers.insert({"Cache-Control", "no-cache"});
+    resp.headers.insert({"X-Request-Path", req.url_view.to_string()});
+    resp.set_body(page, "text/html");
+    return true;
+}
+
+/**
+ * Send n requests over one keep-alive connection, prints requests/s and heap
+ * allocations/request, client and server live in the same process so both
+ * sides are counted
+ */
+bool run(const char *name, unsigned short port, size_t high_water_mark, size_t n) {
+    server::settings s{handler,
+        "127.0.0.1",
+        port,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60),
+        unsigned(n+1)
+    };
+    s.high_water_mark=high_water_mark;
+    server svr(s);
+    svr.start();
+    client c;
+    if (c.connect("127.0.0.1", port)) {
+        std::cerr << name << ": connect failed" << std::endl;
+        return false;
+    }
+    client::request req;
+    client::response resp;
+    make_request(req, "/path/to/resource/index.html?a=1&b=2");
+    req.headers.insert({"User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/38.0 Safari/537.36"});
+    req.headers.insert({"Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8"});
+    req.headers.insert({"Accept-Language", "en-US,en;q=0.8"});
+    req.headers.insert({"Cookie", "session=0123456789abcdef0123456789abcdef; theme=dark"});
+    bool ok=true;
+    uint64_t allocations=heap_allocations;
+    auto start=std::chrono::steady_clock::now();
+    for (size_t i=0; i<n; i++) {
+        if (!c.send_request(req, resp) || resp.status_code!=http_status_code::OK) {
+            std::cerr << name << ": request failed" << std::endl;
+            ok=false;
+            break;
+        }
+        resp.body_stream().ignore(resp.content_length);
+    }
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    if (ok) {
+        std::cout << name << ": "
+                  << n/seconds << " requests/s, "
+                  << double(heap_allocations-allocations)/n << " heap allocations/request"
+                  << std::endl;
+    }
+    c.disconnect();
+    svr.stop();
+    svr.join();
+    return ok;
+}
+
+// Keep-alive request loop, first with storage kept up to the default high water
+// mark, then with a mark of 0, which releases all storage after each request
+int fibio::main(int argc, char *argv[]) {
+    size_t n=(argc>1) ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    if (n==0) n=1;
+    bool ok=run("reused", 23472, DEFAULT_HIGH_WATER_MARK, n);
+    ok=run("released", 23473, 0, n) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+//
+//  bench_multipart.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/11/02.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fibio/http/server/multipart.hpp>
+
+using namespace fibio::http;
+
+static const std::string boundary="----fibio-bench-boundary";
+static const std::string field_value="value";
+
+// File content has near misses of the delimiter so the search can't skip far
+std::string file_content(size_t size) {
+    static const std::string pattern="some file content\r\n------fibio-bench\r\n--";
+    std::string s;
+    s.reserve(size);
+    while (s.size()<size) s.append(pattern, 0, std::min(pattern.size(), size-s.size()));
+    return s;
+}
+
+// Read all parts of the body given times, part content goes to files if spool is set
+void run(const char *name, const std::string &body, size_t file_size, unsigned count, bool spool) {
+    std::vector<char> buf(65536);
+    std::chrono::steady_clock::duration elapsed(0);
+    for (unsigned i=0; i<count; i++) {
+        // Copying the body in is not timed
+        std::istringstream is(body);
+        auto start=std::chrono::steady_clock::now();
+        multipart_reader reader(is, boundary);
+        multipart_reader::part p;
+        uint64_t size=0;
+        while (reader.next(p)) {
+            if (spool && p.has_filename) {
+                std::string path;
+                uint64_t n=0;
+                if (!spool_to_file(reader.stream(), "/tmp", path, n)) {
+                    std::cerr << name << ": spooling failed" << std::endl;
+                    std::exit(1);
+                }
+                std::remove(path.c_str());
+                size+=n;
+            } else {
+                std::istream &s=reader.stream();
+                while (s.read(buf.data(), buf.size()) || s.gcount()>0) size+=s.gcount();
+            }
+        }
+        elapsed+=std::chrono::steady_clock::now()-start;
+        if (reader.failed() || size!=file_size+field_value.size()) {
+            std::cerr << name << ": malformed body" << std::endl;
+            std::exit(1);
+        }
+    }
+    double seconds=std::chrono::duration<double>(elapsed).count();
+    std::cout << name << ": " << double(body.size())*count/(1<<20)/seconds << "MB/s" << std::endl;
+}
+
+// Parse a form with a small field and a file of given size (MB, default 64) given
+// times (default 10), once reading the file part from its stream and once spooling it
+int main(int argc, char *argv[]) {
+    size_t size=((argc>1) ? std::strtoul(argv[1], nullptr, 10) : 64)<<20;
+    unsigned count=(argc>2) ? std::strtoul(argv[2], nullptr, 10) : 10;
+    if (count==0) count=1;
+    std::string body="--"+boundary+"\r\n"
+        "Content-Disposition: form-data; name=\"field\"\r\n\r\n"
+        +field_value+"\r\n"
+        "--"+boundary+"\r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"bench.bin\"\r\n"
+        "Content-Type: application/octet-stream\r\n\r\n";
+    body+=file_content(size);
+    body+="\r\n--"+boundary+"--\r\n";
+    run("read", body, size, count, false);
+    run("spool", body, size, count, true);
+    return 0;
+}
@@ -0,0 +1,102 @@
+//
+//  bench_request_decompression.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/11/01.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fibio/fiber.hpp>
+#include <fibio/fiberize.hpp>
+#include <fibio/http/client/client.hpp>
+#include <fibio/http/server/server.hpp>
+#include "gzip.hpp"
+
+using namespace fibio;
+using namespace fibio::http;
+
+// Read the whole body, decompressed by the server if it's encoded, reply its size
+bool handler(server::request &req, server::response &resp, server::connection &) {
+    std::vector<char> buf(65536);
+    size_t size=0;
+    std::istream &s=req.body_stream();
+    while (s.read(buf.data(), buf.size()) || s.gcount()>0) size+=s.gcount();
+    if (req.decompressed_size_exceeded) {
+        resp.status_code=http_status_code::REQUEST_ENTITY_TOO_LARGE;
+        return true;
+    }
+    resp.set_body(std::to_string(size), "text/plain");
+    return true;
+}
+
+// POST the body given times over one keep-alive connection, prints the throughput
+// of decoded body, client and server share the process
+bool run(client &c, const char *name, const std::string &encoding, const std::string &body, size_t body_size, unsigned count) {
+    client::request req;
+    client::response resp;
+    make_request(req, "/upload");
+    req.method=http_method::POST;
+    if (!encoding.empty()) req.headers.insert({"Content-Encoding", encoding});
+    // The body is kept in the request and sent again each time
+    req.body_stream().write(body.data(), body.size());
+    const std::string expected=std::to_string(body_size);
+    auto start=std::chrono::steady_clock::now();
+    for (unsigned i=0; i<count; i++) {
+        if (!c.send_request(req, resp) || resp.status_code!=http_status_code::OK) {
+            std::cerr << name << ": request failed" << std::endl;
+            return false;
+        }
+        std::string got(resp.content_length, '\0');
+        resp.body_stream().read(&got[0], got.size());
+        if (got!=expected) {
+            std::cerr << name << ": server got " << got << " bytes, expected " << expected << std::endl;
+            return false;
+        }
+    }
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    std::cout << name << ": " << (body.size()>>10) << "KB on the wire, "
+              << double(body_size)*count/(1<<20)/seconds << "MB/s of body read"
+              << std::endl;
+    return true;
+}
+
+// POST request bodies of given size (KB, default 1024) given times (default 200),
+// both as sent and gzip encoded, to a server decompressing request bodies
+int fibio::main(int argc, char *argv[]) {
+    size_t size=((argc>1) ? std::strtoul(argv[1], nullptr, 10) : 1024)<<10;
+    unsigned count=(argc>2) ? std::strtoul(argv[2], nullptr, 10) : 200;
+    if (count==0) count=1;
+    // Text like JSON or form data compresses well
+    std::string body;
+    for (unsigned i=0; body.size()<size; i++) {
+        body+="{\"id\":"+std::to_string(i)+",\"name\":\"item "+std::to_string(i*7919)+"\",\"tags\":[\"a\",\"b\"]},\n";
+    }
+    body.resize(size);
+    server::settings s{handler,
+        "127.0.0.1",
+        23474,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60),
+        2*count+1
+    };
+    s.decompress_requests=true;
+    s.max_decompressed_body_size=size+1;
+    server svr(s);
+    svr.start();
+    client c;
+    if (c.connect("127.0.0.1", 23474)) {
+        std::cerr << "connect failed" << std::endl;
+        return 1;
+    }
+    bool ok=run(c, "identity", "", body, size, count);
+    ok=run(c, "gzip", "gzip", gzip(body), size, count) && ok;
+    c.disconnect();
+    svr.stop();
+    svr.join();
+    return ok ? 0 : 1;
+}
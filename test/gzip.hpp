@@ -0,0 +1,29 @@
+//
+//  gzip.hpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/11/01.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#ifndef fibio_http_test_gzip_hpp
+#define fibio_http_test_gzip_hpp
+
+#include <string>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+
+// gzip encoded request bodies for tests and benchmarks
+inline std::string gzip(const std::string &s) {
+    std::string out;
+    {
+        boost::iostreams::filtering_ostream os;
+        os.push(boost::iostreams::gzip_compressor());
+        os.push(boost::iostreams::back_inserter(out));
+        os << s;
+    }
+    return out;
+}
+
+#endif
@@ -0,0 +1,87 @@
+//
+//  soak_keep_alive.cpp
+//  fibio-http
+//
+//  Created by Chen Xu on 14/10/28.
+//  Copyright (c) 2014 0d0a.com. All rights reserved.
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fibio/fiber.hpp>
+#include <fibio/fiberize.hpp>
+#include <fibio/http/client/client.hpp>
+#include <fibio/http/server/server.hpp>
+
+using namespace fibio;
+using namespace fibio::http;
+
+// Resident set size in KB, 0 if unknown
+size_t rss_kb() {
+    std::ifstream f("/proc/self/status");
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.compare(0, 6, "VmRSS:")==0) return std::strtoul(line.c_str()+6, nullptr, 10);
+    }
+    return 0;
+}
+
+bool handler(server::request &req, server::response &resp, server::connection &) {
+    resp.body_stream() << "ok";
+    return true;
+}
+
+// Many keep-alive connections send a request now and then and stay idle in between,
+// memory held by the idle connections is printed after each round. Clients live in
+// the same process, so bytes/connection is an upper bound for the server side
+int fibio::main(int argc, char *argv[]) {
+    size_t connections=(argc>1) ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    unsigned rounds=(argc>2) ? std::strtoul(argv[2], nullptr, 10) : 20;
+    if (connections==0) connections=1;
+    server::settings s{handler,
+        "127.0.0.1",
+        23470,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60),
+        rounds+1
+    };
+    s.idle_timeout=std::chrono::seconds(60);
+    server svr(s);
+    svr.start();
+    size_t base=rss_kb();
+    std::vector<std::unique_ptr<client>> clients;
+    for (size_t i=0; i<connections; i++) {
+        clients.emplace_back(new client);
+        if (clients.back()->connect("127.0.0.1", 23470)) {
+            std::cerr << "connect failed after " << i << " connections" << std::endl;
+            return 1;
+        }
+    }
+    client::request req;
+    client::response resp;
+    for (unsigned r=0; r<rounds; r++) {
+        for (auto &c : clients) {
+            if (!c->send_request(make_request(req, "/"), resp) || resp.status_code!=http_status_code::OK) {
+                std::cerr << "request failed in round " << r << std::endl;
+                return 1;
+            }
+        }
+        // All servants are parked by now
+        this_fiber::sleep_for(std::chrono::milliseconds(500));
+        size_t rss=rss_kb();
+        std::cout << "round " << r
+                  << ": active connections " << svr.get_stats().active_connections
+                  << ", RSS " << rss << "KB"
+                  << ", " << (rss>base ? (rss-base)*1024/connections : 0) << " bytes/connection"
+                  << std::endl;
+    }
+    for (auto &c : clients) c->disconnect();
+    svr.stop();
+    svr.join();
+    return 0;
+}
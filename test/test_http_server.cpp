@@ -9,7 +9,14 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <atomic>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+#include <iterator>
 #include <boost/asio/basic_waitable_timer.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <fibio/fiber.hpp>
@@ -17,11 +24,110 @@
 #include <fibio/http/client/client.hpp>
 #include <fibio/http/server/server.hpp>
 #include <fibio/http/server/routing.hpp>
+#include <fibio/http/server/static_cache.hpp>
+#include <fibio/http/server/multipart.hpp>
+#include <fibio/http/common/parser_backend.hpp>
+#include "gzip.hpp"
 
 using namespace fibio;
 using namespace fibio::http;
 using namespace fibio::http::common;
 
+// Every heap allocation in the process is counted
+static std::atomic<uint64_t> heap_allocations(0);
+
+void *operator new(size_t size) {
+    heap_allocations++;
+    if (void *p=std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+// Content of static.txt
+std::string static_text() {
+    std::ostringstream os;
+    for (int i=0; i<200; i++) os << "line " << i << " of a compressible text file\n";
+    return os.str();
+}
+
+std::string read_file(const std::string &path) {
+    std::ifstream f(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+std::string read_body(client::response &resp) {
+    return std::string(std::istreambuf_iterator<char>(resp.body_stream()), std::istreambuf_iterator<char>());
+}
+
+// Checks a multipart/byteranges response against ranges of the full body, part
+// boundaries and each part's Content-Type/Content-Range must match exactly
+void check_byteranges(client::response &resp,
+                      const std::string &full,
+                      const std::string &part_type,
+                      const std::vector<std::pair<size_t, size_t>> &ranges)
+{
+    assert(resp.status_code==http_status_code::PARTIAL_CONTENT);
+    // Only one Content-Type, the original one goes into the parts
+    std::string content_type;
+    size_t content_types=0;
+    for (auto &h : resp.headers) {
+        if (boost::algorithm::iequals(h.first, "Content-Type")) {
+            content_type=to_string(h.second);
+            content_types++;
+        }
+    }
+    assert(content_types==1);
+    static const std::string prefix="multipart/byteranges; boundary=";
+    assert(boost::algorithm::starts_with(content_type, prefix));
+    std::string boundary=content_type.substr(prefix.size());
+    assert(!boundary.empty());
+    assert(resp.headers.find("Content-Range")==resp.headers.end());
+    std::string expected;
+    for (auto &r : ranges) {
+        expected.append(expected.empty() ? "--" : "\r\n--");
+        expected.append(boundary);
+        expected.append("\r\nContent-Type: ");
+        expected.append(part_type);
+        expected.append("\r\nContent-Range: bytes ");
+        expected.append(std::to_string(r.first)+"-"+std::to_string(r.first+r.second-1)+"/"+std::to_string(full.size()));
+        expected.append("\r\n\r\n");
+        expected.append(full, r.first, r.second);
+    }
+    expected.append("\r\n--"+boundary+"--\r\n");
+    assert(resp.content_length==expected.size());
+    assert(read_body(resp)==expected);
+}
+
+// Single range and multipart/byteranges of the body at url
+void check_ranges(client &c, const std::string &url, const std::string &full) {
+    client::request req;
+    client::response resp;
+    bool ret=c.send_request(make_request(req, url), resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    assert(read_body(resp)==full);
+    auto ct=resp.headers.find("Content-Type");
+    std::string part_type=(ct==resp.headers.end()) ? "text/plain" : to_string(ct->second);
+    
+    make_request(req, url);
+    req.headers.insert(std::make_pair("Range", "bytes=10-19"));
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::PARTIAL_CONTENT);
+    auto cr=resp.headers.find("Content-Range");
+    assert(cr!=resp.headers.end() && cr->second=="bytes 10-19/"+std::to_string(full.size()));
+    assert(read_body(resp)==full.substr(10, 10));
+    
+    make_request(req, url);
+    req.headers.insert(std::make_pair("Range", "bytes=0-9,20-29,-5"));
+    ret=c.send_request(req, resp);
+    assert(ret);
+    check_byteranges(resp, full, part_type, {{0, 10}, {20, 10}, {full.size()-5, 5}});
+}
+
 void the_client() {
     client c;
     if(c.connect("127.0.0.1", 23456)) {
@@ -93,6 +199,225 @@ void the_client() {
     ret=c.send_request(make_request(req, "/test3/with/a/long/and/stupid/url.html"), resp);
     assert(ret);
     assert(resp.status_code==http_status_code::OK);
+    
+    //std::cout << "GET /chunked" << std::endl;
+    ret=c.send_request(make_request(req, "/chunked"), resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    assert(resp.chunked);
+    std::string body((std::istreambuf_iterator<char>(resp.body_stream())), std::istreambuf_iterator<char>());
+    assert(body.size()==100000 && body.find_first_not_of('x')==std::string::npos);
+    
+    //std::cout << "GET /files/server.pem" << std::endl;
+    ret=c.send_request(make_request(req, "/files/server.pem"), resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    body.assign(std::istreambuf_iterator<char>(resp.body_stream()), std::istreambuf_iterator<char>());
+    assert(body.compare(0, 10, "-----BEGIN")==0);
+    
+    // HEAD gets the headers GET would get, no body follows
+    make_request(req, "/files/server.pem");
+    req.method=http_method::HEAD;
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    assert(resp.content_length==body.size());
+    make_request(req, "/chunked");
+    req.method=http_method::HEAD;
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    assert(resp.chunked);
+    
+    ret=c.send_request(make_request(req, "/files/%2E%2E/%2E%2E/etc/passwd"), resp);
+    assert(ret);
+    assert(resp.status_code!=http_status_code::OK);
+    
+    //std::cout << "GET /static/server.pem" << std::endl;
+    ret=c.send_request(make_request(req, "/static/server.pem"), resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    auto etag=resp.headers.find("ETag");
+    assert(etag!=resp.headers.end());
+    make_request(req, "/static/server.pem");
+    req.headers.insert(std::make_pair("If-None-Match", etag->second));
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::NOT_MODIFIED);
+    assert(resp.headers.find("Content-Length")==resp.headers.end());
+    assert(resp.headers.find("Content-Type")==resp.headers.end());
+    
+    // Compressed variant has a weak ETag, its 304 carries the same tag and Vary
+    make_request(req, "/static/static.txt");
+    req.headers.insert(std::make_pair("Accept-Encoding", "gzip"));
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    etag=resp.headers.find("ETag");
+    assert(etag!=resp.headers.end() && boost::algorithm::starts_with(etag->second, "W/"));
+    std::string weak_etag=to_string(etag->second);
+    make_request(req, "/static/static.txt");
+    req.headers.insert(std::make_pair("Accept-Encoding", "gzip"));
+    req.headers.insert(std::make_pair("If-None-Match", weak_etag));
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::NOT_MODIFIED);
+    etag=resp.headers.find("ETag");
+    assert(etag!=resp.headers.end() && etag->second==weak_etag);
+    auto vary=resp.headers.find("Vary");
+    assert(vary!=resp.headers.end() && vary->second=="Accept-Encoding");
+    assert(resp.headers.find("Content-Length")==resp.headers.end());
+    
+    make_request(req, "/files/server.pem");
+    req.headers.insert(std::make_pair("Range", "bytes=0-9"));
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::PARTIAL_CONTENT);
+    body.assign(std::istreambuf_iterator<char>(resp.body_stream()), std::istreambuf_iterator<char>());
+    assert(body=="-----BEGIN");
+    
+    make_request(req, "/static/server.pem");
+    req.headers.insert(std::make_pair("Range", "bytes=1000000-"));
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::REQUESTED_RANGE_NOT_SATISFIABLE);
+    
+    // File, static and buffered bodies, multiple ranges become multipart/byteranges
+    std::string pem=read_file("server.pem");
+    check_ranges(c, "/files/server.pem", pem);
+    check_ranges(c, "/static/server.pem", pem);
+    check_ranges(c, "/text", static_text());
+    
+    // Ranges of a body compressed when sent whole vary by Accept-Encoding as well
+    const std::pair<const char *, http_status_code> text_ranges[]={
+        {"bytes=10-19", http_status_code::PARTIAL_CONTENT},
+        {"bytes=1000000-", http_status_code::REQUESTED_RANGE_NOT_SATISFIABLE},
+    };
+    for (auto &r : text_ranges) {
+        make_request(req, "/text");
+        req.headers.insert(std::make_pair("Range", r.first));
+        ret=c.send_request(req, resp);
+        assert(ret);
+        assert(resp.status_code==r.second);
+        vary=resp.headers.find("Vary");
+        assert(vary!=resp.headers.end() && vary->second=="Accept-Encoding");
+        read_body(resp);
+    }
+    
+    // Range is honored only if If-Range matches the current strong validator
+    ret=c.send_request(make_request(req, "/static/server.pem"), resp);
+    assert(ret);
+    etag=resp.headers.find("ETag");
+    assert(etag!=resp.headers.end() && !boost::algorithm::starts_with(etag->second, "W/"));
+    std::string strong_etag=to_string(etag->second);
+    auto last_modified=resp.headers.find("Last-Modified");
+    assert(last_modified!=resp.headers.end());
+    std::string modified_date=to_string(last_modified->second);
+    read_body(resp);
+    const std::pair<std::string, bool> if_ranges[]={
+        {strong_etag, true},
+        {"\"stale\"", false},
+        {"W/"+strong_etag, false},
+        {modified_date, true},
+        {"Thu, 01 Jan 1970 00:00:00 GMT", false},
+    };
+    for (auto &ir : if_ranges) {
+        make_request(req, "/static/server.pem");
+        req.headers.insert(std::make_pair("Range", "bytes=0-9"));
+        req.headers.insert(std::make_pair("If-Range", ir.first));
+        ret=c.send_request(req, resp);
+        assert(ret);
+        if (ir.second) {
+            assert(resp.status_code==http_status_code::PARTIAL_CONTENT);
+            assert(read_body(resp)==pem.substr(0, 10));
+        } else {
+            // Stale validator, the whole body is sent
+            assert(resp.status_code==http_status_code::OK);
+            assert(resp.headers.find("Content-Range")==resp.headers.end());
+            assert(read_body(resp)==pem);
+        }
+    }
+    
+    make_request(req, "/upload",
+                 "--xyz\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n1\r\n"
+                 "--xyz\r\nContent-Disposition: form-data; name=\"f\"; filename=\"f.txt\"\r\n\r\nhello\r\n"
+                 "--xyz--\r\n");
+    req.set_content_type("multipart/form-data; boundary=xyz");
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    std::string uploaded;
+    resp.body_stream() >> uploaded;
+    assert(uploaded=="1:f.txt:5");
+    
+    // Handler doesn't read the body, it's never sent and the connection is closed
+    make_request(req, "/test2/123", "this is request body");
+    req.headers.insert(std::make_pair("Expect", "100-continue"));
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    assert(!resp.keep_alive);
+    // Announced body was never sent, the connection can't be used any more
+    ret=c.send_request(make_request(req, "/"), resp);
+    assert(!ret);
+    
+    // Over the URL limit, answered without calling the handler
+    client c2;
+    if(c2.connect("127.0.0.1", 23456)) {
+        assert(false);
+    }
+    ret=c2.send_request(make_request(req, "/test3/"+std::string(2048, 'x')), resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::REQUEST_URI_TOO_LONG);
+    assert(!resp.keep_alive);
+    
+    // gzip request bodies are decompressed for the handler
+    client c4;
+    if(c4.connect("127.0.0.1", 23456)) {
+        assert(false);
+    }
+    make_request(req, "/gunzip");
+    req.method=http_method::POST;
+    req.headers.insert(std::make_pair("Content-Encoding", "gzip"));
+    req.body_stream() << gzip(static_text());
+    ret=c4.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    body.assign(std::istreambuf_iterator<char>(resp.body_stream()), std::istreambuf_iterator<char>());
+    assert(body==std::to_string(static_text().size())+":line 0 of a compressible text file");
+    // Small body expanding past max_decompressed_body_size
+    make_request(req, "/gunzip");
+    req.method=http_method::POST;
+    req.headers.insert(std::make_pair("Content-Encoding", "gzip"));
+    req.body_stream() << gzip(std::string(1024*1024, '\n'));
+    ret=c4.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::REQUEST_ENTITY_TOO_LARGE);
+    
+    // Client sends Accept-Encoding: gzip and decodes the body
+    client c3;
+    if(c3.connect("127.0.0.1", 23456)) {
+        assert(false);
+    }
+    c3.set_auto_decompress(true);
+    for (int i=0; i<4; i++) {
+        // Second time the compressed asset or buffered body comes from the cache
+        ret=c3.send_request(make_request(req, (i<2) ? "/static/static.txt" : "/text"), resp);
+        assert(ret);
+        assert(resp.status_code==http_status_code::OK);
+        assert(resp.headers.find("Content-Encoding")->second=="gzip");
+        assert(resp.headers.find("Vary")->second=="Accept-Encoding");
+        body.assign(std::istreambuf_iterator<char>(resp.body_stream()), std::istreambuf_iterator<char>());
+        assert(body==static_text());
+    }
+    ret=c3.send_request(make_request(req, "/chunked"), resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    assert(resp.chunked);
+    assert(resp.headers.find("Content-Encoding")->second=="gzip");
+    assert(resp.headers.find("Vary")->second=="Accept-Encoding");
+    body.assign(std::istreambuf_iterator<char>(resp.body_stream()), std::istreambuf_iterator<char>());
+    assert(body.size()==100000 && body.find_first_not_of('x')==std::string::npos);
 }
 
 void the_url_client() {
@@ -123,6 +448,45 @@ void the_url_client() {
     assert(resp.status_code==http_status_code::OK);
 }
 
+void the_pipelined_client() {
+    tcp_stream s;
+    if(s.connect("127.0.0.1", "23456")) {
+        assert(false);
+    }
+    // Send requests without waiting for responses, responses must come back in order
+    s << "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+      << "GET /index.php HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+      << "POST /test2/123 HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: 4\r\n\r\nbody"
+      << "POST /test2/123 HTTP/1.1\r\nHost: 127.0.0.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+      << "4\r\nbody\r\n0\r\nX-Trailer: 1\r\n\r\n"
+      << "GET /test3/with/a/long/and/stupid/url HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    s.flush();
+    
+    input_buffer buf(s.rdbuf());
+    std::istream is(&buf);
+    client::response resp;
+    assert(resp.read(is));
+    assert(resp.status_code==http_status_code::OK);
+    assert(resp.read(is));
+    assert(resp.status_code==http_status_code::NOT_FOUND);
+    assert(resp.read(is));
+    assert(resp.status_code==http_status_code::OK);
+    assert(resp.read(is));
+    assert(resp.status_code==http_status_code::OK);
+    assert(resp.read(is));
+    assert(resp.status_code==http_status_code::FORBIDDEN);
+}
+
+bool upload_handler(server::request &req, server::response &resp, server::connection &c) {
+    form_data form;
+    if (!read_form_data(req, form) || form.files.size()!=1) {
+        resp.status_code=http_status_code::BAD_REQUEST;
+        return true;
+    }
+    resp.body_stream() << form.fields.find("a")->second << ':' << form.files[0].filename << ':' << form.files[0].size;
+    return true;
+}
+
 bool handler(server::request &req, server::response &resp, server::connection &c) {
     resp.headers.insert({"Header1", "Value1"});
     // Write all headers back in a table
@@ -131,7 +495,7 @@ bool handler(server::request &req, server::response &resp, server::connection &c
     resp.body_stream() << "<H1>Request Info</H1>" << std::endl;
     
     resp.body_stream() << "<TABLE>" << std::endl;
-    resp.body_stream() << "<TR><TD>URL</TD><TD>" << req.url << "</TD></TR>" << std::endl;
+    resp.body_stream() << "<TR><TD>URL</TD><TD>" << req.url_view << "</TD></TR>" << std::endl;
     resp.body_stream() << "<TR><TD>Schema</TD><TD>" << req.parsed_url.schema << "</TD></TR>" << std::endl;
     resp.body_stream() << "<TR><TD>Port</TD><TD>" << req.parsed_url.port << "</TD></TR>" << std::endl;
     resp.body_stream() << "<TR><TD>Path</TD><TD>" << req.parsed_url.path << "</TD></TR>" << std::endl;
@@ -141,7 +505,7 @@ bool handler(server::request &req, server::response &resp, server::connection &c
     
     resp.body_stream() << "<H1>Headers</H1>" << std::endl;
     resp.body_stream() << "<TABLE>" << std::endl;
-    for(auto &p: req.headers) {
+    for(auto &p: req.header_views) {
         resp.body_stream() << "<TR><TD>" << p.first << "</TD><TD>" << p.second << "</TD></TR>" <<std::endl;
     }
     resp.body_stream() << "</TABLE>" << std::endl;
@@ -164,13 +528,49 @@ bool handler(server::request &req, server::response &resp, server::connection &c
     return true;
 }
 
+// Decompressed body size and its first line
+bool gunzip_handler(server::request &req, server::response &resp, server::connection &c) {
+    std::string body;
+    char buf[4096];
+    while (req.body_stream().read(buf, sizeof(buf)) || req.body_stream().gcount()>0) {
+        body.append(buf, req.body_stream().gcount());
+    }
+    if (req.decompressed_size_exceeded) {
+        resp.status_code=http_status_code::REQUEST_ENTITY_TOO_LARGE;
+        return true;
+    }
+    resp.body_stream() << body.size() << ':' << body.substr(0, body.find('\n'));
+    return true;
+}
+
+bool text_handler(server::request &req, server::response &resp, server::connection &c) {
+    resp.set_body(static_text(), "text/plain");
+    return true;
+}
+
+bool chunked_handler(server::request &req, server::response &resp, server::connection &c) {
+    resp.set_content_type("text/plain");
+    for (int i=0; i<100; i++) {
+        resp.chunked_body_stream() << std::string(1000, 'x');
+    }
+    return true;
+}
+
 void http_server() {
-    server svr(server::settings{route({
+    server::settings s{route({
         {path_matches("/")
             || path_matches("/index.html")
             || path_matches("/index.htm"), handler},
         {GET("/test1/:id/test2"), handler},
         {POST("/test2/*p"), handler},
+        {POST("/upload"), upload_handler},
+        {POST("/gunzip"), gunzip_handler},
+        {GET("/chunked"), chunked_handler},
+        {GET("/text"), text_handler},
+        {GET("/files/*"), file_handler{".", "/files"}},
+        {HEAD("/chunked"), chunked_handler},
+        {HEAD("/files/*"), file_handler{".", "/files"}},
+        {GET("/static/*"), cached_file_handler{{".", "/static"}, std::make_shared<static_cache>()}},
         {path_matches("/test3/*p") && url_(iends_with{".html"}), handler},
         {path_matches("/test3/*"), stock_handler{http_status_code::FORBIDDEN}},
         {!method_is(http_method::GET), stock_handler{http_status_code::BAD_REQUEST}}
@@ -179,20 +579,399 @@ void http_server() {
         23456,
         std::chrono::seconds(60),
         std::chrono::seconds(60)
-    });
-    svr.start();
+    };
+    // One listener per scheduler thread
+    s.listeners=4;
+    // Parked keep-alive connections give buffers back
+    s.idle_timeout=std::chrono::seconds(30);
+    s.compress_responses=true;
+    s.decompress_requests=true;
+    s.max_decompressed_body_size=64*1024;
+    s.limits.max_url_length=1024;
     {
+        // Compressible asset for the static cache
+        std::ofstream f("static.txt");
+        f << static_text();
+    }
+    server svr(s);
+    svr.start();
+    // All parser backends must give same results
+    for (auto b : {parser_backend::HTTP_PARSER, parser_backend::SSE4_2, parser_backend::AVX2}) {
+        if (!set_parser_backend(b)) continue;
         // Create some clients, do some requests
         fiber_group fibers;
         size_t n=10;
         for (int i=0; i<n; i++) {
             fibers.create_fiber(the_client);
             fibers.create_fiber(the_url_client);
+            fibers.create_fiber(the_pipelined_client);
         }
         fibers.join_all();
     }
+    set_parser_backend(parser_backend::AUTO);
     svr.stop();
     svr.join();
+    std::remove("static.txt");
+    server::stats st=svr.get_stats();
+    assert(st.accepted.size()==4);
+    assert(std::accumulate(st.accepted.begin(), st.accepted.end(), uint64_t(0))>0);
+    assert(st.handled_requests>0 && st.shed_requests==0 && st.active_connections==0);
+    // Connection arenas are reset after each request
+    arena_counters ac=get_arena_counters();
+    assert(ac.resets>0);
+}
+
+bool slow_handler(server::request &req, server::response &resp, server::connection &c) {
+    this_fiber::sleep_for(std::chrono::milliseconds(20));
+    resp.body_stream() << "slow";
+    return true;
+}
+
+void the_queued_client(std::atomic<unsigned> *shed) {
+    client c;
+    if(c.connect("127.0.0.1", 23458)) {
+        assert(false);
+    }
+    client::request req;
+    client::response resp;
+    for (int i=0; i<10; i++) {
+        assert(c.send_request(make_request(req, "/"), resp));
+        if (resp.status_code==http_status_code::SERVICE_UNAVAILABLE) {
+            (*shed)++;
+            assert(resp.headers.find("Retry-After")!=resp.headers.end());
+            // Delay-based shedding keeps the connection
+            assert(resp.keep_alive);
+        } else {
+            assert(resp.status_code==http_status_code::OK);
+        }
+    }
+}
+
+// Requests queued behind one handler slot wait far longer than codel_target
+void codel_server() {
+    server::settings s{slow_handler,
+        "127.0.0.1",
+        23458,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60)
+    };
+    s.max_inflight_requests=1;
+    s.codel_target=std::chrono::milliseconds(5);
+    s.codel_interval=std::chrono::milliseconds(50);
+    server svr(s);
+    svr.start();
+    std::atomic<unsigned> shed(0);
+    {
+        fiber_group fibers;
+        for (int i=0; i<8; i++) {
+            fibers.create_fiber([&shed](){ the_queued_client(&shed); });
+        }
+        fibers.join_all();
+    }
+    svr.stop();
+    svr.join();
+    server::stats st=svr.get_stats();
+    assert(shed>0);
+    assert(st.delay_shed_requests==shed && st.shed_requests==shed);
+    assert(st.handled_requests+shed==80);
+}
+
+// Past soft_max_connections requests are shed, at max_connections accept pauses
+void overload_server() {
+    server::settings s{handler,
+        "127.0.0.1",
+        23461,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60)
+    };
+    s.soft_max_connections=1;
+    s.retry_after=5;
+    {
+        server svr(s);
+        svr.start();
+        client c1, c2;
+        client::request req;
+        client::response resp;
+        if(c1.connect("127.0.0.1", 23461)) {
+            assert(false);
+        }
+        assert(c1.send_request(make_request(req, "/"), resp));
+        assert(resp.status_code==http_status_code::OK);
+        if(c2.connect("127.0.0.1", 23461)) {
+            assert(false);
+        }
+        assert(c2.send_request(make_request(req, "/"), resp));
+        assert(resp.status_code==http_status_code::SERVICE_UNAVAILABLE);
+        assert(resp.headers.find("Retry-After")->second=="5");
+        assert(!resp.keep_alive);
+        // Server waits for open connections when stopping
+        c1.disconnect();
+        svr.stop();
+        svr.join();
+        assert(svr.get_stats().shed_requests==1);
+    }
+    s.port=23462;
+    s.soft_max_connections=0;
+    s.max_connections=1;
+    {
+        server svr(s);
+        svr.start();
+        client c1;
+        client::request req;
+        client::response resp;
+        if(c1.connect("127.0.0.1", 23462)) {
+            assert(false);
+        }
+        assert(c1.send_request(make_request(req, "/"), resp));
+        assert(resp.status_code==http_status_code::OK);
+        std::atomic<bool> done(false);
+        fiber_group fibers;
+        fibers.create_fiber([&done](){
+            client c2;
+            client::request req;
+            client::response resp;
+            if(c2.connect("127.0.0.1", 23462)) {
+                assert(false);
+            }
+            // Waits in the backlog until the first connection is closed
+            assert(c2.send_request(make_request(req, "/"), resp));
+            assert(resp.status_code==http_status_code::OK);
+            done=true;
+        });
+        this_fiber::sleep_for(std::chrono::milliseconds(300));
+        assert(!done);
+        assert(svr.get_stats().accept_pauses>0);
+        c1.disconnect();
+        fibers.join_all();
+        assert(done);
+        svr.stop();
+        svr.join();
+    }
+}
+
+// Keep-alive connections are parked between requests and closed after idle_timeout
+void idle_server() {
+    server::settings s{handler,
+        "127.0.0.1",
+        23460,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60)
+    };
+    s.idle_timeout=std::chrono::seconds(1);
+    server svr(s);
+    svr.start();
+    client c;
+    if(c.connect("127.0.0.1", 23460)) {
+        assert(false);
+    }
+    client::request req;
+    client::response resp;
+    assert(c.send_request(make_request(req, "/"), resp));
+    assert(resp.status_code==http_status_code::OK && resp.keep_alive);
+    // Parked connection picks up next request
+    this_fiber::sleep_for(std::chrono::milliseconds(300));
+    assert(c.send_request(make_request(req, "/"), resp));
+    assert(resp.status_code==http_status_code::OK && resp.keep_alive);
+    assert(svr.get_stats().active_connections==1);
+    // Idle for longer than idle_timeout, closed by the server
+    this_fiber::sleep_for(std::chrono::milliseconds(1500));
+    assert(svr.get_stats().active_connections==0);
+    assert(!c.send_request(make_request(req, "/"), resp));
+    svr.stop();
+    svr.join();
+}
+
+// Average heap allocations of n keep-alive requests, both sides are counted
+double allocations_per_request(client &c, client::request &req, client::response &resp, size_t n) {
+    uint64_t allocations=heap_allocations;
+    for (size_t i=0; i<n; i++) {
+        assert(c.send_request(req, resp));
+        assert(resp.status_code==http_status_code::OK);
+        assert(read_body(resp)=="ok");
+    }
+    return double(heap_allocations-allocations)/n;
+}
+
+// Header fields copied by the server live in the connection arena, so extra headers
+// cost the server no heap allocation, runs alone to keep other tests out of the count
+void header_allocation_test() {
+    server::settings s{[](server::request &req, server::response &resp, server::connection &c) {
+            resp.set_body("ok", "text/plain");
+            return true;
+        },
+        "127.0.0.1",
+        23465,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60)
+    };
+    s.copy_headers=true;
+    server svr(s);
+    svr.start();
+    client c;
+    if(c.connect("127.0.0.1", 23465)) {
+        assert(false);
+    }
+    client::response resp;
+    client::request plain;
+    make_request(plain, "/");
+    client::request many;
+    make_request(many, "/");
+    // Names and values are too long for short string optimization
+    for (int i=0; i<32; i++) {
+        many.headers.insert({"X-Long-Header-Name-"+std::to_string(i), std::string(64, 'v')});
+    }
+    // Buffers and arena grow to their steady size first
+    allocations_per_request(c, plain, resp, 20);
+    allocations_per_request(c, many, resp, 20);
+    double base=allocations_per_request(c, plain, resp, 200);
+    double with_headers=allocations_per_request(c, many, resp, 200);
+    // Heap-allocated fields would add 64 per request, the client's growing
+    // serialization buffer accounts for a few
+    assert(with_headers<base+16);
+    c.disconnect();
+    svr.stop();
+    svr.join();
+}
+
+// Cached files rewritten in place are reloaded, responses get the new ETag
+void static_cache_server() {
+    server::settings s{route({
+            {GET("/copied/*"), cached_file_handler{{".", "/copied"}, std::make_shared<static_cache>()}},
+            // Every file is memory-mapped
+            {GET("/mapped/*"), cached_file_handler{{".", "/mapped"}, std::make_shared<static_cache>(DEFAULT_STATIC_CACHE_BUDGET, DEFAULT_STATIC_CACHE_BUDGET/16, 0)}},
+        }, stock_handler{http_status_code::NOT_FOUND}),
+        "127.0.0.1",
+        23463,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60)
+    };
+    server svr(s);
+    svr.start();
+    client c;
+    if(c.connect("127.0.0.1", 23463)) {
+        assert(false);
+    }
+    client::request req;
+    client::response resp;
+    for (const char *prefix : {"/mapped/", "/copied/"}) {
+        {
+            std::ofstream f("rewritten.txt");
+            f << "first version";
+        }
+        assert(c.send_request(make_request(req, std::string(prefix)+"rewritten.txt"), resp));
+        assert(resp.status_code==http_status_code::OK);
+        assert(read_body(resp)=="first version");
+        auto etag=resp.headers.find("ETag");
+        assert(etag!=resp.headers.end());
+        std::string first_etag=to_string(etag->second);
+        {
+            // Truncated and rewritten in place
+            std::ofstream f("rewritten.txt");
+            f << "second, longer version";
+        }
+        // Mapped files are checked on each hit, copied ones when invalidation is picked up
+        if (std::string(prefix)=="/copied/") this_fiber::sleep_for(std::chrono::milliseconds(300));
+        assert(c.send_request(make_request(req, std::string(prefix)+"rewritten.txt"), resp));
+        assert(resp.status_code==http_status_code::OK);
+        assert(read_body(resp)=="second, longer version");
+        etag=resp.headers.find("ETag");
+        assert(etag!=resp.headers.end() && etag->second!=first_etag);
+    }
+    c.disconnect();
+    svr.stop();
+    svr.join();
+    std::remove("rewritten.txt");
+}
+
+// Request copied out of a handler stays intact while the connection serves next requests
+void request_copy_server() {
+    std::unique_ptr<common::request> saved;
+    server::request::params_type saved_params;
+    server::settings s{route({
+            {GET("/copy/:id"), [&](server::request &req, server::response &resp, server::connection &c) {
+                if (!saved) {
+                    saved.reset(new common::request(req));
+                    saved_params=req.params;
+                }
+                resp.set_body("copied", "text/plain");
+                return true;
+            }},
+        }, stock_handler{http_status_code::NOT_FOUND}),
+        "127.0.0.1",
+        23464,
+        std::chrono::seconds(60),
+        std::chrono::seconds(60)
+    };
+    server svr(s);
+    svr.start();
+    client c;
+    if(c.connect("127.0.0.1", 23464)) {
+        assert(false);
+    }
+    client::request req;
+    client::response resp;
+    make_request(req, "/copy/first?q=first-query");
+    req.headers.insert({"X-Copied", "first-header-value"});
+    assert(c.send_request(req, resp));
+    assert(resp.status_code==http_status_code::OK && resp.keep_alive);
+    assert(read_body(resp)=="copied");
+    // Same connection, the arena and buffer are reused by a request of the same shape
+    make_request(req, "/copy/other?q=other-query");
+    req.headers.insert({"X-Copied", "other-header-value"});
+    assert(c.send_request(req, resp));
+    assert(resp.status_code==http_status_code::OK);
+    assert(read_body(resp)=="copied");
+    assert(saved);
+    assert(saved->url=="/copy/first?q=first-query");
+    assert(saved->url_view=="/copy/first?q=first-query");
+    auto h=saved->headers.find("X-Copied");
+    assert(h!=saved->headers.end() && h->second=="first-header-value");
+    auto v=saved->header_views.find("X-Copied");
+    assert(v!=saved->header_views.end() && v->second=="first-header-value");
+    assert(saved->parsed_url.path=="/copy/first");
+    assert(saved->parsed_url.query_params.find("q")->second=="first-query");
+    assert(saved_params.find("id")->second=="first");
+    // Copies are not allocated from the connection arena
+    assert(saved->headers.get_allocator().arena_==nullptr);
+    assert(saved->parsed_url.path.get_allocator().arena_==nullptr);
+    assert(saved_params.get_allocator().arena_==nullptr);
+    c.disconnect();
+    svr.stop();
+    svr.join();
+}
+
+// Server not knowing 100-continue, the client sends the body after a while
+void continue_timeout_test() {
+    tcp_stream_acceptor acc("127.0.0.1", 23459);
+    fiber_group fibers;
+    fibers.create_fiber([&acc](){
+        tcp_stream s;
+        boost::system::error_code ec;
+        acc(s, ec);
+        assert(!ec);
+        std::string line;
+        size_t length=0;
+        while (std::getline(s, line) && line!="\r") {
+            if (boost::algorithm::istarts_with(line, "Content-Length:")) length=std::stoul(line.substr(15));
+        }
+        std::string body(length, '\0');
+        s.read(&body[0], length);
+        s << "HTTP/1.1 200 OK\r\nContent-Length: " << body.size() << "\r\nConnection: close\r\n\r\n" << body;
+        s.flush();
+    });
+    client c;
+    if(c.connect("127.0.0.1", 23459)) {
+        assert(false);
+    }
+    c.set_continue_timeout(std::chrono::milliseconds(100));
+    client::request req;
+    client::response resp;
+    make_request(req, "/", "this is request body");
+    req.headers.insert(std::make_pair("Expect", "100-continue"));
+    assert(c.send_request(req, resp));
+    assert(resp.status_code==http_status_code::OK);
+    assert(resp.content_length==req.get_content_length());
+    fibers.join_all();
 }
 
 void the_ssl_client() {
@@ -267,6 +1046,19 @@ void the_ssl_client() {
     ret=c.send_request(make_request(req, "/test3/with/a/long/and/stupid/url.html"), resp);
     assert(ret);
     assert(resp.status_code==http_status_code::OK);
+    
+    // Multipart body is read through the SSL stream
+    make_request(req, "/upload",
+                 "--xyz\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n1\r\n"
+                 "--xyz\r\nContent-Disposition: form-data; name=\"f\"; filename=\"f.txt\"\r\n\r\nhello\r\n"
+                 "--xyz--\r\n");
+    req.set_content_type("multipart/form-data; boundary=xyz");
+    ret=c.send_request(req, resp);
+    assert(ret);
+    assert(resp.status_code==http_status_code::OK);
+    std::string uploaded;
+    resp.body_stream() >> uploaded;
+    assert(uploaded=="1:f.txt:5");
 }
 
 void the_ssl_url_client() {
@@ -317,6 +1109,7 @@ void https_server() {
                 || path_matches("/index.htm"), handler},
             {GET("/test1/:id/test2"), handler},
             {POST("/test2/*p"), handler},
+            {POST("/upload"), upload_handler},
             {path_matches("/test3/*p") && url_(iends_with{".html"}), handler},
             {path_matches("/test3/*"), stock_handler{http_status_code::FORBIDDEN}},
             {!method_is(http_method::GET), stock_handler{http_status_code::BAD_REQUEST}}
@@ -343,9 +1136,16 @@ void https_server() {
 
 int fibio::main(int argc, char *argv[]) {
     scheduler::get_instance().add_worker_thread(3);
+    header_allocation_test();
     fiber_group fibers;
     fibers.create_fiber(http_server);
     fibers.create_fiber(https_server);
+    fibers.create_fiber(codel_server);
+    fibers.create_fiber(continue_timeout_test);
+    fibers.create_fiber(idle_server);
+    fibers.create_fiber(static_cache_server);
+    fibers.create_fiber(request_copy_server);
+    fibers.create_fiber(overload_server);
     fibers.join_all();
     std::cout << "main_fiber exiting" << std::endl;
     return 0;